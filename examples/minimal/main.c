@@ -159,7 +159,7 @@ static void signal_cb(evutil_socket_t fd, short events, void *arg)
 
     fprintf(stderr, "\nSignal received, shutting down...\n");
     g_running = false;
-    ecli_request_exit();
+    ecli_instance_request_exit(NULL);
     event_base_loopbreak(g_event_base);
 }
 
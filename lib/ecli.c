@@ -11,6 +11,17 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <grp.h>
+#include <pwd.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <inttypes.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/queue.h>
@@ -22,71 +33,498 @@
 #include <event2/buffer.h>
 
 #include <ecoli.h>
+#include <histedit.h>
+
+#include <fcntl.h>
+#include <elf.h>
+#include <link.h>
+#ifdef ECLI_HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "ecli.h"
 #include "ecli_cmd.h"
 #include "ecli_yaml.h"
+#include "ecli_types.h"
+#include "ecli_history.h"
+#include "ecli_audit.h"
+
+/*
+ * Help index entry
+ *
+ * One pre-rendered "  path - help" line per command. Entries are sorted
+ * by path and their lines are stored back to back in help_index.text, so
+ * any prefix range is a single contiguous slice of text.
+ */
+typedef struct help_entry {
+    const char *path;      /* Points into text (not NUL-terminated) */
+    size_t      path_len;
+    size_t      off;       /* Line offset in text */
+    size_t      len;       /* Line length, including '\n' */
+} help_entry_t;
+
+typedef struct help_index {
+    help_entry_t *entries;
+    size_t        count;
+    char         *text;
+} help_index_t;
 
 /* Context stack entry */
 typedef struct context_entry {
     TAILQ_ENTRY(context_entry) next;
     char *name;
+    char *arg;               /* Captured argument, NULL for plain groups */
+    const char *arg_id;      /* Id of the argument node (borrowed) */
+    struct ec_node *sub;     /* Group subtree for this context (borrowed) */
+    struct ec_node *lexed;   /* sh_lex(sub), parsed directly (owned) */
+    help_index_t help;       /* Help of this level, built on first "help" */
+    bool help_built;
+    size_t path_len;         /* Length of context_path before this entry */
 } context_entry_t;
 
-/* CLI context structure */
+static struct ec_node *get_child(const struct ec_node *node, size_t i);
+static const char *get_str_value(const struct ec_node *node);
+static void ecli_build_full_command(eecli_ctx_t *cli, const char *line,
+                                    char *full_cmd, size_t size);
+
+static int help_index_build(help_index_t *idx, const struct ec_node *node);
+static void help_index_free(help_index_t *idx);
+static void context_unwind(eecli_ctx_t *cli, int depth);
+
+/*
+ * Completion cache
+ *
+ * Each slot holds the candidates computed for one line prefix: "base" is
+ * the line up to the token being completed and "token" that token when
+ * the candidates were computed. Typing more characters of the same token
+ * only filters the candidates into the slot view, without completing
+ * again from the grammar.
+ */
+#define COMP_CACHE_SLOTS 8
+
+/*
+ * Slots holding candidates of dynamic nodes (application state) are only
+ * reused for a typing burst; the nodes cache their provider themselves.
+ */
+#define COMP_CACHE_DYN_MS 500
+
+typedef struct comp_cand {
+    char *str;        /* Full token */
+    char *display;    /* Text listed on TAB */
+    bool  full;       /* Complete token (EC_COMP_FULL) */
+} comp_cand_t;
+
+typedef struct comp_slot {
+    const struct ec_node *grammar;   /* Grammar completed against (borrowed) */
+    char         *base;
+    char         *token;
+    comp_cand_t  *cands;
+    size_t        count;
+    const comp_cand_t **view;        /* Candidates matching the last token */
+    size_t        nview;
+    bool          dynamic;           /* Has candidates of a dynamic node */
+    struct timespec filled;          /* When the slot was completed */
+    unsigned long used;              /* LRU stamp */
+} comp_slot_t;
+
+typedef struct comp_cache {
+    comp_slot_t   slots[COMP_CACHE_SLOTS];
+    unsigned long clock;
+} comp_cache_t;
+
+static void comp_cache_clear(comp_cache_t *cache);
+
+/*
+ * Per-session scratch arena
+ *
+ * Transient allocations of one command line (prefix expansion, TCP line
+ * buffer, handler scratch space from ecli_scratch()) are bumped from the
+ * session arena and released at once when the line is done, whatever its
+ * outcome. A first chunk of ARENA_CHUNK_SIZE is kept across lines, larger
+ * needs get extra chunks freed on reset.
+ */
+#define ARENA_CHUNK_SIZE 4096
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t              size;
+    size_t              used;
+    max_align_t         data[];
+} arena_chunk_t;
+
+typedef struct arena {
+    arena_chunk_t *head;            /* Current chunk, first one last */
+} arena_t;
+
+/* Callback name -> command node index, built on first "show doc" */
+typedef struct cmd_index cmd_index_t;
+
+static void cmd_index_free(cmd_index_t *idx);
+
+/*
+ * Telnet session state
+ *
+ * With config.telnet, TCP sessions negotiate character mode (server echo,
+ * suppress go-ahead) and the window size, and lines are edited on the
+ * server with the same completion cache and help index as editline.
+ */
+#define TELNET_LINE_MAX 1024
+#define TELNET_HISTORY  32
+
+typedef struct telnet {
+    /* Protocol */
+    uint8_t   state;                   /* TN_DATA, TN_IAC, ... */
+    uint8_t   verb;                    /* WILL/WONT/DO/DONT being received */
+    uint8_t   sb[8];                   /* Subnegotiation data */
+    size_t    sb_len;
+    bool      skip_lf;                 /* CR seen: drop the LF/NUL after it */
+    unsigned int cols;                 /* NAWS window size */
+    unsigned int rows;
+    /* Line editor */
+    uint8_t   esc;                     /* Escape sequence state */
+    char      line[TELNET_LINE_MAX];
+    size_t    len;
+    size_t    pos;                     /* Cursor */
+    char     *hist[TELNET_HISTORY];    /* Ring, hist_count entries pushed */
+    size_t    hist_count;
+    size_t    hist_back;               /* Entries browsed back, 0: editing */
+    char     *stash;                   /* Line being edited while browsing */
+    bool      closing;                 /* ^D on an empty line */
+} telnet_t;
+
+/* TCP/UNIX listener, one per bind address */
+typedef struct ecli_listener {
+    TAILQ_ENTRY(ecli_listener) next;
+    struct evconnlistener *lev;
+    struct eecli_ctx      *server;
+    char                  *unix_path;      /* Socket file removed on shutdown */
+} ecli_listener_t;
+
+/* Accepted connection, handed over to the thread serving it */
+typedef struct ecli_peer {
+    struct ecli_peer       *next;          /* Worker inbox link */
+    evutil_socket_t         fd;
+    struct sockaddr_storage addr;
+    socklen_t               addrlen;
+    bool                    has_cred;      /* UNIX socket credentials */
+    uid_t                   uid;
+    gid_t                   gid;
+    pid_t                   pid;
+} ecli_peer_t;
+
+/* Session worker thread, running its own event_base */
+typedef struct ecli_worker {
+    struct eecli_ctx       *server;
+    pthread_t               thread;
+    bool                    started;
+    struct event_base      *base;
+    struct event           *wake_ev;
+    int                     wake_fd[2];    /* Pipe: accept thread -> worker */
+    _Atomic(ecli_peer_t *)  inbox;         /* Lock-free LIFO of accepted fds */
+    atomic_bool             stop;
+} ecli_worker_t;
+
+/*
+ * Output registrations, kept in an immutable array sorted by priority
+ *
+ * A registration copies the array with the new entry and publishes the
+ * copy, so ecli_dump_running_config() walks a consistent snapshot without
+ * a lock from any thread. Readers are counted: replaced snapshots are
+ * retired and freed once no reader is left, which during the constructor
+ * time registrations is right away.
+ */
+typedef struct out_snapshot {
+    struct out_snapshot *prev;          /* Next retired snapshot */
+    size_t               count;
+    ecli_out_entry_t    *entries[];
+} out_snapshot_t;
+
+typedef struct out_registry {
+    _Atomic(out_snapshot_t *) snap;
+    atomic_uint               readers;  /* Walking a snapshot */
+    out_snapshot_t           *retired;  /* Replaced snapshots, under lock */
+    pthread_mutex_t           lock;     /* Serializes registrations */
+} out_registry_t;
+
+/*
+ * CLI context structure
+ *
+ * The context created by ecli_new*() is the instance: it owns the
+ * grammar, indexes, outputs and, in TCP mode, the listeners. Each
+ * accepted connection gets its own session context pointing back to it,
+ * with its own buffer, context stack and prompt.
+ */
 struct eecli_ctx {
     ecli_mode_t            mode;
     ecli_config_t          config;
     struct event_base    *event_base;
     bool                  owns_event_base; /* true if we created the event_base */
     struct event         *stdin_event;     /* stdin read event for STDIN mode */
-    struct evconnlistener *listener;
     struct bufferevent   *client_bev;
     struct ec_editline   *editline;
     struct ec_node       *grammar;
+    help_index_t          help_index;      /* Built once from grammar */
+    comp_cache_t          comp_cache;      /* TAB and prefix expansion results */
+    arena_t               arena;           /* Scratch memory of the current line */
+    cmd_index_t          *cmd_index;       /* Built on first doc lookup */
+    out_registry_t        outputs;         /* Instance outputs (write terminal) */
+    _Atomic(volatile bool *) running;      /* Flag of ecli_instance_run() */
+    struct event         *exit_ev;         /* Breaks the loop of ecli_instance_run() */
+    int                   exit_fd[2];      /* Pipe: ecli_request_exit() -> loop */
     uint16_t              tcp_port;
-    bool                  has_client;
     bool                  use_editline;
     bool                  use_yaml;
     bool                  use_event_loop;  /* true if using libevent for stdin */
-    /* Connected client address (for TCP mode) */
+    History              *history;         /* Editline history */
+    ecli_history_t       *hist_log;        /* config.history_file, shared by sessions */
+    ecli_audit_t         *audit;           /* config.audit_file, shared by sessions */
+    bool                  el_reading;      /* Editline in unbuffered mode */
+    /* TCP server: listeners and sessions (session list shared with shards) */
+    TAILQ_HEAD(listener_head, ecli_listener) listeners;
+    TAILQ_HEAD(session_head, eecli_ctx) sessions;
+    unsigned int          nsessions;
+    pthread_mutex_t       session_lock;
+    gid_t                 unix_gid;        /* Resolved config.unix_group */
+    bool                  has_unix_gid;
+    uid_t                *unix_uids;       /* Its listed members, sorted */
+    size_t                unix_nuids;
+    ecli_worker_t        *workers;         /* config.workers threads */
+    unsigned int          nworkers;
+    atomic_uint           next_worker;     /* Round-robin */
+    atomic_bool           sharded;         /* Listeners on other event_bases */
+    /* TCP session: owning server and connected client address */
+    struct eecli_ctx     *server;
+    TAILQ_ENTRY(eecli_ctx) session_next;
     struct sockaddr_storage client_addr;
     socklen_t             client_addrlen;
+    telnet_t             *telnet;          /* Telnet session, NULL for raw lines */
+    /* TCP session limits (idle_timeout, max_line, max_output, max_cmd_rate) */
+    struct event         *rate_ev;         /* Resumes reading once throttled */
+    bool                  throttled;
+    uint64_t              rate_tokens;     /* Commands available, in 1/1000 */
+    uint64_t              rate_stamp_ms;
+    bool                  discard_line;    /* Dropping the rest of a too long line */
+    size_t                out_dropped;     /* Output bytes over max_output */
+    bool                  closing;         /* Flushing output before close */
+    /* UNIX session: peer credentials read at accept time */
+    bool                  has_peer_cred;
+    uid_t                 peer_uid;
+    gid_t                 peer_gid;
+    pid_t                 peer_pid;
+    int                   handler_ret;     /* Result of the last handler run */
     /* Context mode support */
     TAILQ_HEAD(context_stack_head, context_entry) context_stack;
     int                   context_depth;
-    char                  current_prompt[256];
+    int                   match_depth;     /* Level run_line() matched, -1 if none */
+    char                 *context_path;    /* "a-b-c", kept in sync with the stack */
+    size_t                context_path_len;
+    size_t                context_path_cap;
+    char                 *current_prompt;
     /* Line buffer for stdin event-based reading */
     char                  stdin_buf[1024];
     size_t                stdin_buf_len;
 };
 
-/* Global CLI context */
-static eecli_ctx_t *g_ecli_ctx = NULL;
+/*
+ * Default instance, behind the ecli_init*() API
+ *
+ * Published once fully set up and read without a lock by threads calling
+ * ecli_output() and friends with a NULL cli.
+ */
+static _Atomic(eecli_ctx_t *) g_ecli_ctx = NULL;
+
+/* Foreground instance owning the terminal, at most one per process */
+static _Atomic(eecli_ctx_t *) g_stdin_ctx = NULL;
+static atomic_bool g_stdin_used = false;
 
-/* Running flag pointer */
-static volatile bool *g_running = NULL;
+/* Held around command handlers of sessions served by worker threads */
+static pthread_mutex_t g_handler_lock = PTHREAD_MUTEX_INITIALIZER;
 
-/* Context group registry - keywords that can be entered as contexts */
-typedef struct context_group {
-    SLIST_ENTRY(context_group) next;
-    const char *keyword;
-} context_group_t;
+/* Handlers running in this thread, the handler lock is only taken once */
+static _Thread_local unsigned int t_handler_depth = 0;
 
-static SLIST_HEAD(, context_group) g_context_groups = SLIST_HEAD_INITIALIZER(g_context_groups);
+/* Session or instance whose command runs in this thread */
+static _Thread_local eecli_ctx_t *t_cur_cli = NULL;
 
 /*
- * Register a keyword as a context group
+ * Context for a possibly NULL cli argument: the session running the
+ * current command, else the default instance
  */
-void ecli_register_context_group(const char *keyword)
+static eecli_ctx_t *ecli_cur(eecli_ctx_t *cli)
+{
+    if (cli)
+        return cli;
+    return t_cur_cli ? t_cur_cli : atomic_load_explicit(&g_ecli_ctx, memory_order_acquire);
+}
+
+/*
+ * Server context owning the grammar indexes shared by its sessions
+ */
+static eecli_ctx_t *ecli_server(eecli_ctx_t *cli)
+{
+    return cli->server ? cli->server : cli;
+}
+
+static void *arena_alloc(arena_t *arena, size_t size)
+{
+    arena_chunk_t *c = arena->head;
+    size_t align = sizeof(max_align_t);
+
+    size = (size + align - 1) & ~(align - 1);
+    if (!c || c->size - c->used < size) {
+        size_t csize = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+
+        c = malloc(sizeof(*c) + csize);
+        if (!c)
+            return NULL;
+        c->size = csize;
+        c->used = 0;
+        c->next = arena->head;
+        arena->head = c;
+    }
+    c->used += size;
+    return (char *)c->data + c->used - size;
+}
+
+/*
+ * Release everything but the first chunk, kept only if it has the
+ * standard size: a large first allocation does not stay for the life of
+ * the session
+ */
+static void arena_reset(arena_t *arena)
+{
+    arena_chunk_t *c = arena->head;
+
+    while (c && c->next) {
+        arena_chunk_t *next = c->next;
+        free(c);
+        c = next;
+    }
+    if (c && c->size != ARENA_CHUNK_SIZE) {
+        free(c);
+        c = NULL;
+    }
+    arena->head = c;
+    if (c)
+        c->used = 0;
+}
+
+static void arena_free(arena_t *arena)
+{
+    arena_reset(arena);
+    free(arena->head);
+    arena->head = NULL;
+}
+
+static char *arena_strdup(arena_t *arena, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = arena_alloc(arena, len);
+
+    if (copy)
+        memcpy(copy, str, len);
+    return copy;
+}
+
+/*
+ * Scratch memory only exists while a handler runs: elsewhere nothing
+ * would release it, and the arena is not protected by the handler lock
+ */
+void *ecli_scratch(eecli_ctx_t *cli, size_t size)
+{
+    if (t_handler_depth == 0)
+        return NULL;
+    cli = ecli_cur(cli);
+    return cli ? arena_alloc(&cli->arena, size) : NULL;
+}
+
+char *ecli_scratch_strdup(eecli_ctx_t *cli, const char *str)
+{
+    if (t_handler_depth == 0)
+        return NULL;
+    cli = ecli_cur(cli);
+    return cli && str ? arena_strdup(&cli->arena, str) : NULL;
+}
+
+/*
+ * Stop an instance: clear its running flag, set by ecli_instance_run(),
+ * and wake up its event loop to break it
+ *
+ * Safe from any thread and from signal handlers: only atomics and a
+ * write() to the exit pipe.
+ */
+static void ecli_running_clear(eecli_ctx_t *cli)
 {
-    context_group_t *grp = malloc(sizeof(*grp));
-    if (!grp) {
-        fprintf(stderr, " Failed to allocate context group\n");
+    volatile bool *running;
+    char c = 0;
+
+    if (!cli)
         return;
+    cli = ecli_server(cli);
+    running = atomic_load_explicit(&cli->running, memory_order_acquire);
+    if (running)
+        *running = false;
+    if (cli->exit_fd[1] >= 0) {
+        ssize_t ret = write(cli->exit_fd[1], &c, 1);
+        (void)ret; /* Pipe full: a wakeup is already pending */
+    }
+}
+
+static void exit_wake_cb(evutil_socket_t fd, short events, void *arg)
+{
+    eecli_ctx_t *cli = arg;
+    char buf[64];
+    (void)events;
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+    event_base_loopbreak(cli->event_base);
+}
+
+/*
+ * Set up the exit wakeup of an instance, once its event_base is known
+ */
+static int exit_wake_init(eecli_ctx_t *cli)
+{
+    if (pipe(cli->exit_fd) < 0) {
+        cli->exit_fd[0] = cli->exit_fd[1] = -1;
+        fprintf(stderr, " Failed to create exit pipe: %s\n", strerror(errno));
+        return -1;
+    }
+    evutil_make_socket_nonblocking(cli->exit_fd[0]);
+    evutil_make_socket_nonblocking(cli->exit_fd[1]);
+    evutil_make_socket_closeonexec(cli->exit_fd[0]);
+    evutil_make_socket_closeonexec(cli->exit_fd[1]);
+    cli->exit_ev = event_new(cli->event_base, cli->exit_fd[0], EV_READ | EV_PERSIST,
+                             exit_wake_cb, cli);
+    if (!cli->exit_ev || event_add(cli->exit_ev, NULL) < 0) {
+        fprintf(stderr, " Failed to create exit event\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void exit_wake_free(eecli_ctx_t *cli)
+{
+    if (cli->exit_ev)
+        event_free(cli->exit_ev);
+    cli->exit_ev = NULL;
+    if (cli->exit_fd[0] >= 0) {
+        close(cli->exit_fd[0]);
+        close(cli->exit_fd[1]);
     }
-    grp->keyword = keyword;
-    SLIST_INSERT_HEAD(&g_context_groups, grp, next);
+    cli->exit_fd[0] = cli->exit_fd[1] = -1;
+}
+
+/*
+ * Register a keyword as a context group
+ *
+ * Kept for compatibility: groups are now found in the grammar when their
+ * keyword is entered, so no registration is needed.
+ */
+void ecli_register_context_group(const char *keyword)
+{
+    (void)keyword;
 }
 
 /*
@@ -94,25 +532,25 @@ void ecli_register_context_group(const char *keyword)
  */
 void ecli_request_exit(void)
 {
-    if (g_running)
-        *g_running = false;
+    ecli_running_clear(ecli_cur(NULL));
 }
 
 /*
- * Check if a keyword is a registered context group
+ * Request an instance to exit, the default one when inst is NULL
+ *
+ * Reads no thread-local state, only the atomic default instance pointer,
+ * so it can be used from signal handlers.
  */
-static bool is_context_group(const char *keyword)
+void ecli_instance_request_exit(eecli_ctx_t *inst)
 {
-    context_group_t *grp;
-    SLIST_FOREACH(grp, &g_context_groups, next) {
-        if (strcmp(grp->keyword, keyword) == 0)
-            return true;
-    }
-    return false;
+    if (!inst)
+        inst = atomic_load_explicit(&g_ecli_ctx, memory_order_acquire);
+    ecli_running_clear(inst);
 }
 
 static void ecli_write(eecli_ctx_t *cli, const char *fmt, ...)
     __attribute__((format(printf, 2, 3)));
+static void session_send(eecli_ctx_t *cli, const char *buf, size_t len);
 
 static void ecli_write(eecli_ctx_t *cli, const char *fmt, ...)
 {
@@ -127,67 +565,327 @@ static void ecli_write(eecli_ctx_t *cli, const char *fmt, ...)
         fputs(buf, stdout);
         fflush(stdout);
     } else if (cli->client_bev) {
-        bufferevent_write(cli->client_bev, buf, strlen(buf));
+        session_send(cli, buf, strlen(buf));
+    }
+}
+
+/*
+ * Write a preformatted buffer as is (no length limit, no formatting)
+ */
+static void ecli_write_buf(eecli_ctx_t *cli, const char *buf, size_t len)
+{
+    if (cli->mode == ECLI_MODE_STDIN) {
+        fwrite(buf, 1, len, stdout);
+        fflush(stdout);
+    } else if (cli->client_bev) {
+        session_send(cli, buf, len);
     }
 }
 
+/*
+ * Rebuild the prompt from the context path
+ *
+ * With editline, the prompt and the node used for completion are
+ * switched to the current context level as well.
+ */
 static void ecli_update_prompt(eecli_ctx_t *cli)
 {
+    context_entry_t *top = TAILQ_LAST(&cli->context_stack, context_stack_head);
+    char *prompt = NULL;
+
     if (cli->context_depth == 0) {
-        snprintf(cli->current_prompt, sizeof(cli->current_prompt),
-                 "%s", cli->config.prompt);
+        prompt = strdup(cli->config.prompt);
     } else {
-        /* Build prompt with context path */
-        char context_path[128] = "";
-        context_entry_t *entry;
-        int first = 1;
-        TAILQ_FOREACH(entry, &cli->context_stack, next) {
-            if (!first)
-                strncat(context_path, "-", sizeof(context_path) - strlen(context_path) - 1);
-            strncat(context_path, entry->name,
-                    sizeof(context_path) - strlen(context_path) - 1);
-            first = 0;
-        }
         /* Remove trailing "> " or "# " from base prompt and add context */
-        char base[64];
-        strncpy(base, cli->config.prompt, sizeof(base) - 1);
-        base[sizeof(base) - 1] = '\0';
+        const char *base = cli->config.prompt;
         size_t len = strlen(base);
         if (len >= 2 && (base[len-2] == '>' || base[len-2] == '#')) {
-            base[len-2] = '\0';
+            len -= 2;
         } else if (len >= 1 && (base[len-1] == '>' || base[len-1] == '#')) {
-            base[len-1] = '\0';
+            len -= 1;
         }
-        snprintf(cli->current_prompt, sizeof(cli->current_prompt),
-                 "%.*s(%.128s)> ", (int)(sizeof(base) - 5), base, context_path);
+        if (asprintf(&prompt, "%.*s(%s)> ", (int)len, base,
+                     cli->context_path) < 0)
+            prompt = NULL;
+    }
+    if (!prompt) {
+        fprintf(stderr, "Failed to allocate prompt\n");
+        return;
+    }
+    free(cli->current_prompt);
+    cli->current_prompt = prompt;
+
+    if (cli->editline) {
+        ec_editline_set_prompt(cli->editline, cli->current_prompt);
+        ec_editline_set_node(cli->editline,
+                             top && top->lexed ? top->lexed : cli->grammar);
     }
 }
 
 static void ecli_prompt(eecli_ctx_t *cli)
 {
-    ecli_write(cli, "%s", cli->current_prompt);
+    if (cli->out_dropped) {
+        char msg[96];
+        int n = snprintf(msg, sizeof(msg), "\r\n%% Output truncated, %zu bytes dropped\r\n",
+                         cli->out_dropped);
+
+        /* Past the cap on purpose, it is short */
+        cli->out_dropped = 0;
+        bufferevent_write(cli->client_bev, msg, n);
+    }
+    ecli_write(cli, "%s", cli->current_prompt ? cli->current_prompt : "");
 }
 
 /*
- * Enter a context mode
+ * Find the subtree of a context keyword below node
+ *
+ * Groups are seq(str(keyword), or(subcommands)) nodes and contexts with
+ * an argument carry an ECLI_CTX_ATTR descriptor; both hang off "or"
+ * nodes, so only or/sh_lex nodes are searched.
+ *
+ * @param node    Grammar level to search
+ * @param keyword Context keyword
+ * @param defp    Set to the context descriptor, or NULL for a plain group
+ * @return The context subtree, or NULL if keyword is not a context here
+ */
+static struct ec_node *find_context_node(const struct ec_node *node,
+                                         const char *keyword,
+                                         const ecli_context_def_t **defp)
+{
+    size_t n = ec_node_get_children_count(node);
+
+    for (size_t i = 0; i < n; i++) {
+        struct ec_node *child = get_child(node, i);
+        struct ec_dict *attrs;
+        const ecli_context_def_t *def;
+        const char *type;
+
+        if (!child)
+            continue;
+        attrs = ec_node_attrs(child);
+        def = attrs ? ec_dict_get(attrs, ECLI_CTX_ATTR) : NULL;
+        if (def) {
+            if (strcmp(def->keyword, keyword) == 0) {
+                *defp = def;
+                return *def->sub;
+            }
+            continue;
+        }
+        type = ec_node_type_name(ec_node_type(child));
+
+        if (strcmp(type, "seq") == 0 &&
+            ec_node_get_children_count(child) == 2) {
+            struct ec_node *first = get_child(child, 0);
+            const char *str = first &&
+                strcmp(ec_node_type_name(ec_node_type(first)), "str") == 0 ?
+                get_str_value(first) : NULL;
+            if (str && strcmp(str, keyword) == 0) {
+                *defp = NULL;
+                return get_child(child, 1);
+            }
+        } else if (strcmp(type, "or") == 0 || strcmp(type, "sh_lex") == 0) {
+            struct ec_node *found = find_context_node(child, keyword, defp);
+            if (found)
+                return found;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Append "-label" to the context path, growing it as needed
+ */
+static int context_path_append(eecli_ctx_t *cli, const char *name,
+                               const char *arg)
+{
+    size_t need = cli->context_path_len + strlen(name) + 3 +
+                  (arg ? strlen(arg) : 0);
+
+    if (need > cli->context_path_cap) {
+        size_t cap = cli->context_path_cap ? cli->context_path_cap : 64;
+        char *path;
+
+        while (cap < need)
+            cap *= 2;
+        path = realloc(cli->context_path, cap);
+        if (!path)
+            return -1;
+        cli->context_path = path;
+        cli->context_path_cap = cap;
+    }
+
+    cli->context_path_len += sprintf(cli->context_path + cli->context_path_len,
+                                     "%s%s%s%s", cli->context_depth ? "-" : "",
+                                     name, arg ? "-" : "", arg ? arg : "");
+    return 0;
+}
+
+/*
+ * Push a context level
+ *
+ * The subtree reached by the new context is wrapped once in its own
+ * lexer, so lines typed in the context are parsed against it directly
+ * instead of being prefixed with the context path and matched again
+ * from the root. Without a subtree, lines fall back to the full grammar.
+ *
+ * @param name   Context keyword
+ * @param arg_id Id of the captured argument (borrowed), or NULL
+ * @param arg    Captured argument (copied), or NULL
+ * @param sub    Subtree of the context level (borrowed), or NULL
+ * @return 0 on success, -1 on allocation failure
  */
-static int ecli_enter_context(eecli_ctx_t *cli, const char *context)
+static int context_push(eecli_ctx_t *cli, const char *name, const char *arg_id,
+                        const char *arg, struct ec_node *sub)
 {
-    context_entry_t *entry = malloc(sizeof(*entry));
+    context_entry_t *entry = calloc(1, sizeof(*entry));
     if (!entry)
         return -1;
 
-    entry->name = strdup(context);
-    if (!entry->name) {
-        free(entry);
-        return -1;
+    entry->name = strdup(name);
+    entry->arg = arg ? strdup(arg) : NULL;
+    if (!entry->name || (arg && !entry->arg))
+        goto fail;
+    entry->arg_id = arg_id;
+
+    if (sub) {
+        entry->lexed = ec_node_sh_lex(EC_NO_ID, ec_node_clone(sub));
+        if (entry->lexed)
+            entry->sub = sub;
     }
 
+    entry->path_len = cli->context_path_len;
+    if (context_path_append(cli, name, entry->arg) < 0)
+        goto fail;
+
     TAILQ_INSERT_TAIL(&cli->context_stack, entry, next);
 
     cli->context_depth++;
     ecli_update_prompt(cli);
     return 0;
+
+fail:
+    if (entry->lexed)
+        ec_node_free(entry->lexed);
+    free(entry->arg);
+    free(entry->name);
+    free(entry);
+    return -1;
+}
+
+/*
+ * Grammar level where context keywords are looked up: the current
+ * context subtree, or the full grammar at top level (NULL when the
+ * current context has no subtree)
+ */
+static const struct ec_node *context_level(eecli_ctx_t *cli)
+{
+    context_entry_t *top = TAILQ_LAST(&cli->context_stack, context_stack_head);
+
+    if (!top)
+        return cli->grammar;
+    return top->sub;
+}
+
+/*
+ * Enter a context mode
+ */
+int ecli_enter_context(eecli_ctx_t *cli, const char *name, const char *arg)
+{
+    eecli_ctx_t *ctx = ecli_cur(cli);
+    const ecli_context_def_t *def = NULL;
+    const struct ec_node *level;
+    struct ec_node *sub = NULL;
+
+    if (!ctx || !name)
+        return -1;
+
+    level = context_level(ctx);
+    if (level)
+        sub = find_context_node(level, name, &def);
+
+    return context_push(ctx, name, def ? def->arg_id : NULL, arg, sub);
+}
+
+/*
+ * Enter the context(s) matched by a parse tree
+ *
+ * A line like "interface eth0 vlan 10" matches two context descriptors,
+ * pushed outermost first. When run_line() matched the line at an outer
+ * level ("interface eth1" typed in "interface eth0"), the levels inside
+ * it are left first, so the new context replaces them.
+ */
+int ecli_context_enter_cb(eecli_ctx_t *cli, const struct ec_pnode *parse)
+{
+    const struct ec_pnode *p;
+    int entered = 0;
+
+    EC_PNODE_FOREACH(p, parse) {
+        struct ec_dict *attrs = ec_node_attrs(ec_pnode_get_node(p));
+        const ecli_context_def_t *def;
+        const char *arg;
+
+        def = attrs ? ec_dict_get(attrs, ECLI_CTX_ATTR) : NULL;
+        if (!def)
+            continue;
+        /* Matched from an outer level: leave the inner ones first */
+        if (entered == 0 && cli->match_depth >= 0)
+            context_unwind(cli, cli->match_depth);
+        arg = def->arg_id ? ecli_arg_str(p, def->arg_id) : NULL;
+        if (context_push(cli, def->keyword, def->arg_id, arg, *def->sub) < 0) {
+            ecli_err(cli, "Failed to enter context %s\n", def->keyword);
+            return -1;
+        }
+        entered++;
+    }
+
+    if (entered == 0) {
+        ecli_err(cli, "No context to enter\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Argument captured by the innermost context named name
+ */
+const char *ecli_context_arg(eecli_ctx_t *cli, const char *name)
+{
+    eecli_ctx_t *ctx = ecli_cur(cli);
+    context_entry_t *entry;
+
+    if (!ctx)
+        return NULL;
+    TAILQ_FOREACH_REVERSE(entry, &ctx->context_stack, context_stack_head, next) {
+        if (strcmp(entry->name, name) == 0)
+            return entry->arg;
+    }
+    return NULL;
+}
+
+const char *ecli_arg_ctx_str(eecli_ctx_t *cli, const struct ec_pnode *parse,
+                             const char *id)
+{
+    eecli_ctx_t *ctx = ecli_cur(cli);
+    const char *str = parse ? ecli_arg_str(parse, id) : NULL;
+    context_entry_t *entry;
+
+    if (str || !ctx)
+        return str;
+    TAILQ_FOREACH_REVERSE(entry, &ctx->context_stack, context_stack_head, next) {
+        if (entry->arg_id && strcmp(entry->arg_id, id) == 0)
+            return entry->arg;
+    }
+    return NULL;
+}
+
+static void context_entry_free(context_entry_t *entry)
+{
+    if (entry->lexed)
+        ec_node_free(entry->lexed);
+    help_index_free(&entry->help);
+    free(entry->arg);
+    free(entry->name);
+    free(entry);
 }
 
 /*
@@ -204,15 +902,41 @@ static int ecli_exit_context(eecli_ctx_t *cli)
     context_entry_t *entry = TAILQ_LAST(&cli->context_stack, context_stack_head);
     if (entry) {
         TAILQ_REMOVE(&cli->context_stack, entry, next);
-        free(entry->name);
-        free(entry);
+        cli->context_path_len = entry->path_len;
+        cli->context_path[cli->context_path_len] = '\0';
+        context_entry_free(entry);
         cli->context_depth--;
+        comp_cache_clear(&cli->comp_cache);
     }
 
     ecli_update_prompt(cli);
     return 0;
 }
 
+/*
+ * Leave the context levels deeper than depth
+ */
+static void context_unwind(eecli_ctx_t *cli, int depth)
+{
+    while (cli->context_depth > depth)
+        ecli_exit_context(cli);
+}
+
+/*
+ * Context entry at depth (1 for the outermost one), NULL for the top level
+ */
+static context_entry_t *context_entry_at(eecli_ctx_t *cli, int depth)
+{
+    context_entry_t *entry;
+    int d = 0;
+
+    TAILQ_FOREACH(entry, &cli->context_stack, next) {
+        if (++d == depth)
+            return entry;
+    }
+    return NULL;
+}
+
 /*
  * Exit all contexts and return to top level
  */
@@ -221,13 +945,38 @@ static void ecli_exit_all_contexts(eecli_ctx_t *cli)
     context_entry_t *entry, *tmp;
     TAILQ_FOREACH_SAFE(entry, &cli->context_stack, next, tmp) {
         TAILQ_REMOVE(&cli->context_stack, entry, next);
-        free(entry->name);
-        free(entry);
+        context_entry_free(entry);
     }
     cli->context_depth = 0;
+    cli->context_path_len = 0;
+    comp_cache_clear(&cli->comp_cache);
+    if (cli->context_path)
+        cli->context_path[0] = '\0';
     ecli_update_prompt(cli);
 }
 
+/*
+ * Grammar to parse lines typed in the current context
+ *
+ * Returns the cached context subtree, or the full grammar with *cmd set
+ * to the line prefixed by the context path when there is no subtree.
+ */
+static struct ec_node *ecli_context_grammar(eecli_ctx_t *cli, const char *line,
+                                            const char **cmd, char *buf, size_t size)
+{
+    context_entry_t *top = TAILQ_LAST(&cli->context_stack, context_stack_head);
+
+    *cmd = line;
+    if (!top)
+        return cli->grammar;
+    if (top->lexed)
+        return top->lexed;
+
+    ecli_build_full_command(cli, line, buf, size);
+    *cmd = buf;
+    return cli->grammar;
+}
+
 /*
  * Build full command by prepending context prefix
  */
@@ -239,23 +988,326 @@ static void ecli_build_full_command(eecli_ctx_t *cli, const char *line, char *fu
         return;
     }
 
-    /* Prepend all context levels */
+    /* Prepend all context levels and their arguments */
     full_cmd[0] = '\0';
     context_entry_t *entry;
     TAILQ_FOREACH(entry, &cli->context_stack, next) {
         strncat(full_cmd, entry->name, size - strlen(full_cmd) - 1);
         strncat(full_cmd, " ", size - strlen(full_cmd) - 1);
+        if (entry->arg) {
+            strncat(full_cmd, entry->arg, size - strlen(full_cmd) - 1);
+            strncat(full_cmd, " ", size - strlen(full_cmd) - 1);
+        }
     }
     strncat(full_cmd, line, size - strlen(full_cmd) - 1);
 }
 
+static void comp_slot_free(comp_slot_t *slot)
+{
+    for (size_t i = 0; i < slot->count; i++) {
+        free(slot->cands[i].str);
+        free(slot->cands[i].display);
+    }
+    free(slot->cands);
+    free(slot->view);
+    free(slot->base);
+    free(slot->token);
+    memset(slot, 0, sizeof(*slot));
+}
+
+static long comp_slot_age_ms(const comp_slot_t *slot)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - slot->filled.tv_sec) * 1000 +
+           (now.tv_nsec - slot->filled.tv_nsec) / 1000000;
+}
+
+/*
+ * Drop all cached completions (grammar or context change)
+ */
+static void comp_cache_clear(comp_cache_t *cache)
+{
+    for (size_t i = 0; i < COMP_CACHE_SLOTS; i++)
+        comp_slot_free(&cache->slots[i]);
+}
+
+/*
+ * Complete line against grammar into slot
+ *
+ * @return 0 on success, -1 on failure (slot left empty)
+ */
+static int comp_slot_fill(comp_slot_t *slot, const struct ec_node *grammar,
+                          const char *line, size_t base_len)
+{
+    struct ec_comp *comp = ec_complete(grammar, line);
+    struct ec_comp_item *item;
+    size_t n;
+
+    if (!comp)
+        return -1;
+
+    n = ec_comp_count(comp, EC_COMP_FULL | EC_COMP_PARTIAL);
+    slot->grammar = grammar;
+    slot->base = strndup(line, base_len);
+    slot->token = strdup(line + base_len);
+    slot->cands = calloc(n ? n : 1, sizeof(*slot->cands));
+    slot->view = calloc(n ? n : 1, sizeof(*slot->view));
+    if (!slot->base || !slot->token || !slot->cands || !slot->view)
+        goto fail;
+
+    EC_COMP_FOREACH(item, comp, EC_COMP_FULL | EC_COMP_PARTIAL) {
+        const char *str = ec_comp_item_get_str(item);
+        const char *display = ec_comp_item_get_display(item);
+        comp_cand_t *cand = &slot->cands[slot->count];
+
+        if (!str || slot->count == n)
+            continue;
+
+        /* Alternatives may offer the same word more than once */
+        size_t i;
+        for (i = 0; i < slot->count && strcmp(slot->cands[i].str, str) != 0; i++)
+            ;
+        if (i < slot->count)
+            continue;
+        cand->str = strdup(str);
+        cand->display = strdup(display ? display : str);
+        cand->full = ec_comp_item_get_type(item) == EC_COMP_FULL;
+        if (strcmp(ec_node_type_name(ec_node_type(
+                       ec_comp_item_get_node(item))), "dynamic") == 0)
+            slot->dynamic = true;
+        slot->count++;
+        if (!cand->str || !cand->display)
+            goto fail;
+    }
+
+    ec_comp_free(comp);
+    clock_gettime(CLOCK_MONOTONIC, &slot->filled);
+    return 0;
+
+fail:
+    ec_comp_free(comp);
+    comp_slot_free(slot);
+    return -1;
+}
+
+/*
+ * Get the completion candidates of the last token of line
+ *
+ * Served from the session cache when a slot was filled for the same
+ * grammar and base with a token the current one extends; its candidates
+ * are then filtered instead of completing again. Candidate sets are not
+ * always closed under extension: a file node completes "d" to "dir/",
+ * then "dir/" to its entries. So the line is completed again once the
+ * token reaches or passes one of the candidates, or when the filter
+ * leaves none.
+ *
+ * Lines with quotes or escapes are not cached: their tokens do not map
+ * to the line text one to one.
+ *
+ * @param tok_len Set to the length of the token being completed
+ * @return Slot whose view holds the candidates, or NULL if the line
+ *         cannot be cached or completion failed
+ */
+static const comp_slot_t *comp_cache_get(eecli_ctx_t *cli,
+                                         const struct ec_node *grammar,
+                                         const char *line, size_t *tok_len)
+{
+    comp_cache_t *cache = &cli->comp_cache;
+    comp_slot_t *slot = NULL, *lru = &cache->slots[0];
+    const char *token;
+    size_t base_len, len;
+
+    if (!grammar || strpbrk(line, "\"'\\"))
+        return NULL;
+
+    base_len = strlen(line);
+    while (base_len > 0 && line[base_len - 1] != ' ' && line[base_len - 1] != '\t')
+        base_len--;
+    token = line + base_len;
+    len = strlen(token);
+
+    for (size_t i = 0; i < COMP_CACHE_SLOTS; i++) {
+        comp_slot_t *s = &cache->slots[i];
+
+        if (s->used < lru->used)
+            lru = s;
+        if (s->dynamic && comp_slot_age_ms(s) >= COMP_CACHE_DYN_MS)
+            continue;
+        if (s->base && s->grammar == grammar &&
+            strlen(s->base) == base_len &&
+            memcmp(s->base, line, base_len) == 0 &&
+            strncmp(token, s->token, strlen(s->token)) == 0) {
+            slot = s;
+            break;
+        }
+    }
+
+    if (slot) {
+        bool same = strcmp(token, slot->token) == 0;
+        bool reached = false;
+
+        /* Filter the cached candidates on the longer token */
+        slot->nview = 0;
+        for (size_t i = 0; i < slot->count; i++) {
+            const char *str = slot->cands[i].str;
+
+            if (strncmp(str, token, len) == 0)
+                slot->view[slot->nview++] = &slot->cands[i];
+            if (!same && str[0] && strncmp(token, str, strlen(str)) == 0)
+                reached = true;
+        }
+        if (!same && (slot->nview == 0 || reached)) {
+            comp_slot_free(slot);
+            lru = slot;
+            slot = NULL;
+        }
+    }
+
+    if (!slot) {
+        comp_slot_free(lru);
+        if (comp_slot_fill(lru, grammar, line, base_len) < 0)
+            return NULL;
+        slot = lru;
+        for (size_t i = 0; i < slot->count; i++)
+            slot->view[i] = &slot->cands[i];
+        slot->nview = slot->count;
+    }
+
+    slot->used = ++cache->clock;
+    *tok_len = len;
+    return slot;
+}
+
+/*
+ * Complete line in the current context
+ *
+ * The context subtree is completed first. Only when it offers nothing
+ * are the outer levels tried, innermost first, in the order run_line()
+ * runs them, so TAB in a context walks no more than needed.
+ *
+ * @return Slot of the first level with candidates, else of the last one
+ *         tried, or NULL if the line cannot be cached
+ */
+static const comp_slot_t *context_complete(eecli_ctx_t *cli, const char *line,
+                                           size_t *tok_len)
+{
+    char full[TELNET_LINE_MAX + 256];
+    const struct ec_node *grammar;
+    const comp_slot_t *slot;
+    context_entry_t *entry;
+    const char *cmd;
+
+    grammar = ecli_context_grammar(cli, line, &cmd, full, sizeof(full));
+    slot = comp_cache_get(cli, grammar, cmd, tok_len);
+    if (!slot || slot->nview > 0 || cli->context_depth == 0)
+        return slot;
+
+    entry = TAILQ_LAST(&cli->context_stack, context_stack_head);
+    while ((entry = TAILQ_PREV(entry, context_stack_head, next)) != NULL) {
+        if (!entry->lexed)
+            continue;
+        slot = comp_cache_get(cli, entry->lexed, line, tok_len);
+        if (!slot || slot->nview > 0)
+            return slot;
+    }
+    return comp_cache_get(cli, cli->grammar, line, tok_len);
+}
+
+/*
+ * Length of the prefix shared by all candidates of the slot view
+ */
+static size_t comp_view_common(const comp_slot_t *slot)
+{
+    size_t common = strlen(slot->view[0]->str);
+
+    for (size_t i = 1; i < slot->nview; i++) {
+        const char *a = slot->view[0]->str, *b = slot->view[i]->str;
+        size_t j = 0;
+
+        while (j < common && a[j] == b[j])
+            j++;
+        common = j;
+    }
+    return common;
+}
+
+/*
+ * TAB handler for editline, served from the session completion cache
+ *
+ * Inserts the part common to all candidates, followed by a space when
+ * a single complete token is left, or lists the candidates when there
+ * is nothing to insert. Lines the cache does not handle go to the
+ * libecoli handler.
+ */
+static unsigned char editline_complete_cached(EditLine *el, int c)
+{
+    eecli_ctx_t *cli = g_stdin_ctx;
+    const LineInfo *li = el_line(el);
+    const comp_slot_t *slot;
+    const char **displays;
+    size_t tok_len, common;
+    char *line;
+
+    if (!cli || !cli->editline || !li)
+        return CC_ERROR;
+
+    line = strndup(li->buffer, li->cursor - li->buffer);
+    if (!line)
+        return CC_ERROR;
+    slot = context_complete(cli, line, &tok_len);
+    free(line);
+    if (!slot)
+        return ec_editline_complete(el, c);
+
+    if (slot->nview == 0)
+        return CC_REDISPLAY;
+
+    common = comp_view_common(slot);
+
+    if (common > tok_len) {
+        char *append = strndup(slot->view[0]->str + tok_len, common - tok_len);
+
+        if (!append || el_insertstr(el, append) < 0) {
+            free(append);
+            return CC_ERROR;
+        }
+        free(append);
+        if (slot->nview == 1 && slot->view[0]->full)
+            el_insertstr(el, " ");
+        return CC_REFRESH;
+    }
+    if (slot->nview == 1 && slot->view[0]->full) {
+        el_insertstr(el, " ");
+        return CC_REFRESH;
+    }
+
+    displays = malloc(slot->nview * sizeof(*displays));
+    if (!displays)
+        return CC_ERROR;
+    for (size_t i = 0; i < slot->nview; i++)
+        displays[i] = slot->view[i]->display;
+    fprintf(stdout, "\n");
+    ec_editline_print_cols(cli->editline, displays, slot->nview);
+    free(displays);
+    return CC_REDISPLAY;
+}
+
 /*
  * Try to expand a single token at the end of a partial command.
  * Returns the expanded token or NULL if no unique expansion exists.
  */
-static char *expand_single_token(eecli_ctx_t *cli, const char *partial_cmd)
+static char *expand_single_token(eecli_ctx_t *cli, const struct ec_node *grammar,
+                                 const char *partial_cmd)
 {
-    struct ec_comp *comp = ec_complete(cli->grammar, partial_cmd);
+    size_t tok_len;
+    const comp_slot_t *slot = comp_cache_get(cli, grammar, partial_cmd, &tok_len);
+
+    if (slot)
+        return slot->nview == 1 ? arena_strdup(&cli->arena, slot->view[0]->str) : NULL;
+
+    struct ec_comp *comp = ec_complete(grammar, partial_cmd);
     if (!comp)
         return NULL;
 
@@ -276,7 +1328,7 @@ static char *expand_single_token(eecli_ctx_t *cli, const char *partial_cmd)
 
     /* Get the full string that this token should become */
     const char *str = ec_comp_item_get_str(item);
-    char *result = str ? strdup(str) : NULL;
+    char *result = str ? arena_strdup(&cli->arena, str) : NULL;
 
     ec_comp_free(comp);
     return result;
@@ -286,16 +1338,17 @@ static char *expand_single_token(eecli_ctx_t *cli, const char *partial_cmd)
  * Try to expand abbreviated tokens to their full form.
  * Expands each token in sequence, so "sh run" -> "show run".
  *
- * Returns: newly allocated expanded string, or NULL if no expansion needed/possible.
- * Caller must free the returned string.
+ * Returns: expanded string in the session arena, or NULL if no expansion
+ * needed/possible.
  */
-static char *expand_prefixes(eecli_ctx_t *cli, const char *cmd)
+static char *expand_prefixes(eecli_ctx_t *cli, const struct ec_node *grammar,
+                             const char *cmd)
 {
-    if (!cli || !cli->grammar || !cmd || !*cmd)
+    if (!grammar || !cmd || !*cmd)
         return NULL;
 
     /* Make a working copy */
-    char *work = strdup(cmd);
+    char *work = arena_strdup(&cli->arena, cmd);
     if (!work)
         return NULL;
 
@@ -311,11 +1364,9 @@ static char *expand_prefixes(eecli_ctx_t *cli, const char *cmd)
     while (token) {
         /* Build partial command up to this token */
         size_t partial_len = strlen(result) + strlen(token) + 2;
-        char *partial = malloc(partial_len);
-        if (!partial) {
-            free(work);
+        char *partial = arena_alloc(&cli->arena, partial_len);
+        if (!partial)
             return NULL;
-        }
         if (result[0]) {
             snprintf(partial, partial_len, "%s %s", result, token);
         } else {
@@ -323,8 +1374,7 @@ static char *expand_prefixes(eecli_ctx_t *cli, const char *cmd)
         }
 
         /* Try to expand this token */
-        char *expanded_token = expand_single_token(cli, partial);
-        free(partial);
+        char *expanded_token = expand_single_token(cli, grammar, partial);
 
         if (expanded_token) {
             /* Token was expanded - use the expanded form */
@@ -335,7 +1385,6 @@ static char *expand_prefixes(eecli_ctx_t *cli, const char *cmd)
             if (strcmp(token, expanded_token) != 0) {
                 expanded_any = true;
             }
-            free(expanded_token);
         } else {
             /* No expansion - use original token */
             if (result[0]) {
@@ -347,292 +1396,1968 @@ static char *expand_prefixes(eecli_ctx_t *cli, const char *cmd)
         token = strtok_r(NULL, " \t", &saveptr);
     }
 
-    free(work);
-
     /* Return result only if something was expanded */
     if (expanded_any) {
-        return strdup(result);
+        return arena_strdup(&cli->arena, result);
     }
 
     return NULL;
 }
 
 /*
- * Custom editline interactive loop with prefix expansion support.
- * Similar to ec_editline_interact() but tries to expand abbreviated
- * tokens before showing parse errors.
+ * Mark the start of a command handler
+ *
+ * With worker threads, or listeners on event_bases other than the server
+ * one (reuseport sharding), handlers hold the handler lock (one at a
+ * time) unless config.parallel_handlers is set. A handler running another one
+ * (ecli_exec) already holds it.
+ *
+ * @return true if the lock was taken, to pass to handler_leave()
  */
-static int editline_interact_with_expansion(eecli_ctx_t *cli)
+static bool handler_enter(eecli_ctx_t *cli)
 {
-    struct ec_editline_help *helps = NULL;
-    struct ec_pnode *parse = NULL;
-    size_t char_idx = 0;
-    char *line = NULL;
-    ssize_t n;
-
-    while (g_running && *g_running) {
-        line = ec_editline_gets(cli->editline);
-        if (line == NULL) {
-            fprintf(stderr, "\n");
-            break;
-        }
-
-        /* Skip empty lines */
-        char *trimmed = line;
-        while (*trimmed == ' ' || *trimmed == '\t') trimmed++;
-        if (*trimmed == '\0' || *trimmed == '\n') {
-            free(line);
-            continue;
-        }
-
-        /* Remove trailing newline */
-        size_t len = strlen(line);
-        if (len > 0 && line[len - 1] == '\n')
-            line[len - 1] = '\0';
-
-        /* Build full command with context prefixes */
-        char full_cmd[1024];
-        ecli_build_full_command(cli, trimmed, full_cmd, sizeof(full_cmd));
-
-        /* Try to parse the command */
-        parse = ec_parse(cli->grammar, full_cmd);
-        if (parse == NULL) {
-            fprintf(stderr, "Failed to parse command\n");
-            free(line);
-            continue;
-        }
-
-        if (ec_pnode_matches(parse)) {
-            /* Direct match - execute callback */
-            ecli_cmd_cb_t cb = ecli_cmd_lookup_callback(parse);
-            if (cb) {
-                cb(cli, parse);
-            } else {
-                fprintf(stderr, "No handler for command\n");
-            }
-            ec_pnode_free(parse);
-            free(line);
-            continue;
-        }
-
-        /* No direct match - try prefix expansion */
-        ec_pnode_free(parse);
-        parse = NULL;
-
-        char *expanded = expand_prefixes(cli, full_cmd);
-        if (expanded) {
-            struct ec_pnode *exp_parse = ec_parse(cli->grammar, expanded);
-            if (exp_parse && ec_pnode_matches(exp_parse)) {
-                /* Expanded command matches - execute it */
-                ecli_cmd_cb_t cb = ecli_cmd_lookup_callback(exp_parse);
-                if (cb) {
-                    cb(cli, exp_parse);
-                } else {
-                    fprintf(stderr, "No handler for command\n");
-                }
-                ec_pnode_free(exp_parse);
-                free(expanded);
-                free(line);
-                continue;
-            }
-            if (exp_parse)
-                ec_pnode_free(exp_parse);
-            free(expanded);
-        }
-
-        /* Show error helps */
-        n = ec_editline_get_error_helps(cli->editline, &helps, &char_idx);
-        if (n >= 0) {
-            ec_editline_print_error_helps(cli->editline, helps, n, char_idx);
-            ec_editline_free_helps(helps, n);
-        } else {
-            fprintf(stderr, "Invalid command\n");
-        }
-        helps = NULL;
-
-        free(line);
-    }
-
-    return 0;
+    eecli_ctx_t *srv = ecli_server(cli);
+    bool lock = (srv->nworkers || atomic_load(&srv->sharded)) &&
+                !srv->config.parallel_handlers &&
+                t_handler_depth == 0;
+
+    if (lock)
+        pthread_mutex_lock(&g_handler_lock);
+    t_handler_depth++;
+    return lock;
 }
 
-static void process_line(eecli_ctx_t *cli, char *line)
+static void handler_leave(bool locked)
 {
-    /* Trim whitespace */
-    while (*line == ' ' || *line == '\t') line++;
-    char *end = line + strlen(line) - 1;
-    while (end > line && (*end == '\n' || *end == '\r' || *end == ' ')) {
-        *end-- = '\0';
-    }
-
-    if (*line == '\0') {
-        ecli_prompt(cli);
-        return;
-    }
-
-    /* Handle reserved commands for context navigation */
-    if (strcmp(line, "end") == 0) {
-        ecli_exit_all_contexts(cli);
-        ecli_prompt(cli);
-        return;
-    }
-    if (strcmp(line, "exit") == 0 && cli->context_depth > 0) {
-        /* In context mode, "exit" returns to parent context */
-        ecli_exit_context(cli);
-        ecli_prompt(cli);
-        return;
-    }
-    /* At top level, "exit" is handled by the grammar (alias to quit) */
+    t_handler_depth--;
+    if (locked)
+        pthread_mutex_unlock(&g_handler_lock);
+}
 
-    /* Build full command with context prefix */
-    char full_cmd[512];
-    ecli_build_full_command(cli, line, full_cmd, sizeof(full_cmd));
+/*
+ * Run a command line against a grammar
+ *
+ * Abbreviated tokens are expanded when the line does not match as typed
+ * (e.g., "write term" -> "write terminal").
+ *
+ * @return 1 if the line matched and its handler ran, 0 if it did not
+ *         match, -1 on parse error
+ */
+static int dispatch_line(eecli_ctx_t *cli, const struct ec_node *grammar,
+                         const char *cmd)
+{
+    struct ec_pnode *parse = ec_parse(grammar, cmd);
+    char *expanded = NULL;
+    int ret;
 
-    /* Parse using libecoli grammar */
-    struct ec_pnode *parse = ec_parse(cli->grammar, full_cmd);
-    if (!parse) {
-        ecli_err(cli, "Parse error\n");
-        ecli_prompt(cli);
-        return;
-    }
+    if (!parse)
+        return -1;
 
-    /* Check if command matches */
     if (!ec_pnode_matches(parse)) {
         ec_pnode_free(parse);
-
-        /* Try to expand prefixes (e.g., "write term" -> "write terminal") */
-        char *expanded = expand_prefixes(cli, full_cmd);
-        if (expanded) {
-            struct ec_pnode *exp_parse = ec_parse(cli->grammar, expanded);
-            if (exp_parse && ec_pnode_matches(exp_parse)) {
-                /* Expanded command matches - execute it */
-                int ret;
-                if (cli->use_yaml) {
-                    ret = ecli_yaml_dispatch(cli, exp_parse);
-                } else {
-                    ecli_cmd_cb_t cb = ecli_cmd_lookup_callback(exp_parse);
-                    ret = cb ? cb(cli, exp_parse) : -1;
-                }
-                if (ret < 0) {
-                    ecli_err(cli, "No handler for command\n");
-                }
-                ec_pnode_free(exp_parse);
-                free(expanded);
-                ecli_prompt(cli);
-                return;
-            }
-            if (exp_parse)
-                ec_pnode_free(exp_parse);
-            free(expanded);
-        }
-
-        /* Single word that doesn't match - check if it's a registered context group */
-        if (strchr(line, ' ') == NULL && is_context_group(line)) {
-            ecli_enter_context(cli, line);
-            ecli_prompt(cli);
-            return;
+        parse = NULL;
+        expanded = expand_prefixes(cli, grammar, cmd);
+        if (expanded)
+            parse = ec_parse(grammar, expanded);
+        if (parse && !ec_pnode_matches(parse)) {
+            ec_pnode_free(parse);
+            parse = NULL;
         }
-
-        ecli_err(cli, "Unknown command: %s\n", line);
-        ecli_prompt(cli);
-        return;
+        if (!parse)
+            return 0;
     }
 
-    /* Find and execute callback */
-    int ret;
+    bool locked = handler_enter(cli);
     if (cli->use_yaml) {
         ret = ecli_yaml_dispatch(cli, parse);
     } else {
         ecli_cmd_cb_t cb = ecli_cmd_lookup_callback(parse);
         ret = cb ? cb(cli, parse) : -1;
     }
+    handler_leave(locked);
+    cli->handler_ret = ret;
     if (ret < 0) {
         ecli_err(cli, "No handler for command\n");
     }
 
     ec_pnode_free(parse);
-    ecli_prompt(cli);
+    return 1;
 }
 
-/* TCP callbacks */
-static void tcp_read_cb(struct bufferevent *bev, void *arg)
+/*
+ * Enter the group named by a single word at a context level, leaving the
+ * levels inside it first
+ *
+ * @return 1 if word is a group at that level, 0 otherwise
+ */
+static int enter_group(eecli_ctx_t *cli, int depth, const char *word)
 {
-    eecli_ctx_t *cli = arg;
-    struct evbuffer *input = bufferevent_get_input(bev);
+    context_entry_t *entry = depth ? context_entry_at(cli, depth) : NULL;
+    const struct ec_node *level = depth ? (entry ? entry->sub : NULL) : cli->grammar;
+    const ecli_context_def_t *def = NULL;
+    struct ec_node *sub = level ? find_context_node(level, word, &def) : NULL;
 
-    char *line;
-    while ((line = evbuffer_readln(input, NULL, EVBUFFER_EOL_ANY)) != NULL) {
-        process_line(cli, line);
-        free(line);
-    }
+    /* Contexts with an argument are entered through their command */
+    if (!sub || def)
+        return 0;
+    context_unwind(cli, depth);
+    if (context_push(cli, word, NULL, NULL, sub) < 0)
+        ecli_err(cli, "Failed to enter context %s\n", word);
+    return 1;
 }
 
-static void tcp_event_cb(struct bufferevent *bev, short events, void *arg)
+/*
+ * Run a command line typed in the current context
+ *
+ * The line is matched against the context subtree first, then against
+ * each outer level up to the top one, so the commands of enclosing
+ * contexts and global commands stay available. A single group keyword
+ * enters the group. Contexts entered from an outer level replace the
+ * levels inside it (see ecli_context_enter_cb()).
+ *
+ * @return 1 if the line was handled, 0 if it matched nothing, -1 on
+ *         parse error
+ */
+static int run_line(eecli_ctx_t *cli, const char *line)
 {
-    eecli_ctx_t *cli = arg;
-    (void)bev;
+    char full_cmd[512];
+    const char *cmd;
+    struct ec_node *grammar = ecli_context_grammar(cli, line, &cmd,
+                                                   full_cmd, sizeof(full_cmd));
+    bool word = strchr(line, ' ') == NULL;
+    int depth = grammar == cli->grammar ? 0 : cli->context_depth;
+    int ret;
 
-    if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
-        bufferevent_free(cli->client_bev);
-        cli->client_bev = NULL;
-        cli->has_client = false;
+    for (;;) {
+        cli->match_depth = depth;
+        ret = dispatch_line(cli, grammar, cmd);
+        if (ret == 0 && word)
+            ret = enter_group(cli, depth, line);
+        if (ret != 0 || depth == 0)
+            break;
+
+        /* Next outer level parsed directly */
+        context_entry_t *entry = NULL;
+        while (--depth > 0 && !(entry = context_entry_at(cli, depth))->lexed)
+            ;
+        grammar = depth ? entry->lexed : cli->grammar;
+        cmd = line;
     }
+
+    cli->match_depth = -1;
+    return ret;
 }
 
-static void tcp_accept_cb(struct evconnlistener *listener, evutil_socket_t fd,
-                          struct sockaddr *addr, int socklen, void *arg)
+/*
+ * Handle "end" and "exit" in context mode
+ *
+ * At top level, "exit" is left to the grammar (alias to quit).
+ *
+ * @return true if the line was a context navigation command
+ */
+static bool context_nav(eecli_ctx_t *cli, const char *line)
 {
-    eecli_ctx_t *cli = arg;
-    (void)listener;
+    if (strcmp(line, "end") == 0) {
+        ecli_exit_all_contexts(cli);
+        return true;
+    }
+    if (strcmp(line, "exit") == 0 && cli->context_depth > 0) {
+        ecli_exit_context(cli);
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Persistent history (config.history_file)
+ *
+ * Lines are logged per user: the UNIX socket peer or the user running
+ * the terminal. TCP clients have no identity to keep their lines apart,
+ * so they are neither logged nor shown the lines of others.
+ */
+static bool history_uid(const eecli_ctx_t *cli, uint32_t *uid)
+{
+    if (cli->has_peer_cred)
+        *uid = (uint32_t)cli->peer_uid;
+    else if (cli->mode == ECLI_MODE_STDIN)
+        *uid = (uint32_t)getuid();
+    else
+        return false;
+    return true;
+}
+
+static void history_record(eecli_ctx_t *cli, const char *line)
+{
+    ecli_history_t *hist = ecli_server(cli)->hist_log;
+    uint32_t uid;
+
+    if (hist && history_uid(cli, &uid))
+        ecli_history_add(hist, uid, line);
+}
+
+typedef struct history_lines {
+    char  **lines;                      /* Newest first */
+    size_t  count;
+} history_lines_t;
+
+static int history_collect_cb(const char *line, size_t len, void *arg)
+{
+    history_lines_t *hl = arg;
+    char *copy = strndup(line, len);
+
+    if (!copy)
+        return 1;
+    hl->lines[hl->count++] = copy;
+    return 0;
+}
+
+/*
+ * Newest lines of the session user containing match (all if NULL)
+ *
+ * Returns: number of lines stored in lines, newest first, to be freed
+ */
+static size_t history_recent(eecli_ctx_t *cli, const char *match, char **lines,
+                             size_t max)
+{
+    history_lines_t hl = { lines, 0 };
+    uint32_t uid;
+
+    if (history_uid(cli, &uid))
+        ecli_history_search(ecli_server(cli)->hist_log, uid, match, max,
+                            history_collect_cb, &hl);
+    return hl.count;
+}
+
+static void history_open(eecli_ctx_t *cli)
+{
+    if (cli->config.history_file)
+        cli->hist_log = ecli_history_open(cli->config.history_file,
+                                          cli->config.history_size);
+}
+
+/*
+ * Audit log (config.audit_file)
+ *
+ * Each command line is recorded once run, with the outcome of run_line()
+ * (or of a context navigation, always successful) and of its handler.
+ * Commands run by ecli_exec() are recorded as their callback name and
+ * "id=value" for each argument.
+ * The record is queued for the writer thread, no I/O is done here.
+ */
+static void audit_log(eecli_ctx_t *cli, const struct sockaddr_storage *addr,
+                      const char *origin, ecli_audit_result_t result, const char *cmd)
+{
+    ecli_audit_t *audit = ecli_server(cli)->audit;
+    int64_t uid = -1;
+    pid_t pid = 0;
+
+    if (!audit)
+        return;
+    if (cli->has_peer_cred) {
+        uid = cli->peer_uid;
+        pid = cli->peer_pid;
+    } else if (cli->mode == ECLI_MODE_STDIN) {
+        uid = getuid();
+    }
+    ecli_audit_log(audit, addr, origin, uid, pid, result, cmd);
+}
+
+static void audit_record(eecli_ctx_t *cli, const char *origin, const char *line,
+                         int ret)
+{
+    ecli_audit_result_t result;
+
+    if (ret < 0)
+        result = ECLI_AUDIT_PARSE_ERROR;
+    else if (ret == 0)
+        result = ECLI_AUDIT_UNKNOWN;
+    else
+        result = cli->handler_ret < 0 ? ECLI_AUDIT_FAILED : ECLI_AUDIT_OK;
+    audit_log(cli, cli->server ? &cli->client_addr : NULL, origin, result, line);
+}
+
+static void audit_open(eecli_ctx_t *cli)
+{
+    if (cli->config.audit_file)
+        cli->audit = ecli_audit_open(cli->config.audit_file, cli->config.audit_size,
+                                     cli->config.audit_keep, cli->config.audit_slots);
+}
+
+/*
+ * Run a line typed in editline, with prefix expansion support.
+ * Similar to ec_editline_interact() but tries to expand abbreviated
+ * tokens before showing parse errors.
+ */
+static void editline_run_line(eecli_ctx_t *cli, char *line)
+{
+    struct ec_editline_help *helps = NULL;
+    size_t char_idx = 0;
+    ssize_t n;
+
+    /* Trim whitespace, skip empty lines */
+    char *trimmed = line;
+    while (*trimmed == ' ' || *trimmed == '\t') trimmed++;
+    if (*trimmed == '\0')
+        return;
+    char *end = trimmed + strlen(trimmed) - 1;
+    while (end > trimmed && (*end == '\r' || *end == ' ' || *end == '\t'))
+        *end-- = '\0';
+
+    /* History gets the line as run, as the other sessions record it */
+    if (history(cli->history, &(HistEvent){ 0 }, H_ENTER, trimmed) < 0)
+        fprintf(stderr, "Failed to add history entry\n");
+    history_record(cli, trimmed);
+
+    cli->handler_ret = 0;
+    if (context_nav(cli, trimmed)) {
+        audit_record(cli, "console", trimmed, 1);
+        return;
+    }
+
+    int ret = run_line(cli, trimmed);
+    audit_record(cli, "console", trimmed, ret);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to parse command\n");
+    } else if (ret == 0) {
+        /* Show error helps */
+        n = ec_editline_get_error_helps(cli->editline, &helps, &char_idx);
+        if (n >= 0) {
+            ec_editline_print_error_helps(cli->editline, helps, n, char_idx);
+            ec_editline_free_helps(helps, n);
+        } else {
+            fprintf(stderr, "Invalid command\n");
+        }
+    }
+}
+
+/* Lines kept in the editline history */
+#define EDITLINE_HISTORY 128
+
+/*
+ * Event-driven editline
+ *
+ * libedit reads the terminal in unbuffered mode: each el_gets() call
+ * handles one key (or escape sequence) and returns the line edited so
+ * far, complete once it ends with a newline. It is called from a read
+ * event on stdin, so editing, completion and the application's events
+ * share the event loop and nothing runs while the terminal is idle.
+ */
+static void editline_start(eecli_ctx_t *cli)
+{
+    /* Raw terminal, fresh line and prompt */
+    if (!cli->el_reading) {
+        el_set(ec_editline_get_el(cli->editline), EL_UNBUFFERED, 1);
+        cli->el_reading = true;
+    }
+}
+
+static void editline_stop(eecli_ctx_t *cli)
+{
+    /* Terminal back to cooked mode */
+    if (cli->el_reading) {
+        el_set(ec_editline_get_el(cli->editline), EL_UNBUFFERED, 0);
+        cli->el_reading = false;
+    }
+}
+
+static void editline_read_cb(evutil_socket_t fd, short events, void *arg)
+{
+    eecli_ctx_t *cli = arg;
+    volatile bool *running;
+    const char *buf;
+    int count = 0;
+    (void)fd;
+    (void)events;
+
+    /* Loop run by the application rather than ecli_run() */
+    editline_start(cli);
+
+    buf = el_gets(ec_editline_get_el(cli->editline), &count);
+    if (!buf || count <= 0 || (count == 1 && buf[0] == ('d' & 0x1f))) {
+        /* ^D on an empty line or end of input - stop */
+        editline_stop(cli);
+        fprintf(stderr, "\n");
+        event_del(cli->stdin_event);
+        ecli_running_clear(cli);
+        return;
+    }
+    if (buf[count - 1] != '\n')
+        return;
+
+    /* The terminal is cooked while the command runs */
+    char *line = arena_alloc(&cli->arena, count);
+    if (line) {
+        memcpy(line, buf, count - 1);
+        line[count - 1] = '\0';
+    }
+    editline_stop(cli);
+
+    if (line) {
+        eecli_ctx_t *prev = t_cur_cli;
+
+        t_cur_cli = cli;
+        editline_run_line(cli, line);
+        t_cur_cli = prev;
+    }
+    arena_reset(&cli->arena);
+
+    running = atomic_load(&cli->running);
+    if (!running || *running)
+        editline_start(cli);
+}
+
+static void process_line(eecli_ctx_t *cli, char *line)
+{
+    /* Trim whitespace */
+    while (*line == ' ' || *line == '\t') line++;
+    char *end = line + strlen(line) - 1;
+    while (end > line && (*end == '\n' || *end == '\r' || *end == ' ')) {
+        *end-- = '\0';
+    }
+
+    if (*line == '\0') {
+        ecli_prompt(cli);
+        goto out;
+    }
+    history_record(cli, line);
+
+    /* Handle reserved commands for context navigation */
+    cli->handler_ret = 0;
+    if (context_nav(cli, line)) {
+        audit_record(cli, "console", line, 1);
+        ecli_prompt(cli);
+        goto out;
+    }
+
+    int ret = run_line(cli, line);
+    audit_record(cli, "console", line, ret);
+    if (ret < 0)
+        ecli_err(cli, "Parse error\n");
+    else if (ret == 0)
+        ecli_err(cli, "Unknown command: %s\n", line);
+    ecli_prompt(cli);
+out:
+    /* Whatever the outcome, the line is done with its arena */
+    arena_reset(&cli->arena);
+}
+
+static uint64_t session_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/*
+ * Command rate limit (config.max_cmd_rate): token bucket holding up to
+ * one second of commands, counted in thousandths of a command
+ *
+ * @return 0 if a command may run now, else milliseconds to wait
+ */
+static unsigned long session_rate_wait(eecli_ctx_t *cli)
+{
+    uint64_t rate = cli->config.max_cmd_rate;
+    uint64_t now, full = rate * 1000;
+
+    if (!rate)
+        return 0;
+    now = session_now_ms();
+    if (!cli->rate_stamp_ms) {
+        cli->rate_tokens = full;
+    } else {
+        cli->rate_tokens += (now - cli->rate_stamp_ms) * rate;
+        if (cli->rate_tokens > full)
+            cli->rate_tokens = full;
+    }
+    cli->rate_stamp_ms = now;
+    if (cli->rate_tokens >= 1000)
+        return 0;
+    return (1000 - cli->rate_tokens + rate - 1) / rate;
+}
+
+static void session_rate_take(eecli_ctx_t *cli)
+{
+    if (cli->config.max_cmd_rate)
+        cli->rate_tokens -= 1000;
+}
+
+static void tcp_read_cb(struct bufferevent *bev, void *arg);
+static void tcp_event_cb(struct bufferevent *bev, short events, void *arg);
+
+static void session_resume_cb(evutil_socket_t fd, short events, void *arg)
+{
+    eecli_ctx_t *cli = arg;
+    (void)fd;
+    (void)events;
+
+    cli->throttled = false;
+    bufferevent_enable(cli->client_bev, EV_READ);
+    tcp_read_cb(cli->client_bev, cli);
+}
+
+/*
+ * Stop reading until the rate limit lets the next command run
+ *
+ * Pending input stays in the buffer: the client is slowed down, no
+ * command is lost.
+ */
+static void session_throttle(eecli_ctx_t *cli, unsigned long wait_ms)
+{
+    struct timeval tv = { wait_ms / 1000, (wait_ms % 1000) * 1000 };
+
+    if (!cli->rate_ev) {
+        cli->rate_ev = evtimer_new(cli->event_base, session_resume_cb, cli);
+        if (!cli->rate_ev)
+            return;
+    }
+    cli->throttled = true;
+    bufferevent_disable(cli->client_bev, EV_READ);
+    evtimer_add(cli->rate_ev, &tv);
+}
+
+/*
+ * Telnet sessions
+ *
+ * Only the options needed for a character-mode terminal are accepted:
+ * ECHO and SGA on our side, NAWS and SGA on the client side. Anything
+ * else the client asks for is refused once.
+ */
+#define TN_IAC   255
+#define TN_DONT  254
+#define TN_DO    253
+#define TN_WONT  252
+#define TN_WILL  251
+#define TN_SB    250
+#define TN_SE    240
+#define TN_OPT_ECHO 1
+#define TN_OPT_SGA  3
+#define TN_OPT_NAWS 31
+
+enum { TN_DATA, TN_CMD, TN_OPT, TN_SUB, TN_SUB_IAC };
+enum { ESC_NONE, ESC_ESC, ESC_CSI, ESC_DEL, ESC_SKIP };
+
+/*
+ * Send output to a session
+ *
+ * Telnet is NVT: line ends are CR LF and IAC bytes are doubled.
+ */
+static void session_send(eecli_ctx_t *cli, const char *buf, size_t len)
+{
+    const char *p = buf, *end = buf + len;
+    size_t queued = evbuffer_get_length(bufferevent_get_output(cli->client_bev));
+
+    /* A client not reading its output does not make it grow for ever */
+    if (cli->config.max_output && queued + len > cli->config.max_output) {
+        cli->out_dropped += len;
+        return;
+    }
+    if (!cli->telnet) {
+        bufferevent_write(cli->client_bev, buf, len);
+        return;
+    }
+    while (p < end) {
+        const char *q = p;
+
+        while (q < end && *q != '\n' && (uint8_t)*q != TN_IAC)
+            q++;
+        if (q > p)
+            bufferevent_write(cli->client_bev, p, q - p);
+        if (q == end)
+            break;
+        if (*q == '\n')
+            bufferevent_write(cli->client_bev, q > buf && q[-1] == '\r' ? "\n" : "\r\n",
+                              q > buf && q[-1] == '\r' ? 1 : 2);
+        else
+            bufferevent_write(cli->client_bev, "\xff\xff", 2);
+        p = q + 1;
+    }
+}
+
+static void telnet_cmd(eecli_ctx_t *cli, uint8_t verb, uint8_t opt)
+{
+    uint8_t cmd[3] = { TN_IAC, verb, opt };
+
+    bufferevent_write(cli->client_bev, cmd, sizeof(cmd));
+}
+
+static telnet_t *telnet_new(void)
+{
+    telnet_t *tn = calloc(1, sizeof(*tn));
+
+    if (!tn)
+        return NULL;
+    tn->cols = 80;
+    tn->rows = 24;
+    return tn;
+}
+
+/* Character mode: we echo, no go-ahead, and tell us the window size */
+static void telnet_negotiate(eecli_ctx_t *cli)
+{
+    telnet_cmd(cli, TN_WILL, TN_OPT_ECHO);
+    telnet_cmd(cli, TN_WILL, TN_OPT_SGA);
+    telnet_cmd(cli, TN_DO, TN_OPT_SGA);
+    telnet_cmd(cli, TN_DO, TN_OPT_NAWS);
+}
+
+static void telnet_free(telnet_t *tn)
+{
+    if (!tn)
+        return;
+    for (size_t i = 0; i < TELNET_HISTORY; i++)
+        free(tn->hist[i]);
+    free(tn->stash);
+    free(tn);
+}
+
+static void telnet_option(eecli_ctx_t *cli, uint8_t verb, uint8_t opt)
+{
+    switch (verb) {
+    case TN_DO:
+        if (opt != TN_OPT_ECHO && opt != TN_OPT_SGA)
+            telnet_cmd(cli, TN_WONT, opt);
+        break;
+    case TN_WILL:
+        if (opt != TN_OPT_NAWS && opt != TN_OPT_SGA)
+            telnet_cmd(cli, TN_DONT, opt);
+        break;
+    default:
+        break;
+    }
+}
+
+static void telnet_subneg(telnet_t *tn)
+{
+    if (tn->sb_len >= 5 && tn->sb[0] == TN_OPT_NAWS) {
+        unsigned int cols = (tn->sb[1] << 8) | tn->sb[2];
+        unsigned int rows = (tn->sb[3] << 8) | tn->sb[4];
+
+        if (cols)
+            tn->cols = cols;
+        if (rows)
+            tn->rows = rows;
+    }
+}
+
+/*
+ * Redraw the prompt and the line, then put the cursor back
+ */
+static void telnet_redraw(eecli_ctx_t *cli)
+{
+    telnet_t *tn = cli->telnet;
+
+    session_send(cli, "\r", 1);
+    ecli_prompt(cli);
+    session_send(cli, tn->line, tn->len);
+    session_send(cli, "\x1b[K", 3);
+    if (tn->pos < tn->len)
+        ecli_write(cli, "\x1b[%zuD", tn->len - tn->pos);
+}
+
+static void telnet_bell(eecli_ctx_t *cli)
+{
+    session_send(cli, "\a", 1);
+}
+
+static void telnet_insert(eecli_ctx_t *cli, const char *str, size_t n)
+{
+    telnet_t *tn = cli->telnet;
+
+    if (tn->len + n >= sizeof(tn->line) || tn->len + n > cli->config.max_line) {
+        telnet_bell(cli);
+        return;
+    }
+    memmove(tn->line + tn->pos + n, tn->line + tn->pos, tn->len - tn->pos);
+    memcpy(tn->line + tn->pos, str, n);
+    tn->len += n;
+    tn->pos += n;
+    if (tn->pos == tn->len)
+        session_send(cli, str, n);
+    else
+        telnet_redraw(cli);
+}
+
+/* Delete n characters before the cursor */
+static void telnet_delete_back(eecli_ctx_t *cli, size_t n)
+{
+    telnet_t *tn = cli->telnet;
+
+    if (n == 0 || n > tn->pos) {
+        telnet_bell(cli);
+        return;
+    }
+    memmove(tn->line + tn->pos - n, tn->line + tn->pos, tn->len - tn->pos);
+    tn->pos -= n;
+    tn->len -= n;
+    telnet_redraw(cli);
+}
+
+static void telnet_set_line(eecli_ctx_t *cli, const char *str)
+{
+    telnet_t *tn = cli->telnet;
+    size_t n = strlen(str);
+
+    if (n >= sizeof(tn->line))
+        n = sizeof(tn->line) - 1;
+    memcpy(tn->line, str, n);
+    tn->len = tn->pos = n;
+    telnet_redraw(cli);
+}
+
+/*
+ * Browse the history: dir > 0 goes back to older lines
+ */
+static void telnet_history(eecli_ctx_t *cli, int dir)
+{
+    telnet_t *tn = cli->telnet;
+    size_t avail = tn->hist_count < TELNET_HISTORY ? tn->hist_count : TELNET_HISTORY;
+    size_t back = tn->hist_back;
+
+    if (dir > 0 && back < avail)
+        back++;
+    else if (dir < 0 && back > 0)
+        back--;
+    else {
+        telnet_bell(cli);
+        return;
+    }
+
+    if (tn->hist_back == 0) {
+        free(tn->stash);
+        tn->stash = strndup(tn->line, tn->len);
+    }
+    tn->hist_back = back;
+    if (back == 0)
+        telnet_set_line(cli, tn->stash ? tn->stash : "");
+    else
+        telnet_set_line(cli, tn->hist[(tn->hist_count - back) % TELNET_HISTORY]);
+}
+
+static void telnet_history_add(telnet_t *tn, const char *line);
+
+/* Start with the user's latest lines of the persistent history */
+static void telnet_history_load(eecli_ctx_t *cli)
+{
+    char *lines[TELNET_HISTORY];
+    size_t n = history_recent(cli, NULL, lines, TELNET_HISTORY);
+
+    while (n > 0) {
+        telnet_history_add(cli->telnet, lines[--n]);
+        free(lines[n]);
+    }
+}
+
+static void telnet_history_add(telnet_t *tn, const char *line)
+{
+    size_t last = (tn->hist_count + TELNET_HISTORY - 1) % TELNET_HISTORY;
+    char *copy;
+
+    if (tn->hist_count && strcmp(tn->hist[last], line) == 0)
+        return;
+    copy = strdup(line);
+    if (!copy)
+        return;
+    free(tn->hist[tn->hist_count % TELNET_HISTORY]);
+    tn->hist[tn->hist_count % TELNET_HISTORY] = copy;
+    tn->hist_count++;
+}
+
+/*
+ * List strings in columns fitting the NAWS width
+ */
+static void telnet_print_cols(eecli_ctx_t *cli, const comp_slot_t *slot)
+{
+    size_t width = 0, ncols, nrows;
+
+    for (size_t i = 0; i < slot->nview; i++) {
+        size_t w = strlen(slot->view[i]->display);
+        if (w > width)
+            width = w;
+    }
+    width += 2;
+    ncols = cli->telnet->cols / width;
+    if (ncols == 0)
+        ncols = 1;
+    nrows = (slot->nview + ncols - 1) / ncols;
+
+    for (size_t r = 0; r < nrows; r++) {
+        for (size_t c = 0; c < ncols; c++) {
+            size_t i = c * nrows + r;
+            if (i >= slot->nview)
+                break;
+            ecli_write(cli, "%-*s", (int)width, slot->view[i]->display);
+        }
+        session_send(cli, "\n", 1);
+    }
+}
+
+/*
+ * TAB: same completion cache and insertion rules as the editline handler
+ */
+static void telnet_complete(eecli_ctx_t *cli)
+{
+    telnet_t *tn = cli->telnet;
+    const comp_slot_t *slot;
+    size_t tok_len, common;
+    char *line;
+
+    line = strndup(tn->line, tn->pos);
+    if (!line)
+        return;
+    slot = context_complete(cli, line, &tok_len);
+    free(line);
+    if (!slot || slot->nview == 0) {
+        telnet_bell(cli);
+        return;
+    }
+
+    common = comp_view_common(slot);
+    if (common > tok_len) {
+        telnet_insert(cli, slot->view[0]->str + tok_len, common - tok_len);
+        if (slot->nview == 1 && slot->view[0]->full)
+            telnet_insert(cli, " ", 1);
+        return;
+    }
+    if (slot->nview == 1 && slot->view[0]->full) {
+        telnet_insert(cli, " ", 1);
+        return;
+    }
+
+    session_send(cli, "\n", 1);
+    telnet_print_cols(cli, slot);
+    telnet_redraw(cli);
+}
+
+/*
+ * '?' at the end of the line: commands under the words typed
+ */
+static void telnet_help(eecli_ctx_t *cli)
+{
+    telnet_t *tn = cli->telnet;
+    char topic[TELNET_LINE_MAX];
+    size_t start = 0, end = tn->len;
+
+    while (start < end && tn->line[start] == ' ')
+        start++;
+    while (end > start && tn->line[end - 1] == ' ')
+        end--;
+    memcpy(topic, tn->line + start, end - start);
+    topic[end - start] = '\0';
+
+    session_send(cli, "?\n", 2);
+    ecli_show_help_topic(cli, topic);
+    telnet_redraw(cli);
+}
+
+static void telnet_submit(eecli_ctx_t *cli)
+{
+    telnet_t *tn = cli->telnet;
+    char line[TELNET_LINE_MAX];
+
+    memcpy(line, tn->line, tn->len);
+    line[tn->len] = '\0';
+    tn->len = tn->pos = 0;
+    tn->hist_back = 0;
+    free(tn->stash);
+    tn->stash = NULL;
+
+    session_send(cli, "\n", 1);
+    if (line[strspn(line, " \t")] != '\0')
+        telnet_history_add(tn, line);
+    process_line(cli, line);
+}
+
+static void telnet_left(eecli_ctx_t *cli)
+{
+    if (cli->telnet->pos > 0) {
+        cli->telnet->pos--;
+        session_send(cli, "\x1b[D", 3);
+    }
+}
+
+static void telnet_right(eecli_ctx_t *cli)
+{
+    if (cli->telnet->pos < cli->telnet->len) {
+        cli->telnet->pos++;
+        session_send(cli, "\x1b[C", 3);
+    }
+}
+
+/*
+ * Escape sequences of the cursor keys ("ESC [ x", "ESC O x") and of the
+ * delete key ("ESC [ 3 ~"); other sequences are dropped
+ *
+ * @return true if c was part of a sequence
+ */
+static bool telnet_escape(eecli_ctx_t *cli, uint8_t c)
+{
+    telnet_t *tn = cli->telnet;
+
+    switch (tn->esc) {
+    case ESC_NONE:
+        if (c != 0x1b)
+            return false;
+        tn->esc = ESC_ESC;
+        return true;
+    case ESC_ESC:
+        tn->esc = (c == '[' || c == 'O') ? ESC_CSI : ESC_NONE;
+        return true;
+    case ESC_DEL:
+        tn->esc = (c == '~') ? ESC_NONE : ESC_SKIP;
+        if (c == '~' && tn->pos < tn->len) {
+            tn->pos++;
+            telnet_delete_back(cli, 1);
+        }
+        return true;
+    case ESC_SKIP:
+        /* Parameters until the final byte */
+        if (c >= 0x40 && c <= 0x7e)
+            tn->esc = ESC_NONE;
+        return true;
+    default:
+        break;
+    }
+
+    /* ESC_CSI */
+    tn->esc = ESC_NONE;
+    switch (c) {
+    case '3':
+        tn->esc = ESC_DEL;
+        break;
+    case 'A':
+        telnet_history(cli, 1);
+        break;
+    case 'B':
+        telnet_history(cli, -1);
+        break;
+    case 'C':
+        telnet_right(cli);
+        break;
+    case 'D':
+        telnet_left(cli);
+        break;
+    case 'H':
+        tn->pos = 0;
+        telnet_redraw(cli);
+        break;
+    case 'F':
+        tn->pos = tn->len;
+        telnet_redraw(cli);
+        break;
+    default:
+        if (c < 0x40 || c > 0x7e)
+            tn->esc = ESC_SKIP;
+        break;
+    }
+    return true;
+}
+
+/*
+ * Line editor: one byte of data from the client
+ */
+static void telnet_key(eecli_ctx_t *cli, uint8_t c)
+{
+    telnet_t *tn = cli->telnet;
+    size_t n;
+
+    if (tn->skip_lf) {
+        tn->skip_lf = false;
+        if (c == '\n' || c == '\0')
+            return;
+    }
+    if (telnet_escape(cli, c))
+        return;
+
+    switch (c) {
+    case '\r':
+        tn->skip_lf = true;
+        /* fallthrough */
+    case '\n':
+        telnet_submit(cli);
+        break;
+    case '\t':
+        telnet_complete(cli);
+        break;
+    case '?':
+        if (tn->pos == tn->len)
+            telnet_help(cli);
+        else
+            telnet_insert(cli, "?", 1);
+        break;
+    case 0x01: /* ^A */
+        tn->pos = 0;
+        telnet_redraw(cli);
+        break;
+    case 0x05: /* ^E */
+        tn->pos = tn->len;
+        telnet_redraw(cli);
+        break;
+    case 0x02: /* ^B */
+        telnet_left(cli);
+        break;
+    case 0x06: /* ^F */
+        telnet_right(cli);
+        break;
+    case 0x10: /* ^P */
+        telnet_history(cli, 1);
+        break;
+    case 0x0e: /* ^N */
+        telnet_history(cli, -1);
+        break;
+    case 0x03: /* ^C */
+        session_send(cli, "^C\n", 3);
+        tn->len = tn->pos = 0;
+        tn->hist_back = 0;
+        ecli_prompt(cli);
+        break;
+    case 0x04: /* ^D */
+        if (tn->len == 0) {
+            tn->closing = true;
+        } else if (tn->pos < tn->len) {
+            tn->pos++;
+            telnet_delete_back(cli, 1);
+        }
+        break;
+    case 0x08:
+    case 0x7f:
+        telnet_delete_back(cli, 1);
+        break;
+    case 0x0b: /* ^K */
+        tn->len = tn->pos;
+        telnet_redraw(cli);
+        break;
+    case 0x15: /* ^U */
+        telnet_delete_back(cli, tn->pos);
+        break;
+    case 0x17: /* ^W */
+        n = tn->pos;
+        while (n > 0 && tn->line[n - 1] == ' ')
+            n--;
+        while (n > 0 && tn->line[n - 1] != ' ')
+            n--;
+        telnet_delete_back(cli, tn->pos - n);
+        break;
+    case 0x0c: /* ^L */
+        session_send(cli, "\x1b[H\x1b[2J", 7);
+        telnet_redraw(cli);
+        break;
+    default:
+        if (c >= 0x20 && c != TN_IAC) {
+            char ch = (char)c;
+            telnet_insert(cli, &ch, 1);
+        }
+        break;
+    }
+}
+
+/*
+ * Feed bytes received on a telnet session
+ *
+ * Stops at a line end when the rate limit holds the command back, or
+ * once the client asked to close the session (tn->closing).
+ *
+ * @return number of bytes consumed
+ */
+static size_t telnet_input(eecli_ctx_t *cli, const uint8_t *buf, size_t len)
+{
+    telnet_t *tn = cli->telnet;
+    size_t i;
+
+    for (i = 0; i < len && !tn->closing; i++) {
+        uint8_t c = buf[i];
+
+        if (tn->state == TN_DATA && tn->esc == ESC_NONE && !tn->skip_lf &&
+            (c == '\r' || c == '\n')) {
+            unsigned long wait = session_rate_wait(cli);
+            if (wait) {
+                session_throttle(cli, wait);
+                break;
+            }
+            session_rate_take(cli);
+        }
+
+        switch (tn->state) {
+        case TN_DATA:
+            if (c == TN_IAC)
+                tn->state = TN_CMD;
+            else
+                telnet_key(cli, c);
+            break;
+        case TN_CMD:
+            tn->state = TN_DATA;
+            if (c >= TN_WILL && c <= TN_DONT) {
+                tn->verb = c;
+                tn->state = TN_OPT;
+            } else if (c == TN_SB) {
+                tn->sb_len = 0;
+                tn->state = TN_SUB;
+            }
+            /* IAC IAC is a 255 data byte, never valid in a line */
+            break;
+        case TN_OPT:
+            telnet_option(cli, tn->verb, c);
+            tn->state = TN_DATA;
+            break;
+        case TN_SUB:
+            if (c == TN_IAC)
+                tn->state = TN_SUB_IAC;
+            else if (tn->sb_len < sizeof(tn->sb))
+                tn->sb[tn->sb_len++] = c;
+            break;
+        case TN_SUB_IAC:
+            if (c == TN_SE) {
+                telnet_subneg(tn);
+                tn->state = TN_DATA;
+            } else {
+                if (tn->sb_len < sizeof(tn->sb))
+                    tn->sb[tn->sb_len++] = c;
+                tn->state = TN_SUB;
+            }
+            break;
+        default:
+            tn->state = TN_DATA;
+            break;
+        }
+    }
+    return i;
+}
+
+/*
+ * Format a client address as "ip:port" (or the socket path for UNIX)
+ */
+static void session_addr_str(const eecli_ctx_t *sess, char *buf, size_t size)
+{
+    char ip_str[INET6_ADDRSTRLEN];
+
+    if (sess->client_addr.ss_family == AF_INET) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *)&sess->client_addr;
+        inet_ntop(AF_INET, &sin->sin_addr, ip_str, sizeof(ip_str));
+        snprintf(buf, size, "%s:%u", ip_str, ntohs(sin->sin_port));
+    } else if (sess->client_addr.ss_family == AF_INET6) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)&sess->client_addr;
+        inet_ntop(AF_INET6, &sin6->sin6_addr, ip_str, sizeof(ip_str));
+        snprintf(buf, size, "[%s]:%u", ip_str, ntohs(sin6->sin6_port));
+    } else if (sess->has_peer_cred) {
+        snprintf(buf, size, "uid %u pid %d", (unsigned int)sess->peer_uid,
+                 (int)sess->peer_pid);
+    } else {
+        snprintf(buf, size, "unknown");
+    }
+}
+
+/*
+ * Release a TCP session and remove it from its server
+ */
+static void session_free(eecli_ctx_t *sess)
+{
+    eecli_ctx_t *srv = sess->server;
+    context_entry_t *entry, *tmp;
+
+    pthread_mutex_lock(&srv->session_lock);
+    TAILQ_REMOVE(&srv->sessions, sess, session_next);
+    srv->nsessions--;
+    pthread_mutex_unlock(&srv->session_lock);
+
+    if (sess->rate_ev)
+        event_free(sess->rate_ev);
+    if (sess->client_bev)
+        bufferevent_free(sess->client_bev);
+    TAILQ_FOREACH_SAFE(entry, &sess->context_stack, next, tmp) {
+        TAILQ_REMOVE(&sess->context_stack, entry, next);
+        context_entry_free(entry);
+    }
+    comp_cache_clear(&sess->comp_cache);
+    arena_free(&sess->arena);
+    telnet_free(sess->telnet);
+    free(sess->context_path);
+    free(sess->current_prompt);
+    free(sess);
+}
+
+static void tcp_drained_cb(struct bufferevent *bev, void *arg)
+{
+    (void)bev;
+    session_free(arg);
+}
+
+/* Input line length used when config.max_line is 0 */
+#define SESSION_LINE_MAX 1024
+
+/*
+ * Close a session once msg and pending output are sent
+ *
+ * A client that does not read gets SESSION_CLOSE_TIMEOUT seconds.
+ */
+#define SESSION_CLOSE_TIMEOUT 5
+
+static void session_close(eecli_ctx_t *cli, const char *msg)
+{
+    struct timeval tv = { SESSION_CLOSE_TIMEOUT, 0 };
+
+    cli->closing = true;
+    bufferevent_disable(cli->client_bev, EV_READ);
+    if (cli->rate_ev)
+        evtimer_del(cli->rate_ev);
+    if (msg)
+        ecli_write(cli, "%s", msg);
+    if (evbuffer_get_length(bufferevent_get_output(cli->client_bev)) == 0) {
+        session_free(cli);
+        return;
+    }
+    bufferevent_set_timeouts(cli->client_bev, NULL, &tv);
+    bufferevent_setcb(cli->client_bev, NULL, tcp_drained_cb, tcp_event_cb, cli);
+}
+
+/*
+ * Raw line sessions: run each complete line, within the line length and
+ * rate limits
+ */
+static void tcp_read_lines(eecli_ctx_t *cli, struct evbuffer *input)
+{
+    size_t max_line = cli->config.max_line;
+
+    while (!cli->closing) {
+        struct evbuffer_ptr eol;
+        size_t eol_len = 0;
+        unsigned long wait;
+        char *line;
+
+        eol = evbuffer_search_eol(input, NULL, &eol_len, EVBUFFER_EOL_ANY);
+        if (eol.pos < 0) {
+            /* No end of line yet: drop what can no longer fit a line */
+            if (evbuffer_get_length(input) > max_line) {
+                evbuffer_drain(input, evbuffer_get_length(input));
+                cli->discard_line = true;
+            }
+            break;
+        }
+        if (cli->discard_line || (size_t)eol.pos > max_line) {
+            evbuffer_drain(input, eol.pos + eol_len);
+            cli->discard_line = false;
+            ecli_err(cli, "Line too long (max %zu)\n", max_line);
+            ecli_prompt(cli);
+            continue;
+        }
+
+        wait = session_rate_wait(cli);
+        if (wait) {
+            session_throttle(cli, wait);
+            break;
+        }
+        /* The line lives in the arena, released once it has run */
+        line = arena_alloc(&cli->arena, eol.pos + 1);
+        if (!line)
+            break;
+        evbuffer_remove(input, line, eol.pos);
+        evbuffer_drain(input, eol_len);
+        line[eol.pos] = '\0';
+        session_rate_take(cli);
+        process_line(cli, line);
+    }
+}
+
+/* TCP callbacks */
+static void tcp_read_cb(struct bufferevent *bev, void *arg)
+{
+    eecli_ctx_t *cli = arg;
+    struct evbuffer *input = bufferevent_get_input(bev);
+    eecli_ctx_t *prev = t_cur_cli;
+
+    if (cli->throttled || cli->closing)
+        return;
+
+    t_cur_cli = cli;
+    if (cli->telnet) {
+        size_t len;
+
+        while (!cli->throttled && (len = evbuffer_get_length(input)) > 0) {
+            uint8_t *buf;
+            size_t used;
+
+            if (len > 256)
+                len = 256;
+            buf = evbuffer_pullup(input, len);
+            if (!buf)
+                break;
+            used = telnet_input(cli, buf, len);
+            evbuffer_drain(input, used);
+            if (cli->telnet->closing) {
+                t_cur_cli = prev;
+                session_free(cli);
+                return;
+            }
+        }
+    } else {
+        tcp_read_lines(cli, input);
+    }
+    t_cur_cli = prev;
+}
+
+static void tcp_event_cb(struct bufferevent *bev, short events, void *arg)
+{
+    eecli_ctx_t *cli = arg;
+    (void)bev;
+
+    if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
+        session_free(cli);
+    } else if (events & BEV_EVENT_TIMEOUT) {
+        if (cli->closing)
+            session_free(cli);
+        else
+            session_close(cli, "\nIdle timeout, closing session\n");
+    }
+}
+
+/*
+ * Message refusing a connection when the session limit is reached
+ *
+ * With a single session allowed, tell who holds it. Called with the
+ * session lock held.
+ */
+static void tcp_refuse_msg(eecli_ctx_t *srv, char *msg, size_t size)
+{
+    char addr[INET6_ADDRSTRLEN + 8];
+    eecli_ctx_t *first = TAILQ_FIRST(&srv->sessions);
+
+    if (srv->config.max_sessions == 1 && first) {
+        session_addr_str(first, addr, sizeof(addr));
+        snprintf(msg, size, "Another session is active from %s\r\n", addr);
+    } else {
+        snprintf(msg, size, "Too many sessions (%u)\r\n",
+                 srv->config.max_sessions);
+    }
+}
+
+/*
+ * Read the credentials of the process connected to a UNIX socket
+ */
+static int peer_cred_get(evutil_socket_t fd, uid_t *uid, gid_t *gid, pid_t *pid)
+{
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+        return -1;
+    *uid = cred.uid;
+    *gid = cred.gid;
+    *pid = cred.pid;
+#else
+    if (getpeereid(fd, uid, gid) < 0)
+        return -1;
+    *pid = 0;
+#endif
+    return 0;
+}
+
+static int uid_cmp(const void *a, const void *b)
+{
+    uid_t ua = *(const uid_t *)a, ub = *(const uid_t *)b;
+
+    return (ua > ub) - (ua < ub);
+}
+
+/*
+ * Resolve config.unix_group into its gid and the uids of its listed
+ * members
+ *
+ * Done once when the server starts, so that accepting a client never
+ * waits on NSS (files, LDAP, ...). Users having the group as primary
+ * group are matched on the gid of the peer.
+ *
+ * @return 0 on success, -1 on unknown group or allocation failure
+ */
+static int unix_group_resolve(eecli_ctx_t *srv)
+{
+    struct group gr, *grp = NULL;
+    char *grbuf;
+    size_t grbuf_len = 16384, n = 0;
+    int ret = -1;
+
+    grbuf = malloc(grbuf_len);
+    if (!grbuf)
+        return -1;
+    if (getgrnam_r(srv->config.unix_group, &gr, grbuf, grbuf_len, &grp) != 0 || !grp) {
+        fprintf(stderr, " Unknown group: %s\n", srv->config.unix_group);
+        goto out;
+    }
+    srv->unix_gid = gr.gr_gid;
+    srv->has_unix_gid = true;
+
+    while (gr.gr_mem[n])
+        n++;
+    srv->unix_uids = calloc(n ? n : 1, sizeof(*srv->unix_uids));
+    if (!srv->unix_uids)
+        goto out;
+    for (char **m = gr.gr_mem; *m; m++) {
+        struct passwd pw, *pwp = NULL;
+        char pwbuf[4096];
+
+        if (getpwnam_r(*m, &pw, pwbuf, sizeof(pwbuf), &pwp) == 0 && pwp)
+            srv->unix_uids[srv->unix_nuids++] = pw.pw_uid;
+    }
+    qsort(srv->unix_uids, srv->unix_nuids, sizeof(*srv->unix_uids), uid_cmp);
+    ret = 0;
+
+out:
+    free(grbuf);
+    return ret;
+}
+
+/*
+ * Authenticate a UNIX socket client from its kernel credentials
+ *
+ * Root and the daemon user are always let in, members of unix_group when
+ * it is configured. Only numeric ids resolved at startup are compared.
+ *
+ * @return 0 if allowed, -1 if refused
+ */
+static int unix_peer_auth(eecli_ctx_t *srv, evutil_socket_t fd,
+                          uid_t *uid, gid_t *gid, pid_t *pid)
+{
+    static const char denied[] = "Permission denied\r\n";
+
+    if (peer_cred_get(fd, uid, gid, pid) < 0) {
+        fprintf(stderr, " Failed to read peer credentials: %s\n", strerror(errno));
+        return -1;
+    }
+    if (*uid == 0 || *uid == geteuid())
+        return 0;
+    if (srv->has_unix_gid &&
+        (*gid == srv->unix_gid ||
+         bsearch(uid, srv->unix_uids, srv->unix_nuids, sizeof(*uid), uid_cmp)))
+        return 0;
+
+    fprintf(stderr, " Refused UNIX session from uid %u pid %d\n",
+            (unsigned int)*uid, (int)*pid);
+    ssize_t ret = send(fd, denied, sizeof(denied) - 1, MSG_DONTWAIT);
+    (void)ret;
+    return -1;
+}
+
+/*
+ * Create the session of an accepted connection and serve it on base
+ *
+ * The session slot was reserved by the accept callback (nsessions).
+ */
+static void session_start(eecli_ctx_t *srv, struct event_base *base,
+                          const ecli_peer_t *peer)
+{
+    eecli_ctx_t *cli = calloc(1, sizeof(*cli));
+
+    if (!cli)
+        goto fail;
+    cli->mode = ECLI_MODE_TCP;
+    cli->config = srv->config;
+    cli->event_base = base;
+    cli->grammar = srv->grammar;
+    cli->use_yaml = srv->use_yaml;
+    cli->server = srv;
+    TAILQ_INIT(&cli->context_stack);
+    cli->match_depth = -1;
+
+    /* UNIX socket clients are tools, not terminals */
+    if (srv->config.telnet && peer->addr.ss_family != AF_UNIX) {
+        cli->telnet = telnet_new();
+        if (!cli->telnet) {
+            free(cli);
+            goto fail;
+        }
+    }
+
+    cli->client_bev = bufferevent_socket_new(base, peer->fd, BEV_OPT_CLOSE_ON_FREE);
+    if (!cli->client_bev) {
+        telnet_free(cli->telnet);
+        free(cli);
+        goto fail;
+    }
+
+    cli->client_addr = peer->addr;
+    cli->client_addrlen = peer->addrlen;
+    cli->has_peer_cred = peer->has_cred;
+    cli->peer_uid = peer->uid;
+    cli->peer_gid = peer->gid;
+    cli->peer_pid = peer->pid;
+    if (cli->telnet)
+        telnet_history_load(cli);
+
+    pthread_mutex_lock(&srv->session_lock);
+    TAILQ_INSERT_TAIL(&srv->sessions, cli, session_next);
+    pthread_mutex_unlock(&srv->session_lock);
+
+    ecli_update_prompt(cli);
+    bufferevent_setcb(cli->client_bev, tcp_read_cb, NULL, tcp_event_cb, cli);
+    if (cli->config.idle_timeout) {
+        struct timeval tv = { cli->config.idle_timeout, 0 };
+        bufferevent_set_timeouts(cli->client_bev, &tv, NULL);
+    }
+    /* Input never holds more than a few lines, the rest waits in the socket */
+    bufferevent_setwatermark(cli->client_bev, EV_READ, 0, cli->config.max_line * 4);
+    bufferevent_enable(cli->client_bev, EV_READ | EV_WRITE);
+
+    if (cli->telnet)
+        telnet_negotiate(cli);
+    if (cli->config.banner) {
+        ecli_write(cli, "%s v%s\r\n", cli->config.banner, cli->config.version);
+    }
+    ecli_prompt(cli);
+    return;
+
+fail:
+    pthread_mutex_lock(&srv->session_lock);
+    srv->nsessions--;
+    pthread_mutex_unlock(&srv->session_lock);
+    close(peer->fd);
+}
+
+/*
+ * Worker threads
+ *
+ * The accept callback pushes each connection on the inbox of a worker,
+ * picked round-robin. The inbox is a lock-free LIFO: producers push with
+ * a CAS, the worker takes the whole list with one exchange. Only the push
+ * that finds the inbox empty writes to the wake pipe, the worker drains
+ * everything on each wakeup.
+ */
+static void worker_push(ecli_worker_t *w, ecli_peer_t *peer)
+{
+    ecli_peer_t *head = atomic_load_explicit(&w->inbox, memory_order_relaxed);
+
+    do {
+        peer->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&w->inbox, &head, peer,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+    if (!head) {
+        char c = 0;
+        ssize_t ret = write(w->wake_fd[1], &c, 1);
+        (void)ret;
+    }
+}
+
+static ecli_peer_t *worker_take(ecli_worker_t *w)
+{
+    ecli_peer_t *list = atomic_exchange_explicit(&w->inbox, NULL,
+                                                 memory_order_acquire);
+    ecli_peer_t *rev = NULL;
+
+    /* Back to accept order */
+    while (list) {
+        ecli_peer_t *next = list->next;
+        list->next = rev;
+        rev = list;
+        list = next;
+    }
+    return rev;
+}
+
+static void worker_wake_cb(evutil_socket_t fd, short events, void *arg)
+{
+    ecli_worker_t *w = arg;
+    ecli_peer_t *peer, *next;
+    char buf[64];
+    (void)events;
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+    if (atomic_load(&w->stop)) {
+        event_base_loopbreak(w->base);
+        return;
+    }
+    for (peer = worker_take(w); peer; peer = next) {
+        next = peer->next;
+        session_start(w->server, w->base, peer);
+        free(peer);
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    ecli_worker_t *w = arg;
+
+    event_base_loop(w->base, 0);
+    return NULL;
+}
+
+/*
+ * Stop the worker threads, then release what they served
+ *
+ * Sessions of a worker are freed by the caller once it is joined.
+ */
+static void workers_stop(eecli_ctx_t *srv)
+{
+    for (unsigned int i = 0; i < srv->nworkers; i++) {
+        ecli_worker_t *w = &srv->workers[i];
+        char c = 0;
+
+        if (!w->started)
+            continue;
+        atomic_store(&w->stop, true);
+        ssize_t ret = write(w->wake_fd[1], &c, 1);
+        (void)ret;
+        pthread_join(w->thread, NULL);
+        w->started = false;
+    }
+}
+
+static void workers_free(eecli_ctx_t *srv)
+{
+    for (unsigned int i = 0; i < srv->nworkers; i++) {
+        ecli_worker_t *w = &srv->workers[i];
+        ecli_peer_t *peer, *next;
+
+        for (peer = worker_take(w); peer; peer = next) {
+            next = peer->next;
+            close(peer->fd);
+            free(peer);
+        }
+        if (w->wake_ev)
+            event_free(w->wake_ev);
+        if (w->base)
+            event_base_free(w->base);
+        if (w->wake_fd[0] >= 0) {
+            close(w->wake_fd[0]);
+            close(w->wake_fd[1]);
+        }
+    }
+    free(srv->workers);
+    srv->workers = NULL;
+    srv->nworkers = 0;
+}
+
+/*
+ * Start config.workers threads, each running its own event_base
+ *
+ * Signals stay with the application threads.
+ */
+static int workers_start(eecli_ctx_t *srv)
+{
+    unsigned int n = srv->config.workers;
+    sigset_t all, old;
+
+    srv->workers = calloc(n, sizeof(*srv->workers));
+    if (!srv->workers)
+        return -1;
+    srv->nworkers = n;
+    for (unsigned int i = 0; i < n; i++)
+        srv->workers[i].wake_fd[0] = srv->workers[i].wake_fd[1] = -1;
+
+    for (unsigned int i = 0; i < n; i++) {
+        ecli_worker_t *w = &srv->workers[i];
+
+        w->server = srv;
+        atomic_init(&w->inbox, NULL);
+        atomic_init(&w->stop, false);
+        if (pipe(w->wake_fd) < 0) {
+            w->wake_fd[0] = w->wake_fd[1] = -1;
+            goto fail;
+        }
+        evutil_make_socket_nonblocking(w->wake_fd[0]);
+        evutil_make_socket_nonblocking(w->wake_fd[1]);
+        evutil_make_socket_closeonexec(w->wake_fd[0]);
+        evutil_make_socket_closeonexec(w->wake_fd[1]);
+        w->base = event_base_new();
+        if (!w->base)
+            goto fail;
+        w->wake_ev = event_new(w->base, w->wake_fd[0], EV_READ | EV_PERSIST,
+                               worker_wake_cb, w);
+        if (!w->wake_ev || event_add(w->wake_ev, NULL) < 0)
+            goto fail;
+    }
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (unsigned int i = 0; i < n; i++) {
+        ecli_worker_t *w = &srv->workers[i];
+
+        if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+            pthread_sigmask(SIG_SETMASK, &old, NULL);
+            goto fail;
+        }
+        w->started = true;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return 0;
+
+fail:
+    fprintf(stderr, " Failed to start CLI worker threads\n");
+    workers_stop(srv);
+    workers_free(srv);
+    return -1;
+}
+
+static void tcp_accept_cb(struct evconnlistener *listener, evutil_socket_t fd,
+                          struct sockaddr *addr, int socklen, void *arg)
+{
+    ecli_listener_t *lst = arg;
+    eecli_ctx_t *srv = lst->server;
+    ecli_peer_t local = { .fd = fd };
+    ecli_peer_t *peer = &local;
+
+    /* Before the session limit: don't tell strangers who is connected */
+    if (lst->unix_path) {
+        if (unix_peer_auth(srv, fd, &local.uid, &local.gid, &local.pid) < 0) {
+            close(fd);
+            return;
+        }
+        local.has_cred = true;
+    }
+    if ((size_t)socklen > sizeof(local.addr))
+        socklen = sizeof(local.addr);
+    memcpy(&local.addr, addr, socklen);
+    local.addrlen = socklen;
+
+    /* Reserve the session slot here, the session may start on a worker */
+    pthread_mutex_lock(&srv->session_lock);
+    if (srv->nsessions >= srv->config.max_sessions) {
+        char msg[128];
+
+        tcp_refuse_msg(srv, msg, sizeof(msg));
+        pthread_mutex_unlock(&srv->session_lock);
+
+        /* Accepted sockets are non-blocking: a full buffer drops the notice */
+        ssize_t ret = write(fd, msg, strlen(msg));
+        (void)ret;
+        close(fd);
+        return;
+    }
+    srv->nsessions++;
+    pthread_mutex_unlock(&srv->session_lock);
+
+    if (srv->nworkers == 0) {
+        session_start(srv, evconnlistener_get_base(listener), &local);
+        return;
+    }
+
+    peer = malloc(sizeof(*peer));
+    if (!peer) {
+        pthread_mutex_lock(&srv->session_lock);
+        srv->nsessions--;
+        pthread_mutex_unlock(&srv->session_lock);
+        close(fd);
+        return;
+    }
+    *peer = local;
+    unsigned int i = atomic_fetch_add_explicit(&srv->next_worker, 1,
+                                               memory_order_relaxed);
+    worker_push(&srv->workers[i % srv->nworkers], peer);
+}
+
+/*
+ * Parse a listen address
+ *
+ * Accepted forms: "unix:/path/to/socket", "[v6addr]:port", "v6addr",
+ * "v4addr:port" and "v4addr". The port defaults to def_port.
+ *
+ * @return 0 on success, -1 on malformed address
+ */
+static int listen_addr_parse(const char *spec, uint16_t def_port,
+                             struct sockaddr_storage *ss, socklen_t *len)
+{
+    char host[INET6_ADDRSTRLEN];
+    const char *port_str = NULL;
+    unsigned long port = def_port;
+    size_t host_len;
+
+    memset(ss, 0, sizeof(*ss));
+
+    if (strncmp(spec, "unix:", 5) == 0) {
+        struct sockaddr_un *sun = (struct sockaddr_un *)ss;
+        const char *path = spec + 5;
+
+        if (!*path || strlen(path) >= sizeof(sun->sun_path))
+            return -1;
+        sun->sun_family = AF_UNIX;
+        strcpy(sun->sun_path, path);
+        *len = sizeof(*sun);
+        return 0;
+    }
+
+    if (spec[0] == '[') {
+        const char *close_br = strchr(spec, ']');
+        if (!close_br)
+            return -1;
+        host_len = close_br - spec - 1;
+        spec++;
+        if (close_br[1] == ':')
+            port_str = close_br + 2;
+        else if (close_br[1] != '\0')
+            return -1;
+    } else {
+        const char *colon = strchr(spec, ':');
+        /* Several colons: bare IPv6 address without port */
+        if (colon && !strchr(colon + 1, ':')) {
+            host_len = colon - spec;
+            port_str = colon + 1;
+        } else {
+            host_len = strlen(spec);
+        }
+    }
+    if (host_len >= sizeof(host))
+        return -1;
+    memcpy(host, spec, host_len);
+    host[host_len] = '\0';
+
+    if (port_str) {
+        char *end;
+        port = strtoul(port_str, &end, 10);
+        if (!*port_str || *end || port == 0 || port > 65535)
+            return -1;
+    }
+
+    struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+    if (inet_pton(AF_INET, host, &sin->sin_addr) == 1) {
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        *len = sizeof(*sin);
+    } else if (inet_pton(AF_INET6, host, &sin6->sin6_addr) == 1) {
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        *len = sizeof(*sin6);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Bind a listener on addr, serving its sessions on base
+ */
+static int server_listen(eecli_ctx_t *srv, const char *addr, uint16_t def_port,
+                         struct event_base *base)
+{
+    struct sockaddr_storage ss;
+    socklen_t len;
+    unsigned int flags = LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE;
+    ecli_listener_t *lst;
+
+    if (listen_addr_parse(addr, def_port, &ss, &len) < 0) {
+        fprintf(stderr, "Invalid listen address: %s\n", addr);
+        return -1;
+    }
+
+    if (srv->config.reuseport && ss.ss_family != AF_UNIX) {
+#ifdef LEV_OPT_REUSEABLE_PORT
+        flags |= LEV_OPT_REUSEABLE_PORT;
+#else
+        fprintf(stderr, "SO_REUSEPORT not supported by libevent, ignored\n");
+#endif
+    }
+#ifdef LEV_OPT_BIND_IPV6ONLY
+    /* Let "::" and "0.0.0.0" listeners share a port */
+    if (ss.ss_family == AF_INET6)
+        flags |= LEV_OPT_BIND_IPV6ONLY;
+#endif
+
+    lst = calloc(1, sizeof(*lst));
+    if (!lst)
+        return -1;
+    lst->server = srv;
+
+    if (ss.ss_family == AF_UNIX) {
+        struct sockaddr_un *sun = (struct sockaddr_un *)&ss;
+        struct stat st;
+
+        /* Remove a stale socket left by a previous run */
+        if (lstat(sun->sun_path, &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(sun->sun_path);
+        lst->unix_path = strdup(sun->sun_path);
+        if (!lst->unix_path) {
+            free(lst);
+            return -1;
+        }
+    }
+
+    lst->lev = evconnlistener_new_bind(base, tcp_accept_cb, lst, flags, -1,
+                                       (struct sockaddr *)&ss, len);
+    if (!lst->lev) {
+        fprintf(stderr, "Failed to create listener on %s: %s\n",
+                addr, strerror(errno));
+        free(lst->unix_path);
+        free(lst);
+        return -1;
+    }
+
+    /* Peers are authenticated at accept, the file mode is a first fence */
+    if (lst->unix_path) {
+        mode_t mode = srv->config.unix_mode;
+        if (!mode)
+            mode = srv->has_unix_gid ? 0660 : 0600;
+        if (chmod(lst->unix_path, mode) < 0 ||
+            (srv->has_unix_gid && chown(lst->unix_path, -1, srv->unix_gid) < 0)) {
+            fprintf(stderr, "Failed to set permissions on %s: %s\n",
+                    lst->unix_path, strerror(errno));
+            evconnlistener_free(lst->lev);
+            unlink(lst->unix_path);
+            free(lst->unix_path);
+            free(lst);
+            return -1;
+        }
+    }
+
+    TAILQ_INSERT_TAIL(&srv->listeners, lst, next);
+    if (base != srv->event_base)
+        atomic_store(&srv->sharded, true);
+    return 0;
+}
 
-    if (cli->has_client) {
-        /* Only allow one client - show who is connected */
-        char msg[128];
-        char ip_str[INET6_ADDRSTRLEN];
-        uint16_t port = 0;
-
-        if (cli->client_addr.ss_family == AF_INET) {
-            struct sockaddr_in *sin = (struct sockaddr_in *)&cli->client_addr;
-            inet_ntop(AF_INET, &sin->sin_addr, ip_str, sizeof(ip_str));
-            port = ntohs(sin->sin_port);
-        } else if (cli->client_addr.ss_family == AF_INET6) {
-            struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&cli->client_addr;
-            inet_ntop(AF_INET6, &sin6->sin6_addr, ip_str, sizeof(ip_str));
-            port = ntohs(sin6->sin6_port);
-        } else {
-            snprintf(ip_str, sizeof(ip_str), "unknown");
+static void server_close_listeners(eecli_ctx_t *srv)
+{
+    ecli_listener_t *lst, *tmp;
+
+    TAILQ_FOREACH_SAFE(lst, &srv->listeners, next, tmp) {
+        TAILQ_REMOVE(&srv->listeners, lst, next);
+        evconnlistener_free(lst->lev);
+        if (lst->unix_path) {
+            unlink(lst->unix_path);
+            free(lst->unix_path);
         }
-
-        snprintf(msg, sizeof(msg),
-                 "Another session is active from %s:%u\r\n", ip_str, port);
-        ssize_t ret = write(fd, msg, strlen(msg));
-        (void)ret;
-        close(fd);
-        return;
+        free(lst);
     }
+}
 
-    cli->client_bev = bufferevent_socket_new(
-        evconnlistener_get_base(listener), fd, BEV_OPT_CLOSE_ON_FREE);
-    if (!cli->client_bev) {
-        close(fd);
-        return;
+/*
+ * Add a listener to the TCP server
+ */
+int ecli_instance_listen(eecli_ctx_t *srv, const char *addr, struct event_base *base)
+{
+    if (!srv || srv->mode != ECLI_MODE_TCP || !addr) {
+        fprintf(stderr, " ecli_listen: TCP server not initialized\n");
+        return -1;
     }
+    return server_listen(srv, addr, srv->tcp_port,
+                         base ? base : srv->event_base);
+}
 
-    /* Store the client address */
-    memcpy(&cli->client_addr, addr, socklen);
-    cli->client_addrlen = socklen;
-
-    bufferevent_setcb(cli->client_bev, tcp_read_cb, NULL, tcp_event_cb, cli);
-    bufferevent_enable(cli->client_bev, EV_READ | EV_WRITE);
+int ecli_listen(const char *addr, struct event_base *base)
+{
+    return ecli_instance_listen(g_ecli_ctx, addr, base);
+}
 
-    cli->has_client = true;
+static int ecli_init_grammar(eecli_ctx_t *cli)
+{
+    /* Grammar is final from here on: index help once */
+    if (help_index_build(&cli->help_index, cli->grammar) < 0)
+        fprintf(stderr, " Failed to build help index\n");
 
-    if (cli->config.banner) {
-        ecli_write(cli, "%s v%s\r\n", cli->config.banner, cli->config.version);
-    }
-    ecli_prompt(cli);
+    return 0;
 }
 
+/*
+ * libecoli runs the EC_INIT_REGISTER hooks, which build the registered
+ * commands grammar, on each ec_init(): run it once for all instances,
+ * which then only take a reference on the grammar
+ */
+static pthread_once_t g_ec_once = PTHREAD_ONCE_INIT;
+static int g_ec_init_errno;
+
+static void ecli_ec_init(void)
+{
+    if (ec_init() < 0)
+        g_ec_init_errno = errno ? errno : EINVAL;
+}
 
 static int ecli_init_common(eecli_ctx_t *cli, const ecli_config_t *config)
 {
@@ -651,12 +3376,26 @@ static int ecli_init_common(eecli_ctx_t *cli, const ecli_config_t *config)
     if (!cli->config.grammar_env)
         cli->config.grammar_env = "ECLI_GRAMMAR";
 
-    /* Initialize libecoli */
-    if (ec_init() < 0) {
-        fprintf(stderr, " Failed to initialize libecoli: %s\n", strerror(errno));
+    atomic_init(&cli->outputs.snap, NULL);
+    atomic_init(&cli->outputs.readers, 0);
+    pthread_mutex_init(&cli->outputs.lock, NULL);
+    atomic_init(&cli->running, NULL);
+    cli->exit_fd[0] = cli->exit_fd[1] = -1;
+
+    /* Initialize libecoli, building the registered commands grammar */
+    pthread_once(&g_ec_once, ecli_ec_init);
+    if (g_ec_init_errno) {
+        fprintf(stderr, " Failed to initialize libecoli: %s\n",
+                strerror(g_ec_init_errno));
         return -1;
     }
 
+    /* Grammar of this instance, given by the application */
+    if (cli->config.grammar) {
+        cli->grammar = ec_node_clone(cli->config.grammar);
+        return ecli_init_grammar(cli);
+    }
+
     /* Try to load YAML grammar if specified */
     const char *yaml_file = getenv(cli->config.grammar_env);
     if (yaml_file && yaml_file[0]) {
@@ -666,16 +3405,18 @@ static int ecli_init_common(eecli_ctx_t *cli, const ecli_config_t *config)
         }
     }
 
-    /* Fall back to C macro-based grammar */
+    /* Fall back to C macro-based grammar, shared by the instances */
     if (!cli->grammar) {
-        cli->grammar = ecli_cmd_get_commands();
-        if (!cli->grammar) {
+        struct ec_node *commands = ecli_cmd_get_commands();
+
+        if (!commands) {
             fprintf(stderr, " Failed to create CLI grammar\n");
             return -1;
         }
+        cli->grammar = ec_node_clone(commands);
     }
 
-    return 0;
+    return ecli_init_grammar(cli);
 }
 
 /* Forward declaration for stdin callback */
@@ -700,21 +3441,22 @@ static void stdin_read_cb(evutil_socket_t fd, short events, void *arg)
         if (errno == EAGAIN || errno == EWOULDBLOCK)
             return;
         /* Read error - stop */
-        if (g_running)
-            *g_running = false;
+        ecli_running_clear(cli);
         return;
     }
 
     if (n == 0) {
         /* EOF on stdin - stop */
         fprintf(stderr, "\n");
-        if (g_running)
-            *g_running = false;
+        ecli_running_clear(cli);
         return;
     }
 
     buf[n] = '\0';
 
+    eecli_ctx_t *prev = t_cur_cli;
+    t_cur_cli = cli;
+
     /* Append to line buffer and process complete lines */
     for (ssize_t i = 0; i < n; i++) {
         char c = buf[i];
@@ -734,18 +3476,15 @@ static void stdin_read_cb(evutil_socket_t fd, short events, void *arg)
         }
         /* else: buffer full, discard character */
     }
+
+    t_cur_cli = prev;
 }
 
-int ecli_init(const ecli_config_t *config)
+static eecli_ctx_t *stdin_new(const ecli_config_t *config)
 {
-    if (g_ecli_ctx) {
-        fprintf(stderr, " Already initialized\n");
-        return -1;
-    }
-
     eecli_ctx_t *cli = calloc(1, sizeof(*cli));
     if (!cli) {
-        return -ENOMEM;
+        return NULL;
     }
 
     cli->mode = ECLI_MODE_STDIN;
@@ -755,10 +3494,11 @@ int ecli_init(const ecli_config_t *config)
     cli->context_depth = 0;
     cli->stdin_buf_len = 0;
     TAILQ_INIT(&cli->context_stack);
+    cli->match_depth = -1;
 
     if (ecli_init_common(cli, config) < 0) {
         free(cli);
-        return -1;
+        return NULL;
     }
 
     /* Use provided event_base or create our own */
@@ -767,9 +3507,9 @@ int ecli_init(const ecli_config_t *config)
         cli->owns_event_base = false;
         /*
          * When external event_base is provided, use libevent for stdin.
-         * This disables editline (tab completion) but allows the CLI to
-         * integrate with the caller's event loop for processing other
-         * events (netlink, signals, etc.) alongside CLI input.
+         * This allows the CLI to integrate with the caller's event loop
+         * for processing other events (netlink, signals, etc.) alongside
+         * CLI input.
          */
         cli->use_event_loop = true;
     } else {
@@ -777,28 +3517,62 @@ int ecli_init(const ecli_config_t *config)
         if (!cli->event_base) {
             fprintf(stderr, "Failed to create event_base\n");
             free(cli);
-            return -1;
+            return NULL;
         }
         cli->owns_event_base = true;
     }
+    if (exit_wake_init(cli) < 0) {
+        exit_wake_free(cli);
+        if (cli->owns_event_base)
+            event_base_free(cli->event_base);
+        free(cli);
+        return NULL;
+    }
+    history_open(cli);
+    audit_open(cli);
 
     /* Initialize prompt */
     ecli_update_prompt(cli);
 
     /*
-     * Foreground mode - use editline for interactive terminals,
-     * but only when we own the event_base (no external event loop).
-     * When using external event_base, we use simple line-based input
-     * through libevent to allow other events to be processed.
+     * Foreground mode - use editline for interactive terminals, fed
+     * from a read event on stdin (see editline_read_cb()), so that it
+     * runs on the event loop like the line-based input.
      */
-    if (!cli->use_event_loop && isatty(STDIN_FILENO)) {
+    if (isatty(STDIN_FILENO)) {
         cli->editline = ec_editline("cli", stdin, stdout, stderr, 0);
+        cli->history = cli->editline ? history_init() : NULL;
+        if (cli->editline && !cli->history) {
+            ec_editline_free(cli->editline);
+            cli->editline = NULL;
+        }
         if (cli->editline) {
             if (ec_editline_set_prompt(cli->editline, cli->config.prompt) < 0) {
                 fprintf(stderr, "Failed to set editline prompt\n");
             }
             ec_editline_set_node(cli->editline, cli->grammar);
+
+            /* Serve TAB from the session completion cache */
+            EditLine *el = ec_editline_get_el(cli->editline);
+            if (el_set(el, EL_ADDFN, "ecli-complete", "Complete (cached)",
+                       editline_complete_cached) < 0 ||
+                el_set(el, EL_BIND, "^I", "ecli-complete", NULL) < 0) {
+                fprintf(stderr, "Failed to bind cached completion\n");
+            }
+
+            /* History browsed with the arrow keys, filled by editline_run_line() */
+            history(cli->history, &(HistEvent){ 0 }, H_SETSIZE, EDITLINE_HISTORY);
+            el_set(el, EL_HIST, history, cli->history);
+
+            /* Start with the latest lines of the persistent history */
+            char *lines[EDITLINE_HISTORY];
+            size_t n = history_recent(cli, NULL, lines, EDITLINE_HISTORY);
+            while (n > 0) {
+                history(cli->history, &(HistEvent){ 0 }, H_ENTER, lines[--n]);
+                free(lines[n]);
+            }
             cli->use_editline = true;
+            cli->use_event_loop = true;
         }
     }
 
@@ -806,13 +3580,22 @@ int ecli_init(const ecli_config_t *config)
     if (cli->use_event_loop) {
         cli->stdin_event = event_new(cli->event_base, STDIN_FILENO,
                                      EV_READ | EV_PERSIST,
-                                     stdin_read_cb, cli);
+                                     cli->use_editline ? editline_read_cb : stdin_read_cb,
+                                     cli);
         if (!cli->stdin_event) {
             fprintf(stderr, "Failed to create stdin event\n");
+            if (cli->editline) {
+                ec_editline_free(cli->editline);
+                history_end(cli->history);
+            }
+            exit_wake_free(cli);
+            ecli_history_close(cli->hist_log);
+            ecli_audit_close(cli->audit);
             if (cli->owns_event_base)
                 event_base_free(cli->event_base);
+            free(cli->current_prompt);
             free(cli);
-            return -1;
+            return NULL;
         }
         event_add(cli->stdin_event, NULL);
     }
@@ -826,20 +3609,63 @@ int ecli_init(const ecli_config_t *config)
         printf("Type 'help' for commands.\n");
     }
 
-    g_ecli_ctx = cli;
+    return cli;
+}
+
+/*
+ * Make cli the default instance
+ *
+ * On failure, cli is freed.
+ */
+static int ecli_set_default(eecli_ctx_t *cli)
+{
+    eecli_ctx_t *expected = NULL;
+
+    if (!cli)
+        return -1;
+    if (!atomic_compare_exchange_strong_explicit(&g_ecli_ctx, &expected, cli,
+                                                 memory_order_release,
+                                                 memory_order_relaxed)) {
+        fprintf(stderr, " Already initialized\n");
+        ecli_free(cli);
+        return -1;
+    }
     return 0;
 }
 
-int ecli_init_tcp(const ecli_config_t *config, struct event_base *event_base, uint16_t port)
+eecli_ctx_t *ecli_new(const ecli_config_t *config)
+{
+    eecli_ctx_t *cli;
+
+    /* Only one instance can own the terminal */
+    if (atomic_exchange(&g_stdin_used, true)) {
+        fprintf(stderr, " Terminal already used by another instance\n");
+        return NULL;
+    }
+    cli = stdin_new(config);
+    if (!cli) {
+        atomic_store(&g_stdin_used, false);
+        return NULL;
+    }
+    atomic_store_explicit(&g_stdin_ctx, cli, memory_order_release);
+    return cli;
+}
+
+int ecli_init(const ecli_config_t *config)
 {
     if (g_ecli_ctx) {
         fprintf(stderr, " Already initialized\n");
         return -1;
     }
+    return ecli_set_default(ecli_new(config));
+}
 
+eecli_ctx_t *ecli_new_tcp(const ecli_config_t *config, struct event_base *event_base,
+                         uint16_t port)
+{
     eecli_ctx_t *cli = calloc(1, sizeof(*cli));
     if (!cli) {
-        return -ENOMEM;
+        return NULL;
     }
 
     cli->mode = ECLI_MODE_TCP;
@@ -849,53 +3675,125 @@ int ecli_init_tcp(const ecli_config_t *config, struct event_base *event_base, ui
     cli->use_yaml = false;
     cli->context_depth = 0;
     TAILQ_INIT(&cli->context_stack);
+    cli->match_depth = -1;
 
     if (ecli_init_common(cli, config) < 0) {
         free(cli);
-        return -1;
+        return NULL;
     }
 
     /* Initialize prompt */
     ecli_update_prompt(cli);
 
-    /* Set up TCP listener */
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-    addr.sin_port = htons(port);
-
-    cli->listener = evconnlistener_new_bind(event_base,
-                                             tcp_accept_cb, cli,
-                                             LEV_OPT_CLOSE_ON_FREE |
-                                             LEV_OPT_REUSEABLE,
-                                             -1,
-                                             (struct sockaddr *)&addr,
-                                             sizeof(addr));
-    if (!cli->listener) {
-        fprintf(stderr, "Failed to create TCP listener on port %u: %s\n",
-                port, strerror(errno));
+    /* One listener per bind address, loopback IPv4 by default */
+    TAILQ_INIT(&cli->listeners);
+    TAILQ_INIT(&cli->sessions);
+    pthread_mutex_init(&cli->session_lock, NULL);
+    if (cli->config.max_sessions == 0)
+        cli->config.max_sessions = 1;
+    if (cli->config.max_line == 0)
+        cli->config.max_line = SESSION_LINE_MAX;
+    if (exit_wake_init(cli) < 0) {
+        exit_wake_free(cli);
+        pthread_mutex_destroy(&cli->session_lock);
+        help_index_free(&cli->help_index);
+        ec_node_free(cli->grammar);
+        free(cli->current_prompt);
+        free(cli);
+        return NULL;
+    }
+    if (cli->config.unix_group && unix_group_resolve(cli) < 0) {
+        exit_wake_free(cli);
+        pthread_mutex_destroy(&cli->session_lock);
+        help_index_free(&cli->help_index);
         ec_node_free(cli->grammar);
+        free(cli->unix_uids);
+        free(cli->current_prompt);
         free(cli);
+        return NULL;
+    }
+
+    history_open(cli);
+    audit_open(cli);
+
+    const char *const *addrs = cli->config.listen;
+    static const char *const default_addrs[] = { "127.0.0.1", NULL };
+    if (!addrs || !addrs[0])
+        addrs = default_addrs;
+    for (size_t i = 0; addrs[i]; i++) {
+        if (server_listen(cli, addrs[i], port, event_base) < 0 ||
+            (!addrs[i + 1] && cli->config.workers && workers_start(cli) < 0)) {
+            server_close_listeners(cli);
+            exit_wake_free(cli);
+            ecli_history_close(cli->hist_log);
+            ecli_audit_close(cli->audit);
+            pthread_mutex_destroy(&cli->session_lock);
+            help_index_free(&cli->help_index);
+            ec_node_free(cli->grammar);
+            free(cli->unix_uids);
+            free(cli->current_prompt);
+            free(cli);
+            return NULL;
+        }
+    }
+
+    return cli;
+}
+
+int ecli_init_tcp(const ecli_config_t *config, struct event_base *event_base, uint16_t port)
+{
+    if (g_ecli_ctx) {
+        fprintf(stderr, " Already initialized\n");
         return -1;
     }
+    return ecli_set_default(ecli_new_tcp(config, event_base, port));
+}
 
-    g_ecli_ctx = cli;
-    return 0;
+eecli_ctx_t *ecli_new_unix(const ecli_config_t *config, struct event_base *event_base,
+                          const char *path)
+{
+    eecli_ctx_t *cli;
+    ecli_config_t cfg = config ? *config : (ecli_config_t)ECLI_CONFIG_DEFAULT;
+    char spec[sizeof(((struct sockaddr_un *)0)->sun_path) + 5];
+    const char *addrs[] = { spec, NULL };
+
+    if (!path || snprintf(spec, sizeof(spec), "unix:%s", path) >= (int)sizeof(spec)) {
+        fprintf(stderr, " Invalid UNIX socket path\n");
+        return NULL;
+    }
+    cfg.listen = addrs;
+    cli = ecli_new_tcp(&cfg, event_base, 0);
+
+    /* addrs only lives for this call */
+    if (cli)
+        cli->config.listen = NULL;
+    return cli;
 }
 
-void ecli_shutdown(void)
+int ecli_init_unix(const ecli_config_t *config, struct event_base *event_base,
+                   const char *path)
 {
-    eecli_ctx_t *cli = g_ecli_ctx;
+    if (g_ecli_ctx) {
+        fprintf(stderr, " Already initialized\n");
+        return -1;
+    }
+    return ecli_set_default(ecli_new_unix(config, event_base, path));
+}
 
-    if (!cli) return;
+static out_registry_t g_cli_out;
+static void out_registry_trim(out_registry_t *reg);
+static void out_registry_free(out_registry_t *reg);
+
+void ecli_free(eecli_ctx_t *cli)
+{
+    /* Sessions go away with their instance */
+    if (!cli || cli->server) return;
 
     /* Free context stack */
     context_entry_t *entry, *tmp;
     TAILQ_FOREACH_SAFE(entry, &cli->context_stack, next, tmp) {
         TAILQ_REMOVE(&cli->context_stack, entry, next);
-        free(entry->name);
-        free(entry);
+        context_entry_free(entry);
     }
 
     /* Free stdin event if using event loop mode */
@@ -904,86 +3802,168 @@ void ecli_shutdown(void)
         cli->stdin_event = NULL;
     }
 
-    if (cli->listener) {
-        evconnlistener_free(cli->listener);
-    }
-    if (cli->client_bev) {
-        bufferevent_free(cli->client_bev);
+    if (cli->mode == ECLI_MODE_TCP) {
+        /* Listeners and sessions on other event_bases must be idle here */
+        server_close_listeners(cli);
+        workers_stop(cli);
+        while (!TAILQ_EMPTY(&cli->sessions))
+            session_free(TAILQ_FIRST(&cli->sessions));
+        workers_free(cli);
+        pthread_mutex_destroy(&cli->session_lock);
+        free(cli->unix_uids);
     }
     if (cli->editline) {
+        editline_stop(cli);
         ec_editline_free(cli->editline);
+        history_end(cli->history);
     }
+    help_index_free(&cli->help_index);
+    cmd_index_free(cli->cmd_index);
+    comp_cache_clear(&cli->comp_cache);
+    arena_free(&cli->arena);
+    free(cli->context_path);
+    free(cli->current_prompt);
     if (cli->grammar && !cli->use_yaml) {
         ec_node_free(cli->grammar);
     }
 
+    out_registry_free(&cli->outputs);
+    exit_wake_free(cli);
+    ecli_history_close(cli->hist_log);
+    ecli_audit_close(cli->audit);
+
     /* Only free event_base if we created it */
     if (cli->owns_event_base && cli->event_base) {
         event_base_free(cli->event_base);
     }
 
+    /* Release the terminal */
+    if (cli == g_stdin_ctx) {
+        atomic_store(&g_stdin_ctx, NULL);
+        atomic_store(&g_stdin_used, false);
+    }
     free(cli);
-    g_ecli_ctx = NULL;
 }
 
-int ecli_run(volatile bool *running)
+void ecli_shutdown(void)
 {
-    eecli_ctx_t *cli = g_ecli_ctx;
+    /* Unpublish first, concurrent ecli_output() calls then get nothing */
+    ecli_free(atomic_exchange(&g_ecli_ctx, NULL));
+    out_registry_trim(&g_cli_out);
+}
 
-    if (!cli)
+/*
+ * Dispatch the event loop of an instance until it is stopped
+ *
+ * ecli_request_exit() breaks the loop through the exit wakeup, so there
+ * is no polling of *running. The loop is entered again if it was broken
+ * for another reason, e.g. by the application.
+ */
+static void instance_dispatch(eecli_ctx_t *cli, volatile bool *running)
+{
+    while (running && *running) {
+        if (event_base_dispatch(cli->event_base) != 0)
+            break;
+    }
+}
+
+int ecli_instance_run(eecli_ctx_t *cli, volatile bool *running)
+{
+    eecli_ctx_t *prev = t_cur_cli;
+
+    if (!cli || cli->server)
         return -1;
 
-    g_running = running;
+    atomic_store_explicit(&cli->running, running, memory_order_release);
 
     /* TCP mode - run the event loop */
     if (cli->mode == ECLI_MODE_TCP) {
-        while (running && *running) {
-            event_base_loop(cli->event_base, EVLOOP_ONCE);
-        }
+        instance_dispatch(cli, running);
         return 0;
     }
 
+    /* Handlers of the terminal run for this instance */
+    t_cur_cli = cli;
+
     /*
      * STDIN mode with libevent integration - run the event loop.
-     * stdin_read_cb will be called when input is available.
-     * This allows other events (netlink, signals, timers) to be
-     * processed alongside CLI input.
+     * stdin_read_cb or editline_read_cb will be called when input is
+     * available. This allows other events (netlink, signals, timers)
+     * to be processed alongside CLI input.
      */
     if (cli->use_event_loop) {
         /* Print initial prompt */
-        ecli_prompt(cli);
-        fflush(stdout);
+        if (cli->use_editline) {
+            editline_start(cli);
+        } else {
+            ecli_prompt(cli);
+            fflush(stdout);
+        }
+
+        instance_dispatch(cli, running);
+        if (cli->use_editline)
+            editline_stop(cli);
+    } else {
+        /* Basic stdin loop when editline is not available */
+        char line[1024];
 
-        while (running && *running) {
-            event_base_loop(cli->event_base, EVLOOP_ONCE);
+        ecli_prompt(cli);
+        while (running && *running && fgets(line, sizeof(line), stdin) != NULL) {
+            process_line(cli, line);
         }
-        return 0;
     }
 
-    /* Foreground mode with editline - use custom loop with prefix expansion */
-    if (cli->use_editline) {
-        return editline_interact_with_expansion(cli);
-    }
+    t_cur_cli = prev;
+    return 0;
+}
 
-    /* Basic stdin loop when editline is not available */
-    char line[1024];
+int ecli_run(volatile bool *running)
+{
+    return ecli_instance_run(g_ecli_ctx, running);
+}
 
-    ecli_prompt(cli);
-    while (running && *running && fgets(line, sizeof(line), stdin) != NULL) {
-        process_line(cli, line);
-    }
+void ecli_lock(void)
+{
+    pthread_mutex_lock(&g_handler_lock);
+}
+
+void ecli_unlock(void)
+{
+    pthread_mutex_unlock(&g_handler_lock);
+}
 
+int ecli_peer_cred(eecli_ctx_t *cli, uid_t *uid, gid_t *gid, pid_t *pid)
+{
+    cli = ecli_cur(cli);
+    if (!cli || !cli->has_peer_cred)
+        return -1;
+    if (uid)
+        *uid = cli->peer_uid;
+    if (gid)
+        *gid = cli->peer_gid;
+    if (pid)
+        *pid = cli->peer_pid;
     return 0;
 }
 
+uint64_t ecli_audit_dropped(eecli_ctx_t *cli)
+{
+    cli = ecli_cur(cli);
+    return cli ? ecli_audit_drops(ecli_server(cli)->audit) : 0;
+}
+
 bool ecli_uses_editline(void)
 {
-    return g_ecli_ctx && g_ecli_ctx->use_editline;
+    eecli_ctx_t *cli = atomic_load_explicit(&g_ecli_ctx, memory_order_acquire);
+
+    return cli && cli->use_editline;
 }
 
 ecli_mode_t ecli_get_mode(void)
 {
-    return g_ecli_ctx ? g_ecli_ctx->mode : ECLI_MODE_STDIN;
+    eecli_ctx_t *cli = atomic_load_explicit(&g_ecli_ctx, memory_order_acquire);
+
+    return cli ? cli->mode : ECLI_MODE_STDIN;
 }
 
 void ecli_output(eecli_ctx_t *cli, const char *fmt, ...)
@@ -991,9 +3971,8 @@ void ecli_output(eecli_ctx_t *cli, const char *fmt, ...)
     va_list args;
     char buf[1024];
 
-    /* Use global context if cli is NULL */
-    if (!cli)
-        cli = g_ecli_ctx;
+    /* Use the current session or global context if cli is NULL */
+    cli = ecli_cur(cli);
     if (!cli)
         return;
 
@@ -1009,9 +3988,8 @@ void ecli_err(eecli_ctx_t *cli, const char *fmt, ...)
     va_list args;
     char buf[1024];
 
-    /* Use global context if cli is NULL */
-    if (!cli)
-        cli = g_ecli_ctx;
+    /* Use the current session or global context if cli is NULL */
+    cli = ecli_cur(cli);
     if (!cli)
         return;
 
@@ -1022,8 +4000,57 @@ void ecli_err(eecli_ctx_t *cli, const char *fmt, ...)
     ecli_write(cli, "Error: %s", buf);
 }
 
+/* Text form of an ecli_exec() value given without one, built on demand */
+#define ECLI_VALUE_STR_ATTR "ecli.value.str"
+
+static const ecli_val_t *pnode_val(const struct ec_pnode *p)
+{
+    struct ec_dict *attrs = ec_pnode_get_attrs((struct ec_pnode *)p);
+
+    return attrs ? ec_dict_get(attrs, ECLI_VALUE_ATTR) : NULL;
+}
+
+/*
+ * Format a typed value passed to ecli_exec() without its string
+ */
+static char *exec_val_str(const ecli_val_t *val)
+{
+    char buf[INET6_ADDRSTRLEN + 8];
+    int plen = -1;
+
+    switch (val->type) {
+    case ECLI_VAL_INT:
+        snprintf(buf, sizeof(buf), "%" PRId64, val->i64);
+        break;
+    case ECLI_VAL_UINT:
+        snprintf(buf, sizeof(buf), "%" PRIu64, val->u64);
+        break;
+    case ECLI_VAL_IPV4:
+        inet_ntop(AF_INET, &val->ipv4.addr, buf, sizeof(buf));
+        plen = val->ipv4.prefix_len;
+        break;
+    case ECLI_VAL_IPV6:
+        inet_ntop(AF_INET6, &val->ipv6.addr, buf, sizeof(buf));
+        plen = val->ipv6.prefix_len;
+        break;
+    case ECLI_VAL_MAC:
+        snprintf(buf, sizeof(buf), "%02x:%02x:%02x:%02x:%02x:%02x",
+                 val->mac[0], val->mac[1], val->mac[2],
+                 val->mac[3], val->mac[4], val->mac[5]);
+        break;
+    default:
+        return NULL;
+    }
+    if (plen >= 0)
+        snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), "/%d", plen);
+    return strdup(buf);
+}
+
 /*
  * Argument helpers for CLI commands
+ *
+ * Arguments passed by ecli_exec() have no token: their value is read from
+ * ECLI_VALUE_ATTR instead.
  */
 const char *ecli_arg_str(const struct ec_pnode *parse, const char *id)
 {
@@ -1031,46 +4058,179 @@ const char *ecli_arg_str(const struct ec_pnode *parse, const char *id)
     if (!node)
         return NULL;
     const struct ec_strvec *vec = ec_pnode_get_strvec(node);
-    if (!vec || ec_strvec_len(vec) == 0)
+    if (vec && ec_strvec_len(vec) > 0)
+        return ec_strvec_val(vec, 0);
+
+    const ecli_val_t *val = pnode_val(node);
+    if (!val)
+        return NULL;
+    if (val->str)
+        return val->str;
+
+    struct ec_dict *attrs = ec_pnode_get_attrs((struct ec_pnode *)node);
+    char *str = ec_dict_get(attrs, ECLI_VALUE_STR_ATTR);
+    if (str)
+        return str;
+    str = exec_val_str(val);
+    if (!str || ec_dict_set(attrs, ECLI_VALUE_STR_ATTR, str, free) < 0)
         return NULL;
-    return ec_strvec_val(vec, 0);
+    return str;
+}
+
+int ecli_arg_int(const struct ec_pnode *parse, const char *id, int def)
+{
+    const struct ec_pnode *node = ec_pnode_find(parse, id);
+    const ecli_val_t *val = node ? pnode_val(node) : NULL;
+
+    if (val && val->type == ECLI_VAL_INT)
+        return (int)val->i64;
+    if (val && val->type == ECLI_VAL_UINT)
+        return (int)val->u64;
+
+    const char *str = ecli_arg_str(parse, id);
+    if (!str)
+        return def;
+    return atoi(str);
+}
+
+/*
+ * Output function registration for write terminal/file
+ *
+ * Registrations of the process (ECLI_DEFUN_SET) are shown by every
+ * instance, merged by priority with the instance's own ones.
+ */
+static out_registry_t g_cli_out = {
+    .snap = NULL,
+    .readers = 0,
+    .retired = NULL,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/*
+ * Free the retired snapshots once no reader is left, lock held
+ *
+ * A reader counted after the check loads the current snapshot, never a
+ * retired one.
+ */
+static void out_registry_reclaim(out_registry_t *reg)
+{
+    out_snapshot_t *old = reg->retired;
+
+    if (!old || atomic_load(&reg->readers) != 0)
+        return;
+    reg->retired = NULL;
+    while (old) {
+        out_snapshot_t *prev = old->prev;
+        free(old);
+        old = prev;
+    }
+}
+
+static const out_snapshot_t *out_registry_enter(out_registry_t *reg)
+{
+    atomic_fetch_add(&reg->readers, 1);
+    return atomic_load(&reg->snap);
+}
+
+static void out_registry_leave(out_registry_t *reg)
+{
+    /* The last reader frees what registrations retired meanwhile */
+    if (atomic_fetch_sub(&reg->readers, 1) == 1 &&
+        pthread_mutex_trylock(&reg->lock) == 0) {
+        out_registry_reclaim(reg);
+        pthread_mutex_unlock(&reg->lock);
+    }
+}
+
+static void out_registry_add(out_registry_t *reg, const char *name, const char *group,
+                             const char *default_fmt, ecli_out_t func, int priority)
+{
+    ecli_out_entry_t *entry = calloc(1, sizeof(*entry));
+    if (!entry) {
+        fprintf(stderr, " Failed to allocate output registration for %s\n", name);
+        return;
+    }
+
+    entry->name = name;
+    entry->group = group;
+    entry->default_fmt = default_fmt;
+    entry->func = func;
+    entry->priority = priority;
+
+    pthread_mutex_lock(&reg->lock);
+    out_snapshot_t *old = atomic_load_explicit(&reg->snap, memory_order_relaxed);
+    size_t count = old ? old->count : 0;
+    out_snapshot_t *snap = malloc(sizeof(*snap) + (count + 1) * sizeof(snap->entries[0]));
+    if (!snap) {
+        pthread_mutex_unlock(&reg->lock);
+        fprintf(stderr, " Failed to allocate output registration for %s\n", name);
+        free(entry);
+        return;
+    }
+
+    /* Insert sorted by priority (lower = earlier) */
+    size_t pos = 0;
+    while (pos < count && old->entries[pos]->priority <= priority)
+        pos++;
+    if (pos > 0)
+        memcpy(snap->entries, old->entries, pos * sizeof(snap->entries[0]));
+    snap->entries[pos] = entry;
+    if (count > pos)
+        memcpy(snap->entries + pos + 1, old->entries + pos,
+               (count - pos) * sizeof(snap->entries[0]));
+    snap->count = count + 1;
+    snap->prev = NULL;
+    atomic_store(&reg->snap, snap);
+    if (old) {
+        old->prev = reg->retired;
+        reg->retired = old;
+    }
+    out_registry_reclaim(reg);
+    pthread_mutex_unlock(&reg->lock);
 }
 
-int ecli_arg_int(const struct ec_pnode *parse, const char *id, int def)
+/*
+ * Free the snapshots replaced by later registrations, unless in use
+ */
+static void out_registry_trim(out_registry_t *reg)
 {
-    const char *str = ecli_arg_str(parse, id);
-    if (!str)
-        return def;
-    return atoi(str);
+    pthread_mutex_lock(&reg->lock);
+    out_registry_reclaim(reg);
+    pthread_mutex_unlock(&reg->lock);
 }
 
 /*
- * Output function registration for write terminal/file
+ * Free an instance registry and its entries
  */
-static ecli_out_entry_t *g_cli_out_head = NULL;
+static void out_registry_free(out_registry_t *reg)
+{
+    out_snapshot_t *snap;
+
+    /* The instance is going away, nobody reads its outputs any more */
+    atomic_store(&reg->readers, 0);
+    out_registry_trim(reg);
+    snap = atomic_exchange(&reg->snap, NULL);
+    for (size_t i = 0; snap && i < snap->count; i++)
+        free(snap->entries[i]);
+    free(snap);
+    pthread_mutex_destroy(&reg->lock);
+}
 
 void ecli_out_register(const char *name, const char *group,
                       const char *default_fmt, ecli_out_t func, int priority)
 {
-    ecli_out_entry_t *entry = calloc(1, sizeof(*entry));
-    if (!entry) {
-        fprintf(stderr, " Failed to allocate output registration for %s\n", name);
-        return;
-    }
-
-    entry->name = name;
-    entry->group = group;
-    entry->default_fmt = default_fmt;
-    entry->func = func;
-    entry->priority = priority;
+    out_registry_add(&g_cli_out, name, group, default_fmt, func, priority);
+}
 
-    /* Insert sorted by priority (lower = earlier) */
-    ecli_out_entry_t **pp = &g_cli_out_head;
-    while (*pp && (*pp)->priority <= priority) {
-        pp = &(*pp)->next;
+void ecli_instance_out_register(eecli_ctx_t *inst, const char *name, const char *group,
+                                const char *default_fmt, ecli_out_t func, int priority)
+{
+    if (!inst) {
+        ecli_out_register(name, group, default_fmt, func, priority);
+        return;
     }
-    entry->next = *pp;
-    *pp = entry;
+    out_registry_add(&ecli_server(inst)->outputs, name, group, default_fmt, func,
+                     priority);
 }
 
 /*
@@ -1094,7 +4254,24 @@ void ecli_dump_running_config(eecli_ctx_t *cli, FILE *fp)
     ECLI_OUT(cli, fp, "! running configuration\n");
     ECLI_OUT(cli, fp, "!\n");
 
-    for (ecli_out_entry_t *e = g_cli_out_head; e; e = e->next) {
+    eecli_ctx_t *ctx = ecli_cur(cli);
+    out_registry_t *own_reg = ctx ? &ecli_server(ctx)->outputs : NULL;
+    const out_snapshot_t *snap = out_registry_enter(&g_cli_out);
+    const out_snapshot_t *own = own_reg ? out_registry_enter(own_reg) : NULL;
+    size_t i = 0, j = 0;
+    size_t count = snap ? snap->count : 0;
+    size_t own_count = own ? own->count : 0;
+
+    /* Process and instance outputs merged by priority, process first */
+    while (i < count || j < own_count) {
+        const ecli_out_entry_t *e;
+
+        if (j == own_count ||
+            (i < count && snap->entries[i]->priority <= own->entries[j]->priority))
+            e = snap->entries[i++];
+        else
+            e = own->entries[j++];
+
         /* Print group separator if group changed */
         if (e->group && (!current_group || strcmp(current_group, e->group) != 0)) {
             if (current_group)
@@ -1110,6 +4287,10 @@ void ecli_dump_running_config(eecli_ctx_t *cli, FILE *fp)
         }
     }
 
+    if (own_reg)
+        out_registry_leave(own_reg);
+    out_registry_leave(&g_cli_out);
+
     /* End the last group if any */
     if (current_group)
         ECLI_OUT(cli, fp, "! end %s\n", current_group);
@@ -1132,6 +4313,9 @@ typedef struct {
         unsigned int   u;
         long           l;
         unsigned long  ul;
+        uint32_t       ipv4;
+        const uint8_t *mac;
+        const struct in6_addr *ipv6;
     } val;
 } ecli_fmt_param_t;
 
@@ -1181,6 +4365,15 @@ void ecli_out_fmt(eecli_ctx_t *cli, FILE *fp, const char *fmt, ...)
         case ECLI_FMT_ULONG:
             params[num_params].val.ul = va_arg(ap, unsigned long);
             break;
+        case ECLI_FMT_IPV4:
+            params[num_params].val.ipv4 = va_arg(ap, uint32_t);
+            break;
+        case ECLI_FMT_MAC:
+            params[num_params].val.mac = va_arg(ap, const uint8_t *);
+            break;
+        case ECLI_FMT_IPV6:
+            params[num_params].val.ipv6 = va_arg(ap, const struct in6_addr *);
+            break;
         default:
             break;
         }
@@ -1227,6 +4420,24 @@ void ecli_out_fmt(eecli_ctx_t *cli, FILE *fp, const char *fmt, ...)
                                 written = snprintf(out, out_end - out, "%lu",
                                     params[i].val.ul);
                                 break;
+                            case ECLI_FMT_IPV4:
+                                /* Rendered in place, no intermediate string */
+                                if (ecli_fmt_ipv4_r(params[i].val.ipv4, out,
+                                                    out_end - out))
+                                    written = (int)strlen(out);
+                                break;
+                            case ECLI_FMT_MAC:
+                                if (params[i].val.mac &&
+                                    ecli_fmt_mac_r(params[i].val.mac, out,
+                                                   out_end - out))
+                                    written = (int)strlen(out);
+                                break;
+                            case ECLI_FMT_IPV6:
+                                if (params[i].val.ipv6 &&
+                                    ecli_fmt_ipv6_r(params[i].val.ipv6, out,
+                                                    out_end - out))
+                                    written = (int)strlen(out);
+                                break;
                             default:
                                 break;
                             }
@@ -1296,10 +4507,55 @@ static const char *get_cmd_expr(const struct ec_node *node)
 }
 
 /*
- * Recursive helper to walk the node tree and display help
+ * Temporary help entry, before the index text is laid out
+ */
+typedef struct help_line {
+    char   *line;       /* "  path - help\n" */
+    size_t  path_len;
+} help_line_t;
+
+typedef struct help_lines {
+    help_line_t *items;
+    size_t       count;
+    size_t       cap;
+} help_lines_t;
+
+static void help_lines_add(help_lines_t *hl, const char *prefix,
+                           const char *word, const char *help)
+{
+    char *line;
+    size_t path_len;
+    int len;
+
+    if (hl->count == hl->cap) {
+        size_t cap = hl->cap ? hl->cap * 2 : 64;
+        help_line_t *items = realloc(hl->items, cap * sizeof(*items));
+        if (!items)
+            return;
+        hl->items = items;
+        hl->cap = cap;
+    }
+
+    if (prefix[0] && word) {
+        len = asprintf(&line, "  %s %s - %s\n", prefix, word, help);
+        path_len = strlen(prefix) + 1 + strlen(word);
+    } else {
+        len = asprintf(&line, "  %s - %s\n", word ? word : prefix, help);
+        path_len = strlen(word ? word : prefix);
+    }
+    if (len < 0)
+        return;
+
+    hl->items[hl->count].line = line;
+    hl->items[hl->count].path_len = path_len;
+    hl->count++;
+}
+
+/*
+ * Recursive helper to walk the node tree and collect help lines
  */
-static void show_help_recursive(eecli_ctx_t *cli, const struct ec_node *node,
-                                char *prefix, size_t prefix_size)
+static void help_collect_recursive(help_lines_t *hl, const struct ec_node *node,
+                                   const char *prefix)
 {
     if (!node)
         return;
@@ -1309,120 +4565,295 @@ static void show_help_recursive(eecli_ctx_t *cli, const struct ec_node *node,
     const char *help = attrs ? ec_dict_get(attrs, ECLI_HELP_ATTR) : NULL;
 
     if (strcmp(node_type, "cmd") == 0) {
-        /* CMD node - get command string and display if has help */
+        /* CMD node - get command string and record if has help */
         const char *cmd_str = get_cmd_expr(node);
-        if (cmd_str && help) {
-            if (prefix[0]) {
-                ecli_output(cli, "  %s %s - %s\n", prefix, cmd_str, help);
-            } else {
-                ecli_output(cli, "  %s - %s\n", cmd_str, help);
-            }
-        }
+        if (cmd_str && help)
+            help_lines_add(hl, prefix, cmd_str, help);
         return;
     }
 
     if (strcmp(node_type, "str") == 0) {
-        /* STR node - display if has help (used for aliases) */
+        /* STR node - record if has help (used for aliases) */
         const char *str_val = get_str_value(node);
-        if (str_val && help) {
-            if (prefix[0]) {
-                ecli_output(cli, "  %s %s - %s\n", prefix, str_val, help);
-            } else {
-                ecli_output(cli, "  %s - %s\n", str_val, help);
-            }
-        }
+        if (str_val && help)
+            help_lines_add(hl, prefix, str_val, help);
         return;
     }
 
     if (strcmp(node_type, "seq") == 0) {
         /* SEQ node - first child is usually keyword, rest are args */
         size_t nchildren = ec_node_get_children_count(node);
-        if (nchildren > 0) {
-            struct ec_node *first = get_child(node, 0);
-            if (first) {
-                const char *first_type = ec_node_type_name(ec_node_type(first));
-
-                /* If first child is a string (keyword), add to prefix */
-                if (strcmp(first_type, "str") == 0) {
-                    const char *str_val = get_str_value(first);
-                    if (str_val) {
-                        char new_prefix[128];
-                        if (prefix[0]) {
-                            snprintf(new_prefix, sizeof(new_prefix), "%s %s",
-                                     prefix, str_val);
-                        } else {
-                            snprintf(new_prefix, sizeof(new_prefix), "%s",
-                                     str_val);
-                        }
+        struct ec_node *first = nchildren > 0 ? get_child(node, 0) : NULL;
+        const char *str_val = NULL;
 
-                        /*
-                         * Check if this is a group (has "or" child) or a leaf command.
-                         * Groups recurse to show subcommands.
-                         * Leaf commands with help display directly (handles
-                         * ECLI_DEFUN_SUB_NODE with complex argument structures).
-                         */
-                        bool is_group = false;
-                        for (size_t i = 1; i < nchildren; i++) {
-                            struct ec_node *child = get_child(node, i);
-                            if (child) {
-                                const char *child_type = ec_node_type_name(
-                                    ec_node_type(child));
-                                if (strcmp(child_type, "or") == 0) {
-                                    is_group = true;
-                                    break;
-                                }
-                            }
-                        }
+        if (first && strcmp(ec_node_type_name(ec_node_type(first)), "str") == 0)
+            str_val = get_str_value(first);
 
-                        if (help && !is_group) {
-                            /* Leaf command with help - display it */
-                            ecli_output(cli, "  %s - %s\n", new_prefix, help);
-                            return;
-                        }
+        /* If first child is a string (keyword), add to prefix */
+        if (str_val) {
+            char new_prefix[128];
+            if (prefix[0]) {
+                snprintf(new_prefix, sizeof(new_prefix), "%s %s",
+                         prefix, str_val);
+            } else {
+                snprintf(new_prefix, sizeof(new_prefix), "%s", str_val);
+            }
 
-                        /* Recurse into remaining children with new prefix */
-                        for (size_t i = 1; i < nchildren; i++) {
-                            show_help_recursive(cli, get_child(node, i),
-                                               new_prefix, sizeof(new_prefix));
-                        }
-                        return;
-                    }
-                }
+            /*
+             * Check if this is a group (has "or" child) or a leaf command.
+             * Groups recurse to collect subcommands.
+             * Leaf commands with help are recorded directly (handles
+             * ECLI_DEFUN_SUB_NODE with complex argument structures).
+             */
+            bool is_group = false;
+            for (size_t i = 1; i < nchildren && !is_group; i++) {
+                struct ec_node *child = get_child(node, i);
+                if (child && strcmp(ec_node_type_name(ec_node_type(child)),
+                                    "or") == 0)
+                    is_group = true;
+            }
+
+            if (help && !is_group) {
+                help_lines_add(hl, new_prefix, NULL, help);
+                return;
             }
+
+            /* Recurse into remaining children with new prefix */
+            for (size_t i = 1; i < nchildren; i++)
+                help_collect_recursive(hl, get_child(node, i), new_prefix);
+            return;
         }
         /* Fallthrough: recurse into all children */
     }
 
-    if (strcmp(node_type, "or") == 0 || strcmp(node_type, "sh_lex") == 0) {
-        /* OR/sh_lex - iterate children with same prefix */
-        size_t nchildren = ec_node_get_children_count(node);
-        for (size_t i = 0; i < nchildren; i++) {
-            show_help_recursive(cli, get_child(node, i), prefix, prefix_size);
-        }
-        return;
+    /* OR/sh_lex and other node types - iterate children with same prefix */
+    size_t nchildren = ec_node_get_children_count(node);
+    for (size_t i = 0; i < nchildren; i++)
+        help_collect_recursive(hl, get_child(node, i), prefix);
+}
+
+static int help_line_cmp(const void *a, const void *b)
+{
+    const help_line_t *la = a;
+    const help_line_t *lb = b;
+    size_t n = la->path_len < lb->path_len ? la->path_len : lb->path_len;
+    int ret = memcmp(la->line + 2, lb->line + 2, n);
+
+    if (ret != 0)
+        return ret;
+    return (la->path_len > lb->path_len) - (la->path_len < lb->path_len);
+}
+
+/*
+ * Build the help index for a grammar (sub)tree
+ *
+ * Walks the tree once, sorts the commands by full path and lays out
+ * their help lines in a single text buffer. Any node can be indexed, so
+ * context subtrees can get their own index.
+ *
+ * @param idx  Index to fill (previous content is released)
+ * @param node Grammar root or subtree
+ * @return 0 on success, -1 on allocation failure
+ */
+static int help_index_build(help_index_t *idx, const struct ec_node *node)
+{
+    help_lines_t hl = { 0 };
+    size_t total = 0;
+    int ret = -1;
+
+    help_index_free(idx);
+    help_collect_recursive(&hl, node, "");
+    if (hl.count == 0)
+        return 0;
+
+    qsort(hl.items, hl.count, sizeof(hl.items[0]), help_line_cmp);
+    for (size_t i = 0; i < hl.count; i++)
+        total += strlen(hl.items[i].line);
+
+    idx->entries = calloc(hl.count, sizeof(*idx->entries));
+    idx->text = malloc(total + 1);
+    if (!idx->entries || !idx->text) {
+        help_index_free(idx);
+        goto out;
     }
 
-    /* For other node types, recurse into children */
-    size_t nchildren = ec_node_get_children_count(node);
-    for (size_t i = 0; i < nchildren; i++) {
-        show_help_recursive(cli, get_child(node, i), prefix, prefix_size);
+    total = 0;
+    for (size_t i = 0; i < hl.count; i++) {
+        size_t len = strlen(hl.items[i].line);
+
+        memcpy(idx->text + total, hl.items[i].line, len);
+        idx->entries[i].path = idx->text + total + 2;
+        idx->entries[i].path_len = hl.items[i].path_len;
+        idx->entries[i].off = total;
+        idx->entries[i].len = len;
+        total += len;
+    }
+    idx->text[total] = '\0';
+    idx->count = hl.count;
+    ret = 0;
+
+out:
+    for (size_t i = 0; i < hl.count; i++)
+        free(hl.items[i].line);
+    free(hl.items);
+    return ret;
+}
+
+static void help_index_free(help_index_t *idx)
+{
+    free(idx->entries);
+    free(idx->text);
+    memset(idx, 0, sizeof(*idx));
+}
+
+/*
+ * Compare an entry path with a topic, treating the topic itself and paths
+ * continuing it with a space as equal
+ *
+ * Topics match whole words: "int" covers "int" and "int brief", not
+ * "interface". Since ' ' sorts before any other path character, the
+ * matching paths form one contiguous range in sorted order.
+ */
+static int help_entry_cmp_topic(const help_entry_t *e, const char *topic,
+                                size_t topic_len)
+{
+    size_t n = e->path_len < topic_len ? e->path_len : topic_len;
+    int ret = memcmp(e->path, topic, n);
+
+    if (ret != 0)
+        return ret;
+    if (e->path_len < topic_len)
+        return -1;
+    if (e->path_len == topic_len || e->path[topic_len] == ' ')
+        return 0;
+    return (unsigned char)e->path[topic_len] < ' ' ? -1 : 1;
+}
+
+/*
+ * Find the range of entries under topic (whole words)
+ *
+ * @return Number of matching entries, first one at *first
+ */
+static size_t help_index_find(const help_index_t *idx, const char *topic,
+                              size_t *first)
+{
+    size_t topic_len = strlen(topic);
+    size_t lo = 0, hi = idx->count;
+
+    /* Lower bound: first entry >= topic */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (help_entry_cmp_topic(&idx->entries[mid], topic, topic_len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    *first = lo;
+
+    /* Upper bound: first entry > topic */
+    hi = idx->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (help_entry_cmp_topic(&idx->entries[mid], topic, topic_len) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo - *first;
 }
 
 /*
- * Display help by walking the CLI command tree
+ * Display help for the commands under topic (all when NULL)
  */
-void ecli_show_help(eecli_ctx_t *cli)
+void ecli_show_help_topic(eecli_ctx_t *cli, const char *topic)
 {
-    eecli_ctx_t *ctx = cli ? cli : g_ecli_ctx;
+    eecli_ctx_t *ctx = ecli_cur(cli);
+    const help_index_t *idx = NULL;
+    context_entry_t *entry;
+    size_t first = 0, count = 0;
+
     if (!ctx || !ctx->grammar) {
         ecli_output(cli, "No commands available\n");
         return;
     }
 
-    ecli_output(cli, "Commands:\n");
-    char prefix[128] = "";
-    show_help_recursive(ctx, ctx->grammar, prefix, sizeof(prefix));
+    /*
+     * In a context, the commands of that level; the outer levels, up to
+     * the top one, only when it has none under topic
+     */
+    TAILQ_FOREACH_REVERSE(entry, &ctx->context_stack, context_stack_head, next) {
+        if (!entry->sub)
+            continue;
+        if (!entry->help_built && help_index_build(&entry->help, entry->sub) == 0)
+            entry->help_built = true;
+        idx = &entry->help;
+        first = 0;
+        count = topic && topic[0] ? help_index_find(idx, topic, &first) : idx->count;
+        if (count > 0)
+            break;
+    }
+    if (count == 0) {
+        idx = &ecli_server(ctx)->help_index;
+        first = 0;
+        count = topic && topic[0] ? help_index_find(idx, topic, &first) : idx->count;
+    }
+    if (count == 0) {
+        if (topic && topic[0])
+            ecli_output(ctx, "No commands matching '%s'\n", topic);
+        else
+            ecli_output(ctx, "No commands available\n");
+        return;
+    }
+
+    ecli_output(ctx, "Commands:\n");
+    ecli_write_buf(ctx, idx->text + idx->entries[first].off,
+                   idx->entries[first + count - 1].off +
+                   idx->entries[first + count - 1].len -
+                   idx->entries[first].off);
+}
+
+/*
+ * Display the latest lines of the persistent history, oldest first
+ */
+void ecli_show_history(eecli_ctx_t *cli, const char *match, size_t count)
+{
+    eecli_ctx_t *ctx = ecli_cur(cli);
+    char **lines;
+    size_t n;
+
+    if (!ctx)
+        return;
+    if (!ecli_server(ctx)->hist_log) {
+        ecli_output(ctx, "No command history (history_file not set)\n");
+        return;
+    }
+    if (!history_uid(ctx, &(uint32_t){ 0 })) {
+        ecli_output(ctx, "No command history for TCP sessions\n");
+        return;
+    }
+    if (count == 0)
+        count = ECLI_SHOW_HISTORY_DEFAULT;
+    lines = calloc(count, sizeof(*lines));
+    if (!lines) {
+        ecli_err(ctx, "Out of memory\n");
+        return;
+    }
+
+    n = history_recent(ctx, match && match[0] ? match : NULL, lines, count);
+    while (n > 0) {
+        ecli_output(ctx, "  %s\n", lines[--n]);
+        free(lines[n]);
+    }
+    free(lines);
+}
+
+/*
+ * Display help from the prebuilt command index
+ */
+void ecli_show_help(eecli_ctx_t *cli)
+{
+    ecli_show_help_topic(cli, NULL);
 }
 
 /*
@@ -1455,13 +4886,13 @@ ecli_cmd_cb_t ecli_cmd_lookup_callback(const struct ec_pnode *parse)
  * When ec_editline_interact() successfully parses a command, it looks for
  * a callback stored under the EC_EDITLINE_CB_ATTR ("_cb") attribute on
  * matched nodes. This wrapper is stored there and performs:
- * 1. Retrieves the global CLI context
+ * 1. Retrieves the context of the terminal instance
  * 2. Looks up the actual libecli callback from ECLI_CB_ATTR
  * 3. Invokes it with the CLI context and parse tree
  */
 int ecli_editline_cmd_wrapper(const struct ec_pnode *parse)
 {
-    eecli_ctx_t *cli = g_ecli_ctx;
+    eecli_ctx_t *cli = g_stdin_ctx;
     if (!cli)
         return -1;
 
@@ -1494,14 +4925,16 @@ int ecli_editline_cmd_wrapper(const struct ec_pnode *parse)
  */
 static int execute_command(eecli_ctx_t *cli, const char *line)
 {
-    /* Build full command with context prefix */
+    /* Parse against the current context subtree */
     char full_cmd[512];
-    ecli_build_full_command(cli, line, full_cmd, sizeof(full_cmd));
+    const char *cmd;
+    struct ec_node *grammar = ecli_context_grammar(cli, line, &cmd,
+                                                   full_cmd, sizeof(full_cmd));
 
-    /* Parse using libecoli grammar */
-    struct ec_pnode *parse = ec_parse(cli->grammar, full_cmd);
+    struct ec_pnode *parse = ec_parse(grammar, cmd);
     if (!parse) {
         fprintf(stderr, " Config: parse error for: %s\n", line);
+        audit_record(cli, "config", line, -1);
         return -1;
     }
 
@@ -1509,6 +4942,7 @@ static int execute_command(eecli_ctx_t *cli, const char *line)
     if (!ec_pnode_matches(parse)) {
         ec_pnode_free(parse);
         fprintf(stderr, " Config: unknown command: %s\n", line);
+        audit_record(cli, "config", line, 0);
         return -1;
     }
 
@@ -1524,6 +4958,8 @@ static int execute_command(eecli_ctx_t *cli, const char *line)
     if (ret < 0) {
         fprintf(stderr, " Config: command failed: %s\n", line);
     }
+    cli->handler_ret = ret;
+    audit_record(cli, "config", line, 1);
 
     ec_pnode_free(parse);
     return ret;
@@ -1532,9 +4968,8 @@ static int execute_command(eecli_ctx_t *cli, const char *line)
 /*
  * ecli_load_config - Load and replay configuration from a file
  */
-int ecli_load_config(const char *filename)
+int ecli_instance_load_config(eecli_ctx_t *cli, const char *filename)
 {
-    eecli_ctx_t *cli = g_ecli_ctx;
     if (!cli) {
         fprintf(stderr, " ecli_load_config: CLI not initialized\n");
         return -1;
@@ -1547,57 +4982,340 @@ int ecli_load_config(const char *filename)
         return -1;
     }
 
+    eecli_ctx_t *prev = t_cur_cli;
     char line[1024];
     int line_num = 0;
     int error_count = 0;
     int cmd_count = 0;
 
+    /* Handlers run for this instance */
+    t_cur_cli = cli;
     while (fgets(line, sizeof(line), fp) != NULL) {
         line_num++;
 
-        /* Trim leading whitespace */
-        char *p = line;
-        while (*p == ' ' || *p == '\t')
-            p++;
+        /* Trim leading whitespace */
+        char *p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+
+        /* Trim trailing whitespace/newline */
+        char *end = p + strlen(p) - 1;
+        while (end > p && (*end == '\n' || *end == '\r' || *end == ' ' || *end == '\t'))
+            *end-- = '\0';
+
+        /* Skip empty lines */
+        if (*p == '\0')
+            continue;
+
+        /* Skip comments (lines starting with '!' or '#') */
+        if (*p == '!' || *p == '#')
+            continue;
+
+        /* Execute the command */
+        cmd_count++;
+        if (execute_command(cli, p) < 0) {
+            fprintf(stderr, " Config error at line %d: %s\n", line_num, p);
+            error_count++;
+        }
+        arena_reset(&cli->arena);
+    }
+
+    t_cur_cli = prev;
+    fclose(fp);
+
+    return error_count;
+}
+
+int ecli_load_config(const char *filename)
+{
+    return ecli_instance_load_config(g_ecli_ctx, filename);
+}
+
+/*
+ * CLI Documentation System
+ *
+ * Documentation entries are stored in the "ecli_doc" ELF section.
+ * We use weak symbols for the section markers so the code works
+ * even when no ECLI_DOC entries exist or when the section is stripped.
+ */
+
+/* Section markers (defined by linker for "ecli_doc" section)
+ * Weak symbols allow the code to work when documentation is stripped. */
+extern const ecli_doc_entry_t __start_ecli_doc[] __attribute__((weak));
+extern const ecli_doc_entry_t __stop_ecli_doc[] __attribute__((weak));
+
+/*
+ * Sorted view of the ecli_doc section
+ *
+ * The section is in link order, so the entries are sorted by name once,
+ * on first lookup, and then found by binary search. Duplicates keep the
+ * first entry in section order, as the linear scan did. Compressed
+ * documentation (ECLI_DOC_COMPRESSED) is inflated at that same point.
+ */
+static struct {
+    const ecli_doc_entry_t **entries;
+    size_t                   count;
+    bool                     built;
+} g_doc_index;
+
+/* Serializes the indexes built on first use, sessions may run in threads */
+static pthread_mutex_t g_index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int doc_index_cmp(const void *a, const void *b)
+{
+    const ecli_doc_entry_t *da = *(const ecli_doc_entry_t *const *)a;
+    const ecli_doc_entry_t *db = *(const ecli_doc_entry_t *const *)b;
+    int ret = strcmp(da->cmd_name, db->cmd_name);
+
+    if (ret != 0)
+        return ret;
+    return (da > db) - (da < db);
+}
+
+static int doc_index_cmp_key(const void *key, const void *elem)
+{
+    const ecli_doc_entry_t *doc = *(const ecli_doc_entry_t *const *)elem;
+
+    return strcmp(key, doc->cmd_name);
+}
+
+static int doc_index_add(const ecli_doc_entry_t *doc, size_t *cap)
+{
+    if (g_doc_index.count == *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 64;
+        const ecli_doc_entry_t **entries =
+            realloc(g_doc_index.entries, new_cap * sizeof(*entries));
+        if (!entries)
+            return -1;
+        g_doc_index.entries = entries;
+        *cap = new_cap;
+    }
+    g_doc_index.entries[g_doc_index.count++] = doc;
+    return 0;
+}
+
+/*
+ * Read a section of an ELF file by name
+ *
+ * Used for sections that are not loaded in memory, so it goes through the
+ * file rather than the program headers. Caller frees the result.
+ */
+static void *elf_read_section(const char *path, const char *name, size_t *size)
+{
+    ElfW(Ehdr) eh;
+    ElfW(Shdr) *sh = NULL;
+    char *names = NULL;
+    void *data = NULL;
+    size_t names_size;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    if (pread(fd, &eh, sizeof(eh), 0) != (ssize_t)sizeof(eh) ||
+        memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0 ||
+        eh.e_shentsize != sizeof(ElfW(Shdr)) ||
+        eh.e_shnum == 0 || eh.e_shstrndx >= eh.e_shnum)
+        goto out;
+
+    sh = calloc(eh.e_shnum, sizeof(*sh));
+    if (!sh || pread(fd, sh, eh.e_shnum * sizeof(*sh), eh.e_shoff) !=
+               (ssize_t)(eh.e_shnum * sizeof(*sh)))
+        goto out;
+
+    names_size = sh[eh.e_shstrndx].sh_size;
+    names = malloc(names_size + 1);
+    if (!names || pread(fd, names, names_size, sh[eh.e_shstrndx].sh_offset) !=
+                  (ssize_t)names_size)
+        goto out;
+    names[names_size] = '\0';
+
+    for (size_t i = 0; i < eh.e_shnum; i++) {
+        if (sh[i].sh_name >= names_size || sh[i].sh_type == SHT_NOBITS ||
+            strcmp(names + sh[i].sh_name, name) != 0)
+            continue;
+        data = malloc(sh[i].sh_size ? sh[i].sh_size : 1);
+        if (data && pread(fd, data, sh[i].sh_size, sh[i].sh_offset) !=
+                    (ssize_t)sh[i].sh_size) {
+            free(data);
+            data = NULL;
+        }
+        if (data)
+            *size = sh[i].sh_size;
+        break;
+    }
+
+out:
+    free(names);
+    free(sh);
+    close(fd);
+    return data;
+}
+
+#ifdef ECLI_HAVE_ZLIB
+
+/*
+ * Inflate the ecli_docz blob of the running executable, if any, and add
+ * its records to the index. The text and entries stay allocated for the
+ * lifetime of the process, as the section entries do.
+ */
+static int doc_index_load_compressed(size_t *cap)
+{
+    static ecli_doc_entry_t *docs;
+    static char *text;
+    ecli_docz_hdr_t hdr;
+    size_t blob_size = 0;
+    size_t ndocs = 0;
+    uLongf raw_size;
+    char *blob;
+    int ret = -1;
+
+    blob = elf_read_section("/proc/self/exe", ECLI_DOCZ_SECTION, &blob_size);
+    if (!blob)
+        return 0;  /* Not packed, or stripped */
+
+    if (blob_size < sizeof(hdr))
+        goto out;
+    memcpy(&hdr, blob, sizeof(hdr));
+    if (memcmp(hdr.magic, ECLI_DOCZ_MAGIC, sizeof(hdr.magic)) != 0)
+        goto out;
+
+    text = malloc((size_t)hdr.raw_size + 1);
+    if (!text)
+        goto out;
+    raw_size = hdr.raw_size;
+    if (uncompress((Bytef *)text, &raw_size, (const Bytef *)blob + sizeof(hdr),
+                   blob_size - sizeof(hdr)) != Z_OK || raw_size != hdr.raw_size) {
+        fprintf(stderr, " Corrupted compressed documentation\n");
+        goto out;
+    }
+    text[raw_size] = '\0';
+
+    /* Each record is "name\0long_desc\0examples\0" */
+    for (size_t i = 0; i < raw_size; i++)
+        ndocs += text[i] == '\0';
+    if (ndocs % 3 != 0 || (raw_size && text[raw_size - 1] != '\0')) {
+        fprintf(stderr, " Corrupted compressed documentation\n");
+        goto out;
+    }
+    ndocs /= 3;
+    docs = calloc(ndocs ? ndocs : 1, sizeof(*docs));
+    if (!docs)
+        goto out;
+
+    const char *p = text;
+    const char *end = text + raw_size;
+    const char *field[3];
+    for (size_t i = 0; i < ndocs; i++) {
+        for (size_t f = 0; f < 3; f++) {
+            if (p >= end) {
+                fprintf(stderr, " Corrupted compressed documentation\n");
+                goto out;
+            }
+            field[f] = p;
+            p += strlen(p) + 1;
+        }
+        docs[i].cmd_name = field[0];
+        docs[i].long_desc = *field[1] ? field[1] : NULL;
+        docs[i].examples = *field[2] ? field[2] : NULL;
+        if (doc_index_add(&docs[i], cap) < 0)
+            goto out;
+    }
+    ret = 0;
+
+out:
+    free(blob);
+    return ret;
+}
+#else
+/*
+ * Without zlib a packed blob cannot be inflated: say so rather than
+ * silently showing no documentation
+ */
+static int doc_index_load_compressed(size_t *cap)
+{
+    size_t blob_size = 0;
+    void *blob = elf_read_section("/proc/self/exe", ECLI_DOCZ_SECTION, &blob_size);
+
+    (void)cap;
+    if (blob) {
+        fprintf(stderr, " Compressed documentation (%s) ignored: libecli was built without zlib\n",
+                ECLI_DOCZ_SECTION);
+        free(blob);
+    }
+    return 0;
+}
+#endif
+
+static int doc_index_build_locked(void)
+{
+    size_t cap = 0;
+    size_t n;
+
+    if (g_doc_index.built)
+        return 0;
+
+    /* Check if documentation is available (weak symbols are NULL when no ecli_doc section) */
+    if ((const void *)__start_ecli_doc != NULL &&
+        (const void *)__stop_ecli_doc != NULL &&
+        (const void *)__start_ecli_doc < (const void *)__stop_ecli_doc) {
+        for (const ecli_doc_entry_t *doc = __start_ecli_doc;
+             doc < __stop_ecli_doc; doc++) {
+            if (doc->cmd_name != NULL && doc_index_add(doc, &cap) < 0)
+                goto fail;
+        }
+    }
+
+    if (doc_index_load_compressed(&cap) < 0)
+        goto fail;
 
-        /* Trim trailing whitespace/newline */
-        char *end = p + strlen(p) - 1;
-        while (end > p && (*end == '\n' || *end == '\r' || *end == ' ' || *end == '\t'))
-            *end-- = '\0';
+    n = g_doc_index.count;
+    qsort(g_doc_index.entries, n, sizeof(g_doc_index.entries[0]), doc_index_cmp);
 
-        /* Skip empty lines */
-        if (*p == '\0')
+    /* Drop duplicate names, keeping the first one in section order */
+    g_doc_index.count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (g_doc_index.count > 0 &&
+            strcmp(g_doc_index.entries[g_doc_index.count - 1]->cmd_name,
+                   g_doc_index.entries[i]->cmd_name) == 0)
             continue;
+        g_doc_index.entries[g_doc_index.count++] = g_doc_index.entries[i];
+    }
 
-        /* Skip comments (lines starting with '!' or '#') */
-        if (*p == '!' || *p == '#')
-            continue;
+    g_doc_index.built = true;
+    return 0;
 
-        /* Execute the command */
-        cmd_count++;
-        if (execute_command(cli, p) < 0) {
-            fprintf(stderr, " Config error at line %d: %s\n", line_num, p);
-            error_count++;
-        }
-    }
+fail:
+    fprintf(stderr, " Failed to build documentation index\n");
+    free(g_doc_index.entries);
+    g_doc_index.entries = NULL;
+    g_doc_index.count = 0;
+    return -1;
+}
 
-    fclose(fp);
+static int doc_index_build(void)
+{
+    int ret;
 
-    return error_count;
+    pthread_mutex_lock(&g_index_lock);
+    ret = doc_index_build_locked();
+    pthread_mutex_unlock(&g_index_lock);
+    return ret;
 }
 
-/*
- * CLI Documentation System
- *
- * Documentation entries are stored in the "ecli_doc" ELF section.
- * We use weak symbols for the section markers so the code works
- * even when no ECLI_DOC entries exist or when the section is stripped.
- */
+/* Search the documentation index, once built it is never changed */
+static const ecli_doc_entry_t *doc_index_find(const char *cmd_name)
+{
+    const ecli_doc_entry_t *const *found;
 
-/* Section markers (defined by linker for "ecli_doc" section)
- * Weak symbols allow the code to work when documentation is stripped. */
-extern const ecli_doc_entry_t __start_ecli_doc[] __attribute__((weak));
-extern const ecli_doc_entry_t __stop_ecli_doc[] __attribute__((weak));
+    if (!cmd_name || g_doc_index.count == 0)
+        return NULL;
+
+    found = bsearch(cmd_name, g_doc_index.entries, g_doc_index.count,
+                    sizeof(g_doc_index.entries[0]), doc_index_cmp_key);
+    return found ? *found : NULL;
+}
 
 /*
  * ecli_doc_lookup - Find documentation entry by command name
@@ -1609,54 +5327,9 @@ extern const ecli_doc_entry_t __stop_ecli_doc[] __attribute__((weak));
  */
 const ecli_doc_entry_t *ecli_doc_lookup(const char *cmd_name)
 {
-    if (!cmd_name)
-        return NULL;
-
-    /* Check if documentation is available (weak symbols are NULL when no ecli_doc section) */
-    if ((const void *)__start_ecli_doc == NULL ||
-        (const void *)__stop_ecli_doc == NULL ||
-        (const void *)__start_ecli_doc >= (const void *)__stop_ecli_doc)
-        return NULL;
-
-    /* Iterate through documentation entries */
-    for (const ecli_doc_entry_t *doc = __start_ecli_doc;
-         doc < __stop_ecli_doc; doc++) {
-        if (doc->cmd_name == NULL)
-            continue;
-        if (strcmp(doc->cmd_name, cmd_name) == 0)
-            return doc;
-    }
-    return NULL;
-}
-
-/*
- * Helper to extract command info from the grammar tree
- */
-static const char *find_cmd_help(const struct ec_node *node, const char *cb_name)
-{
-    if (!node)
+    if (!cmd_name || doc_index_build() < 0)
         return NULL;
-
-    /* Check this node */
-    struct ec_dict *attrs = ec_node_attrs(node);
-    if (attrs) {
-        const char *node_cb = ec_dict_get(attrs, ECLI_CB_NAME_ATTR);
-        if (node_cb && strcmp(node_cb, cb_name) == 0) {
-            return ec_dict_get(attrs, ECLI_HELP_ATTR);
-        }
-    }
-
-    /* Recurse into children */
-    size_t n = ec_node_get_children_count(node);
-    for (size_t i = 0; i < n; i++) {
-        struct ec_node *child = NULL;
-        if (ec_node_get_child(node, i, &child) == 0 && child) {
-            const char *help = find_cmd_help(child, cb_name);
-            if (help)
-                return help;
-        }
-    }
-    return NULL;
+    return doc_index_find(cmd_name);
 }
 
 /*
@@ -1680,7 +5353,8 @@ static void build_syntax_recursive(const struct ec_node *node, char *buf,
             if (n > 0) *pos += n;
         }
     } else if (strcmp(type, "int") == 0 || strcmp(type, "uint") == 0 ||
-               strcmp(type, "re") == 0) {
+               strcmp(type, "re") == 0 || strncmp(type, "ipv", 3) == 0 ||
+               strncmp(type, "mac", 3) == 0) {
         /* Argument - use ID or help text */
         const char *id = ec_node_id(node);
         const char *help = attrs ? ec_dict_get(attrs, ECLI_HELP_ATTR) : NULL;
@@ -1750,92 +5424,210 @@ static void build_syntax_recursive(const struct ec_node *node, char *buf,
 }
 
 /*
- * Find command node by callback name, returning prefix path
+ * Command index entry: where a callback name lives in the grammar
+ */
+typedef struct cmd_entry {
+    const char           *cb_name;
+    const struct ec_node *node;
+    char                 *prefix;   /* Group keywords leading to node */
+    const char           *help;
+    char                 *syntax;   /* Built on first use */
+    size_t                order;    /* Walk order, first match wins */
+} cmd_entry_t;
+
+struct cmd_index {
+    const struct ec_node *grammar;
+    cmd_entry_t          *entries;
+    size_t                count;
+    size_t                cap;
+};
+
+static int cmd_index_add(cmd_index_t *idx, const char *cb_name,
+                         const struct ec_node *node, const char *prefix,
+                         const char *help)
+{
+    cmd_entry_t *e;
+
+    if (idx->count == idx->cap) {
+        size_t cap = idx->cap ? idx->cap * 2 : 64;
+        cmd_entry_t *entries = realloc(idx->entries, cap * sizeof(*entries));
+        if (!entries)
+            return -1;
+        idx->entries = entries;
+        idx->cap = cap;
+    }
+
+    e = &idx->entries[idx->count];
+    e->prefix = strdup(prefix);
+    if (!e->prefix)
+        return -1;
+    e->cb_name = cb_name;
+    e->node = node;
+    e->help = help;
+    e->syntax = NULL;
+    e->order = idx->count;
+    idx->count++;
+    return 0;
+}
+
+/*
+ * Record every node carrying a callback name, with its group prefix
+ *
+ * Same traversal as a per-name search would do (keywords heading a seq
+ * extend the prefix for the following children), but all commands are
+ * collected in one walk. Command nodes are not descended into.
  */
-static const struct ec_node *find_cmd_node_with_prefix(const struct ec_node *node,
-                                                       const char *cb_name,
-                                                       char *prefix, size_t prefix_size)
+static int cmd_index_walk(cmd_index_t *idx, const struct ec_node *node,
+                          char *prefix, size_t prefix_size)
 {
     if (!node)
-        return NULL;
+        return 0;
 
-    const char *type = ec_node_type_name(ec_node_type(node));
     struct ec_dict *attrs = ec_node_attrs(node);
+    const char *cb_name = attrs ? ec_dict_get(attrs, ECLI_CB_NAME_ATTR) : NULL;
 
-    /* Check if this node has the callback we're looking for */
-    if (attrs) {
-        const char *node_cb = ec_dict_get(attrs, ECLI_CB_NAME_ATTR);
-        if (node_cb && strcmp(node_cb, cb_name) == 0) {
-            return node;
-        }
-    }
+    if (cb_name)
+        return cmd_index_add(idx, cb_name, node, prefix,
+                             ec_dict_get(attrs, ECLI_HELP_ATTR));
+
+    size_t n = ec_node_get_children_count(node);
+    const char *keyword = NULL;
 
     /* For seq nodes, first child might be a keyword to add to prefix */
-    if (strcmp(type, "seq") == 0) {
-        size_t n = ec_node_get_children_count(node);
-        if (n > 0) {
-            struct ec_node *first = get_child(node, 0);
-            if (first) {
-                const char *first_type = ec_node_type_name(ec_node_type(first));
-                if (strcmp(first_type, "str") == 0) {
-                    const char *keyword = get_str_value(first);
-                    if (keyword) {
-                        /* Save current prefix length */
-                        size_t orig_len = strlen(prefix);
-                        /* Append keyword to prefix */
-                        if (orig_len > 0) {
-                            strncat(prefix, " ", prefix_size - strlen(prefix) - 1);
-                        }
-                        strncat(prefix, keyword, prefix_size - strlen(prefix) - 1);
-
-                        /* Search remaining children */
-                        for (size_t i = 1; i < n; i++) {
-                            const struct ec_node *found =
-                                find_cmd_node_with_prefix(get_child(node, i),
-                                                         cb_name, prefix, prefix_size);
-                            if (found)
-                                return found;
-                        }
+    if (n > 0 && strcmp(ec_node_type_name(ec_node_type(node)), "seq") == 0) {
+        struct ec_node *first = get_child(node, 0);
+        if (first && strcmp(ec_node_type_name(ec_node_type(first)), "str") == 0)
+            keyword = get_str_value(first);
+    }
 
-                        /* Not found - restore prefix */
-                        prefix[orig_len] = '\0';
-                    }
-                }
-            }
+    if (keyword) {
+        size_t orig_len = strlen(prefix);
+
+        if (cmd_index_walk(idx, get_child(node, 0), prefix, prefix_size) < 0)
+            return -1;
+        if (orig_len > 0)
+            strncat(prefix, " ", prefix_size - strlen(prefix) - 1);
+        strncat(prefix, keyword, prefix_size - strlen(prefix) - 1);
+        for (size_t i = 1; i < n; i++) {
+            if (cmd_index_walk(idx, get_child(node, i), prefix, prefix_size) < 0)
+                return -1;
         }
+        prefix[orig_len] = '\0';
+        return 0;
     }
 
-    /* Recurse into children */
-    size_t n = ec_node_get_children_count(node);
     for (size_t i = 0; i < n; i++) {
-        struct ec_node *child = NULL;
-        if (ec_node_get_child(node, i, &child) == 0 && child) {
-            const struct ec_node *found =
-                find_cmd_node_with_prefix(child, cb_name, prefix, prefix_size);
-            if (found)
-                return found;
-        }
+        if (cmd_index_walk(idx, get_child(node, i), prefix, prefix_size) < 0)
+            return -1;
     }
-    return NULL;
+    return 0;
+}
+
+static int cmd_entry_cmp(const void *a, const void *b)
+{
+    const cmd_entry_t *ea = a;
+    const cmd_entry_t *eb = b;
+    int ret = strcmp(ea->cb_name, eb->cb_name);
+
+    if (ret != 0)
+        return ret;
+    return (ea->order > eb->order) - (ea->order < eb->order);
+}
+
+static int cmd_entry_cmp_key(const void *key, const void *elem)
+{
+    return strcmp(key, ((const cmd_entry_t *)elem)->cb_name);
+}
+
+static void cmd_index_free(cmd_index_t *idx)
+{
+    if (!idx)
+        return;
+    for (size_t i = 0; i < idx->count; i++) {
+        free(idx->entries[i].prefix);
+        free(idx->entries[i].syntax);
+    }
+    free(idx->entries);
+    free(idx);
 }
 
 /*
- * Build syntax string for a command - caller must free result
+ * Get the command index of a CLI context, building it on first use
  */
-static char *build_cmd_syntax(const struct ec_node *grammar, const char *cb_name)
+static cmd_index_t *cmd_index_get_locked(eecli_ctx_t *ctx)
 {
     char prefix[256] = "";
-    const struct ec_node *cmd_node =
-        find_cmd_node_with_prefix(grammar, cb_name, prefix, sizeof(prefix));
-    if (!cmd_node)
+    cmd_index_t *idx;
+    size_t n = 0;
+
+    if (!ctx || !ctx->grammar)
+        return NULL;
+    ctx = ecli_server(ctx);
+    if (ctx->cmd_index && ctx->cmd_index->grammar == ctx->grammar)
+        return ctx->cmd_index;
+
+    cmd_index_free(ctx->cmd_index);
+    ctx->cmd_index = NULL;
+
+    idx = calloc(1, sizeof(*idx));
+    if (!idx)
+        return NULL;
+    idx->grammar = ctx->grammar;
+
+    if (cmd_index_walk(idx, ctx->grammar, prefix, sizeof(prefix)) < 0) {
+        fprintf(stderr, " Failed to build command index\n");
+        cmd_index_free(idx);
+        return NULL;
+    }
+
+    qsort(idx->entries, idx->count, sizeof(idx->entries[0]), cmd_entry_cmp);
+
+    /* Keep the first occurrence of each name, in walk order */
+    for (size_t i = 0; i < idx->count; i++) {
+        if (n > 0 && strcmp(idx->entries[n - 1].cb_name,
+                            idx->entries[i].cb_name) == 0) {
+            free(idx->entries[i].prefix);
+            continue;
+        }
+        idx->entries[n++] = idx->entries[i];
+    }
+    idx->count = n;
+
+    ctx->cmd_index = idx;
+    return idx;
+}
+
+/*
+ * Find a command in the index. The entry belongs to the index, which is
+ * rebuilt when the grammar changes: only use it with g_index_lock held.
+ */
+static cmd_entry_t *cmd_index_lookup_locked(eecli_ctx_t *ctx, const char *cb_name)
+{
+    cmd_index_t *idx = cmd_index_get_locked(ctx);
+
+    if (!idx || !cb_name || idx->count == 0)
         return NULL;
 
+    return bsearch(cb_name, idx->entries, idx->count,
+                   sizeof(idx->entries[0]), cmd_entry_cmp_key);
+}
+
+/*
+ * Syntax string for a command, built on first use and kept in the entry
+ */
+static const char *cmd_entry_syntax_locked(cmd_entry_t *e)
+{
+    if (e->syntax)
+        return e->syntax;
+
     /* First check if node has an explicit expr config */
-    const struct ec_config *cfg = ec_node_get_config(cmd_node);
+    const struct ec_config *cfg = ec_node_get_config(e->node);
     if (cfg) {
         struct ec_config *expr = ec_config_dict_get(cfg, "expr");
-        if (expr && expr->type == EC_CONFIG_TYPE_STRING)
-            return strdup(expr->string);
+        if (expr && expr->type == EC_CONFIG_TYPE_STRING) {
+            e->syntax = strdup(expr->string);
+            return e->syntax;
+        }
     }
 
     /* Build syntax from node tree */
@@ -1847,15 +5639,15 @@ static char *build_cmd_syntax(const struct ec_node *grammar, const char *cb_name
     size_t pos = 0;
 
     /* Start with prefix (group keywords) */
-    if (prefix[0]) {
-        int n = snprintf(buf, 512, "%s", prefix);
+    if (e->prefix[0]) {
+        int n = snprintf(buf, 512, "%s", e->prefix);
         if (n > 0) pos = n;
     }
 
     /* Add command syntax from children */
-    size_t nchildren = ec_node_get_children_count(cmd_node);
+    size_t nchildren = ec_node_get_children_count(e->node);
     for (size_t i = 0; i < nchildren; i++) {
-        build_syntax_recursive(get_child(cmd_node, i), buf, 512, &pos);
+        build_syntax_recursive(get_child(e->node, i), buf, 512, &pos);
     }
 
     if (pos == 0) {
@@ -1863,7 +5655,164 @@ static char *build_cmd_syntax(const struct ec_node *grammar, const char *cb_name
         return NULL;
     }
 
-    return buf;
+    e->syntax = buf;
+    return e->syntax;
+}
+
+/*
+ * Copy the syntax and help of a command, NULL when unknown. The copies
+ * stay valid after g_index_lock is released, free them after use.
+ */
+static void cmd_index_describe(eecli_ctx_t *ctx, const char *cb_name,
+                               char **syntax, char **help)
+{
+    const char *str;
+    cmd_entry_t *e;
+
+    *syntax = NULL;
+    *help = NULL;
+    pthread_mutex_lock(&g_index_lock);
+    e = cmd_index_lookup_locked(ctx, cb_name);
+    if (e) {
+        str = cmd_entry_syntax_locked(e);
+        *syntax = str ? strdup(str) : NULL;
+        *help = e->help ? strdup(e->help) : NULL;
+    }
+    pthread_mutex_unlock(&g_index_lock);
+}
+
+/*
+ * Audit text of a programmatic command: the callback name followed by
+ * "id=value" for each argument, typed values in their canonical form.
+ * Truncated to the audit record size.
+ */
+static void exec_audit_fmt(const char *cb_name, const ecli_exec_arg_t *args,
+                           size_t nargs, char *buf, size_t size)
+{
+    char val[ECLI_FMT_IPV6_LEN];
+    size_t pos;
+    int n;
+
+    n = snprintf(buf, size, "%s", cb_name);
+    pos = n < 0 ? 0 : (size_t)n;
+    for (size_t i = 0; i < nargs && pos < size; i++) {
+        const ecli_val_t *v = &args[i].val;
+        const char *str = v->str ? v->str : "";
+        int prefix_len = -1;
+
+        switch (v->type) {
+        case ECLI_VAL_INT:
+            snprintf(val, sizeof(val), "%" PRId64, v->i64);
+            str = val;
+            break;
+        case ECLI_VAL_UINT:
+            snprintf(val, sizeof(val), "%" PRIu64, v->u64);
+            str = val;
+            break;
+        case ECLI_VAL_IPV4:
+            str = ecli_fmt_ipv4_r(v->ipv4.addr, val, sizeof(val));
+            prefix_len = v->ipv4.prefix_len;
+            break;
+        case ECLI_VAL_IPV6:
+            str = ecli_fmt_ipv6_r(&v->ipv6.addr, val, sizeof(val));
+            prefix_len = v->ipv6.prefix_len;
+            break;
+        case ECLI_VAL_MAC:
+            str = ecli_fmt_mac_r(v->mac, val, sizeof(val));
+            break;
+        default:
+            break;
+        }
+        if (prefix_len >= 0)
+            n = snprintf(buf + pos, size - pos, " %s=%s/%d", args[i].id,
+                         str ? str : "?", prefix_len);
+        else
+            n = snprintf(buf + pos, size - pos, " %s=%s", args[i].id,
+                         str ? str : "?");
+        if (n < 0)
+            break;
+        pos += (size_t)n;
+    }
+}
+
+/*
+ * Run a command handler by callback name with typed arguments
+ *
+ * The handler gets a parse tree built from args instead of a parsed line:
+ * an empty node of the command with one child per argument, holding its
+ * value under ECLI_VALUE_ATTR as the native address nodes do. The tree is
+ * built under g_index_lock, the index entry is not used past it.
+ */
+int ecli_exec(eecli_ctx_t *cli, const char *cb_name,
+              const ecli_exec_arg_t *args, size_t nargs)
+{
+    eecli_ctx_t *ctx = ecli_cur(cli);
+    char audit_cmd[ECLI_AUDIT_CMD_MAX];
+    struct ec_pnode *root = NULL;
+    ecli_cmd_cb_t cb = NULL;
+    cmd_entry_t *e;
+    bool locked;
+    int ret;
+
+    if (!ctx || !cb_name || (nargs && !args))
+        return -1;
+
+    pthread_mutex_lock(&g_index_lock);
+    e = cmd_index_lookup_locked(ctx, cb_name);
+    if (e)
+        cb = ec_dict_get(ec_node_attrs(e->node), ECLI_CB_ATTR);
+    if (!cb) {
+        pthread_mutex_unlock(&g_index_lock);
+        fprintf(stderr, " ecli_exec: unknown command '%s'\n", cb_name);
+        return -1;
+    }
+
+    root = ec_pnode(e->node);
+    if (!root)
+        goto fail;
+    for (size_t i = 0; i < nargs; i++) {
+        struct ec_node *node = ec_node_find((struct ec_node *)e->node, args[i].id);
+        struct ec_pnode *child;
+        ecli_val_t *val;
+
+        if (!node) {
+            fprintf(stderr, " ecli_exec: '%s' has no argument '%s'\n",
+                    cb_name, args[i].id);
+            goto fail;
+        }
+        child = ec_pnode(node);
+        if (!child)
+            goto fail;
+        ec_pnode_link_child(root, child);
+        val = malloc(sizeof(*val));
+        if (!val)
+            goto fail;
+        *val = args[i].val;
+        if (ec_dict_set(ec_pnode_get_attrs(child), ECLI_VALUE_ATTR, val, free) < 0)
+            goto fail;
+    }
+    pthread_mutex_unlock(&g_index_lock);
+
+    locked = handler_enter(ctx);
+    ret = cb(ctx, root);
+    /*
+     * Called from the application, not from a line: release its scratch,
+     * still under the handler lock as other threads may use the arena
+     */
+    if (t_handler_depth == 1)
+        arena_reset(&ctx->arena);
+    handler_leave(locked);
+    exec_audit_fmt(cb_name, args, nargs, audit_cmd, sizeof(audit_cmd));
+    audit_log(ctx, NULL, "exec", ret < 0 ? ECLI_AUDIT_FAILED : ECLI_AUDIT_OK,
+              audit_cmd);
+
+    ec_pnode_free(root);
+    return ret;
+
+fail:
+    pthread_mutex_unlock(&g_index_lock);
+    ec_pnode_free(root);
+    return -1;
 }
 
 /*
@@ -1871,20 +5820,15 @@ static char *build_cmd_syntax(const struct ec_node *grammar, const char *cb_name
  */
 void ecli_show_doc(eecli_ctx_t *cli, const char *cmd_name)
 {
-    eecli_ctx_t *ctx = cli ? cli : g_ecli_ctx;
+    eecli_ctx_t *ctx = ecli_cur(cli);
     if (!ctx)
         return;
 
     const ecli_doc_entry_t *doc = ecli_doc_lookup(cmd_name);
 
-    /* Get command syntax and help from grammar */
-    char *cmd_syntax = NULL;
-    const char *cmd_help = NULL;
-
-    if (ctx->grammar) {
-        cmd_syntax = build_cmd_syntax(ctx->grammar, cmd_name);
-        cmd_help = find_cmd_help(ctx->grammar, cmd_name);
-    }
+    /* Get command syntax and help from the command index */
+    char *cmd_syntax, *cmd_help;
+    cmd_index_describe(ctx, cmd_name, &cmd_syntax, &cmd_help);
 
     /* Output documentation */
     ecli_output(ctx, "\n");
@@ -1892,7 +5836,6 @@ void ecli_show_doc(eecli_ctx_t *cli, const char *cmd_name)
 
     if (cmd_syntax) {
         ecli_output(ctx, "    %s\n", cmd_syntax);
-        free(cmd_syntax);
     } else {
         ecli_output(ctx, "    %s\n", cmd_name);
     }
@@ -1930,31 +5873,18 @@ void ecli_show_doc(eecli_ctx_t *cli, const char *cmd_name)
     } else {
         ecli_output(ctx, "  (no extended documentation available)\n\n");
     }
+
+    free(cmd_syntax);
+    free(cmd_help);
 }
 
 /*
- * ecli_show_doc_file - Write documentation to a file
+ * Write the documentation of one command to fp in the given format
  */
-void ecli_show_doc_file(eecli_ctx_t *cli, const char *cmd_name,
-                       const char *filename, ecli_doc_fmt_t fmt)
+static void doc_write_entry(FILE *fp, const char *cmd_name, const char *cmd_syntax,
+                            const char *cmd_help, const ecli_doc_entry_t *doc,
+                            ecli_doc_fmt_t fmt)
 {
-    FILE *fp = fopen(filename, "w");
-    if (!fp) {
-        ecli_output(cli, "Error: cannot open file '%s': %s\n", filename, strerror(errno));
-        return;
-    }
-
-    eecli_ctx_t *ctx = cli ? cli : g_ecli_ctx;
-    const ecli_doc_entry_t *doc = ecli_doc_lookup(cmd_name);
-
-    char *cmd_syntax = NULL;
-    const char *cmd_help = NULL;
-
-    if (ctx && ctx->grammar) {
-        cmd_syntax = build_cmd_syntax(ctx->grammar, cmd_name);
-        cmd_help = find_cmd_help(ctx->grammar, cmd_name);
-    }
-
     switch (fmt) {
     case ECLI_DOC_FMT_MD:
         /* Markdown format */
@@ -2009,11 +5939,132 @@ void ecli_show_doc_file(eecli_ctx_t *cli, const char *cmd_name,
         }
         break;
     }
+}
 
-    free(cmd_syntax);
+static const char *doc_fmt_name(ecli_doc_fmt_t fmt)
+{
+    return (fmt == ECLI_DOC_FMT_MD) ? "Markdown" :
+           (fmt == ECLI_DOC_FMT_RST) ? "reStructuredText" : "plain text";
+}
+
+static const char *doc_fmt_ext(ecli_doc_fmt_t fmt)
+{
+    return (fmt == ECLI_DOC_FMT_MD) ? "md" :
+           (fmt == ECLI_DOC_FMT_RST) ? "rst" : "txt";
+}
+
+/*
+ * ecli_show_doc_file - Write documentation to a file
+ */
+void ecli_show_doc_file(eecli_ctx_t *cli, const char *cmd_name,
+                       const char *filename, ecli_doc_fmt_t fmt)
+{
+    FILE *fp = fopen(filename, "w");
+    if (!fp) {
+        ecli_output(cli, "Error: cannot open file '%s': %s\n", filename, strerror(errno));
+        return;
+    }
+
+    eecli_ctx_t *ctx = ecli_cur(cli);
+    const ecli_doc_entry_t *doc = ecli_doc_lookup(cmd_name);
+
+    char *cmd_syntax, *cmd_help;
+    cmd_index_describe(ctx, cmd_name, &cmd_syntax, &cmd_help);
+
+    doc_write_entry(fp, cmd_name, cmd_syntax, cmd_help, doc, fmt);
     fclose(fp);
+    free(cmd_syntax);
+    free(cmd_help);
+
+    ecli_output(cli, "Documentation written to '%s' (%s)\n", filename,
+                doc_fmt_name(fmt));
+}
+
+/*
+ * ecli_write_doc - Export the documentation of all commands
+ *
+ * The command index gives every command from a single grammar walk, and
+ * each one is joined with its ecli_doc entry by binary search, so the
+ * export is linear in the number of commands. Commands are written in
+ * callback name order.
+ *
+ * When path is an existing directory, each command goes to its own file
+ * "<path>/<callback>.<md|rst|txt>". Otherwise all commands are streamed
+ * to the single file path.
+ *
+ * @param cli  CLI context (NULL for the global one)
+ * @param path Output directory or file
+ * @param fmt  Output format
+ * @return Number of commands written, -1 on error
+ */
+int ecli_write_doc(eecli_ctx_t *cli, const char *path, ecli_doc_fmt_t fmt)
+{
+    eecli_ctx_t *ctx = ecli_cur(cli);
+    cmd_index_t *idx;
+    struct stat st;
+    bool per_file;
+    FILE *fp = NULL;
+    int count = 0;
+
+    if (!path)
+        return -1;
+
+    /*
+     * Build the documentation index first, it takes g_index_lock, then
+     * keep the lock across the export so the command index stays valid
+     */
+    doc_index_build();
+    pthread_mutex_lock(&g_index_lock);
+    idx = cmd_index_get_locked(ctx);
+    if (!idx) {
+        pthread_mutex_unlock(&g_index_lock);
+        ecli_output(cli, "Error: no commands available\n");
+        return -1;
+    }
+
+    per_file = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+    if (!per_file) {
+        fp = fopen(path, "w");
+        if (!fp) {
+            pthread_mutex_unlock(&g_index_lock);
+            ecli_output(cli, "Error: cannot open file '%s': %s\n", path, strerror(errno));
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < idx->count; i++) {
+        cmd_entry_t *cmd = &idx->entries[i];
+        const ecli_doc_entry_t *doc = doc_index_find(cmd->cb_name);
+
+        if (per_file) {
+            char filename[PATH_MAX];
+
+            snprintf(filename, sizeof(filename), "%s/%s.%s", path,
+                     cmd->cb_name, doc_fmt_ext(fmt));
+            fp = fopen(filename, "w");
+            if (!fp) {
+                pthread_mutex_unlock(&g_index_lock);
+                ecli_output(cli, "Error: cannot open file '%s': %s\n",
+                            filename, strerror(errno));
+                return -1;
+            }
+        }
+
+        doc_write_entry(fp, cmd->cb_name, cmd_entry_syntax_locked(cmd), cmd->help,
+                        doc, fmt);
+        count++;
+
+        if (per_file) {
+            fclose(fp);
+            fp = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&g_index_lock);
+    if (fp)
+        fclose(fp);
 
-    const char *fmt_name = (fmt == ECLI_DOC_FMT_MD) ? "Markdown" :
-                           (fmt == ECLI_DOC_FMT_RST) ? "reStructuredText" : "plain text";
-    ecli_output(cli, "Documentation written to '%s' (%s)\n", filename, fmt_name);
+    ecli_output(cli, "Documentation for %d commands written to '%s' (%s)\n",
+                count, path, doc_fmt_name(fmt));
+    return count;
 }
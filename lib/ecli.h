@@ -12,15 +12,36 @@
  * INITIALIZATION:
  *   ecli_init(config)                    - Start CLI in foreground/interactive mode
  *   ecli_init_tcp(config, base, port)    - Start CLI in TCP daemon mode
+ *   ecli_init_unix(config, base, path)   - Start CLI on a UNIX domain socket
+ *   ecli_listen(addr, base)              - Add a TCP/UNIX listener (sharding)
  *   ecli_shutdown()                      - Clean up and shutdown CLI
  *
+ * INSTANCES:
+ *   ecli_new(config)                     - Create a foreground instance
+ *   ecli_new_tcp(config, base, port)     - Create a TCP daemon instance
+ *   ecli_new_unix(config, base, path)    - Create a UNIX socket instance
+ *   ecli_instance_run(inst, running)     - Run an instance until exit is requested
+ *   ecli_instance_listen(inst, addr, base) - Add a listener to an instance
+ *   ecli_instance_load_config(inst, file) - Replay a config file on an instance
+ *   ecli_free(inst)                      - Destroy an instance
+ *
  * MAIN LOOP:
- *   ecli_run(running)                    - Run CLI event loop until *running=false
+ *   ecli_run(running)                    - Run CLI event loop until exit is requested
  *   ecli_request_exit()                  - Request CLI to stop (sets running=false)
+ *   ecli_instance_request_exit(inst)     - Same for one instance, signal-safe
+ *
+ * THREADS:
+ *   ecli_lock() / ecli_unlock()          - Handler lock (config.workers)
  *
  * OUTPUT:
  *   ecli_output(cli, fmt, ...)           - Printf-style output to CLI client
  *   ecli_show_help(cli)                  - Display available commands
+ *   ecli_show_help_topic(cli, topic)     - Display commands under topic
+ *   ecli_show_history(cli, match, count) - Display the latest history lines
+ *
+ * MEMORY:
+ *   ecli_scratch(cli, size)              - Scratch memory released after the command
+ *   ecli_scratch_strdup(cli, str)        - Copy a string into scratch memory
  *
  * CONFIG:
  *   ecli_load_config(filename)           - Load and replay config file at startup
@@ -28,21 +49,28 @@
  * QUERY:
  *   ecli_get_mode()                      - Get current mode (STDIN or TCP)
  *   ecli_uses_editline()                 - Check if editline is available
+ *   ecli_peer_cred(cli, uid, gid, pid)   - Credentials of a UNIX socket client
+ *   ecli_audit_dropped(cli)              - Audit records lost to a full queue
  *
  * CONTEXT:
- *   ecli_register_context_group(keyword) - Register group for context mode
+ *   ecli_enter_context(cli, name, arg)   - Enter a context level from a handler
+ *   ecli_context_arg(cli, name)          - Argument captured by a context level
+ *   ecli_register_context_group(keyword) - Deprecated, groups are always contexts
  */
 
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 /* Library version */
 #define ECLI_VERSION "1.0.0"
 
 /* Forward declarations */
 struct event_base;
+struct ec_node;
 
 /*
  * eecli_ctx_t - CLI context (opaque)
@@ -57,9 +85,12 @@ typedef struct eecli_ctx eecli_ctx_t;
  */
 typedef enum {
     ECLI_MODE_STDIN,  /* Interactive foreground mode (stdin/stdout) */
-    ECLI_MODE_TCP,    /* TCP daemon mode (libevent-based server) */
+    ECLI_MODE_TCP,    /* TCP/UNIX socket daemon mode (libevent-based server) */
 } ecli_mode_t;
 
+/* config.audit_keep value rotating the audit log without keeping old files */
+#define ECLI_AUDIT_KEEP_NONE ((unsigned int)-1)
+
 /*
  * ecli_config_t - CLI configuration
  *
@@ -72,6 +103,30 @@ typedef struct ecli_config {
     const char *grammar_env;  /* Env var for YAML grammar (default: "ECLI_GRAMMAR") */
     bool use_yaml;            /* Try YAML grammar first (default: false) */
     struct event_base *event_base; /* External event_base for async events (optional) */
+    struct ec_node *grammar;       /* Grammar (default: registered commands) */
+    /* TCP mode */
+    const char *const *listen;     /* NULL-terminated bind addresses (default: 127.0.0.1) */
+    unsigned int max_sessions;     /* Concurrent sessions (default: 1) */
+    bool reuseport;                /* SO_REUSEPORT on TCP listeners (default: false) */
+    unsigned int workers;          /* Session threads, 0: serve on event_base (default: 0) */
+    bool parallel_handlers;        /* Don't serialize handlers across threads (default: false) */
+    bool telnet;                   /* Telnet line editing on TCP sessions (default: false) */
+    /* Session limits */
+    unsigned int idle_timeout;     /* Seconds without input before closing (default: 0, none) */
+    size_t max_line;               /* Input line length (default: 0, 1024) */
+    size_t max_output;             /* Output queued per session (default: 0, UNLIMITED) */
+    unsigned int max_cmd_rate;     /* Commands per second (default: 0, unlimited) */
+    /* UNIX sockets */
+    unsigned int unix_mode;        /* Socket file mode (default: 0600, 0660 with unix_group) */
+    const char *unix_group;        /* Group also allowed to connect (default: NULL) */
+    /* Command history */
+    const char *history_file;      /* Persistent history log (default: NULL, none) */
+    size_t history_size;           /* Log size cap in bytes (default: 0, 8 MiB) */
+    /* Audit log */
+    const char *audit_file;        /* Log of the commands run (default: NULL, none) */
+    size_t audit_size;             /* Size before rotation in bytes (default: 0, 16 MiB) */
+    unsigned int audit_keep;       /* Rotated files kept (default: 0, 4) */
+    size_t audit_slots;            /* Records queued for the writer (default: 0, 1024) */
 } ecli_config_t;
 
 /*
@@ -83,7 +138,26 @@ typedef struct ecli_config {
     .version = "1.0.0", \
     .grammar_env = "ECLI_GRAMMAR", \
     .use_yaml = false, \
-    .event_base = NULL \
+    .event_base = NULL, \
+    .grammar = NULL, \
+    .listen = NULL, \
+    .max_sessions = 1, \
+    .reuseport = false, \
+    .workers = 0, \
+    .parallel_handlers = false, \
+    .telnet = false, \
+    .idle_timeout = 0, \
+    .max_line = 0, \
+    .max_output = 0, \
+    .max_cmd_rate = 0, \
+    .unix_mode = 0, \
+    .unix_group = NULL, \
+    .history_file = NULL, \
+    .history_size = 0, \
+    .audit_file = NULL, \
+    .audit_size = 0, \
+    .audit_keep = 0, \
+    .audit_slots = 0 \
 }
 
 /*
@@ -96,27 +170,217 @@ int ecli_init(const ecli_config_t *config);
 /*
  * ecli_init_tcp - Initialize CLI in TCP daemon mode
  *
+ * Listens on each address of config->listen, or on 127.0.0.1 when it is
+ * NULL. Addresses are "v4addr[:port]", "[v6addr][:port]", "v6addr" or
+ * "unix:/path"; port is used when they carry none. Each connection gets
+ * its own session (context stack, prompt) up to config->max_sessions.
+ * Clients of "unix:" listeners are authenticated as for ecli_init_unix().
+ *
+ * With config->telnet, TCP sessions negotiate character mode with the
+ * client (server echo, SGA, NAWS window size) and lines are edited on
+ * the server: TAB completes from the same cache as editline, '?' at the
+ * end of the line lists the matching commands, the arrow keys move the
+ * cursor and browse a per-session history. Raw line clients such as
+ * netcat should leave it off; UNIX socket sessions never use it.
+ *
+ * Session limits: a session without input for config->idle_timeout
+ * seconds is closed. Lines longer than config->max_line are rejected.
+ * Output queued for a client, including what the running command writes,
+ * is capped at config->max_output bytes: beyond it, output is dropped
+ * with a notice at the next prompt, so a client that never reads cannot
+ * grow the daemon's memory. max_output is 0, unlimited, by default: set
+ * it on any daemon reachable by untrusted clients. Size it above the
+ * largest command output (e.g. write terminal), which is only sent once
+ * the command returns. Over
+ * config->max_cmd_rate commands per second, reading the session pauses
+ * until the rate allows the next command, so no command is lost.
+ *
  * Returns: 0 on success, -1 on error
  */
 int ecli_init_tcp(const ecli_config_t *config, struct event_base *event_base, uint16_t port);
 
+/*
+ * Worker threads (config->workers)
+ *
+ * With workers > 0, connections are still accepted on the event_base
+ * given to ecli_init_tcp(), but each is handed over to one of the worker
+ * threads, each running its own event_base: reading, parsing, completion
+ * and handlers of the session never run on the application loop.
+ *
+ * Thread-safety contract for command handlers:
+ *   - A session is only ever served by one thread; ecli_output(),
+ *     ecli_err() and the context functions on its cli are safe.
+ *   - Handlers run with the handler lock held, so they never run
+ *     concurrently with each other. This also holds without workers once
+ *     ecli_listen() added a listener on another event_base. Application
+ *     threads touching state that handlers use take the same lock with
+ *     ecli_lock().
+ *   - With config->parallel_handlers, no lock is taken: handlers of
+ *     different sessions run concurrently and must synchronize by
+ *     themselves.
+ *   - Dynamic completion providers (ECLI_ARG_DYN) run on a helper thread
+ *     of the library, one call at a time per argument, without the
+ *     handler lock (see ecli_types.h).
+ *
+ * Other application threads may call ecli_output() with a NULL cli,
+ * ecli_request_exit(), ecli_dump_running_config(), ecli_out_register()
+ * and ecli_yaml_register() at any time between ecli_init*() and
+ * ecli_shutdown(): the global context and the registries are published
+ * atomically and read without a lock.
+ */
+
+/*
+ * ecli_lock - Take the handler lock
+ *
+ * Excludes command handlers of sessions served by worker threads.
+ * Not recursive: never call from a handler.
+ */
+void ecli_lock(void);
+
+/*
+ * ecli_unlock - Release the handler lock
+ */
+void ecli_unlock(void);
+
+/*
+ * ecli_init_unix - Initialize CLI on a UNIX domain socket
+ *
+ * Same server as ecli_init_tcp(), listening on path only. Clients of
+ * UNIX sockets are authenticated from their kernel credentials at
+ * accept time: root, the user running the daemon and, if set, members
+ * of config->unix_group (resolved once at init, so later changes to the
+ * group need a restart) are let in, others are refused. The socket file
+ * gets config->unix_mode and is removed on shutdown.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int ecli_init_unix(const ecli_config_t *config, struct event_base *event_base,
+                   const char *path);
+
+/*
+ * ecli_listen - Add a listener to the TCP server
+ *
+ * Sessions accepted on the listener are served by base (the server
+ * event_base when NULL). With config->reuseport, the same address can be
+ * bound once per event_base, each run by its own thread: the kernel then
+ * spreads connections across them. Handlers of such sessions run in the
+ * thread of their event_base, under the handler lock as with workers
+ * (see the thread-safety contract of ecli_init_tcp()).
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int ecli_listen(const char *addr, struct event_base *base);
+
 /*
  * ecli_shutdown - Shutdown CLI subsystem
+ *
+ * Frees the default instance. The registered commands grammar is built
+ * once per process and kept until ec_exit(), so ecli_init() may be
+ * called again afterwards.
  */
 void ecli_shutdown(void);
 
+/*
+ * Instances
+ *
+ * ecli_init*() create the default instance, used by the functions that
+ * take no instance. More instances can run in the same process, e.g. a
+ * foreground console next to a TCP management port, or two TCP ports
+ * with different grammars (config->grammar). Each one owns its grammar,
+ * indexes, sessions, output registrations and event_base, and is
+ * represented by its top-level context. Only one instance can use the
+ * terminal.
+ *
+ * Handlers get the session they run for as cli; ecli_output() and the
+ * other functions given a NULL cli use it too, else the default
+ * instance.
+ */
+
+/*
+ * ecli_new - Create a foreground (interactive) instance
+ *
+ * Returns: the instance, or NULL on error
+ */
+eecli_ctx_t *ecli_new(const ecli_config_t *config);
+
+/*
+ * ecli_new_tcp - Create a TCP daemon instance, as ecli_init_tcp()
+ *
+ * Returns: the instance, or NULL on error
+ */
+eecli_ctx_t *ecli_new_tcp(const ecli_config_t *config, struct event_base *event_base,
+                         uint16_t port);
+
+/*
+ * ecli_new_unix - Create a UNIX domain socket instance, as ecli_init_unix()
+ *
+ * Returns: the instance, or NULL on error
+ */
+eecli_ctx_t *ecli_new_unix(const ecli_config_t *config, struct event_base *event_base,
+                          const char *path);
+
+/*
+ * ecli_instance_run - Run the loop of an instance, as ecli_run()
+ *
+ * Instances sharing an event_base are all served by running one of them.
+ *
+ * Returns: 0 on normal exit, -1 on error
+ */
+int ecli_instance_run(eecli_ctx_t *inst, volatile bool *running);
+
+/*
+ * ecli_instance_listen - Add a listener to a TCP instance, as ecli_listen()
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int ecli_instance_listen(eecli_ctx_t *inst, const char *addr, struct event_base *base);
+
+/*
+ * ecli_instance_load_config - Replay a config file, as ecli_load_config()
+ *
+ * Returns: number of failed commands, -1 if the file could not be opened
+ */
+int ecli_instance_load_config(eecli_ctx_t *inst, const char *filename);
+
+/*
+ * ecli_free - Destroy an instance and its sessions
+ */
+void ecli_free(eecli_ctx_t *inst);
+
 /*
  * ecli_run - Run CLI main loop
  *
+ * Dispatches the event_base until ecli_request_exit() is called, which
+ * also clears *running. Stop the loop with ecli_request_exit(), not by
+ * clearing *running: the loop sleeps until an event and would not see it.
+ *
  * Returns: 0 on normal exit, -1 on error
  */
 int ecli_run(volatile bool *running);
 
 /*
  * ecli_request_exit - Request CLI to stop
+ *
+ * Stops the instance of the running command, else the default instance:
+ * clears its running flag and breaks its event loop right away. Safe to
+ * call from any thread.
+ *
+ * Not for signal handlers: finding the running command reads thread-local
+ * state, which is not async-signal-safe, and a signal delivered to a
+ * worker thread would stop the instance of the session it serves. Use
+ * ecli_instance_request_exit() there.
  */
 void ecli_request_exit(void);
 
+/*
+ * ecli_instance_request_exit - Request an instance to stop
+ *
+ * As ecli_request_exit() for inst, or for the default instance when inst
+ * is NULL. Async-signal-safe: it only loads atomics and writes to a pipe.
+ * Do not call it once inst is freed, or after ecli_shutdown() for NULL.
+ */
+void ecli_instance_request_exit(eecli_ctx_t *inst);
+
 /*
  * ecli_uses_editline - Check if editline is available
  */
@@ -127,6 +391,29 @@ bool ecli_uses_editline(void);
  */
 ecli_mode_t ecli_get_mode(void);
 
+/*
+ * ecli_peer_cred - Get the credentials of a UNIX socket client
+ *
+ * Any of uid, gid and pid may be NULL. cli NULL means the session running
+ * the current command.
+ *
+ * Returns: 0 on success, -1 if the session is not a UNIX socket client
+ */
+int ecli_peer_cred(eecli_ctx_t *cli, uid_t *uid, gid_t *gid, pid_t *pid);
+
+/*
+ * ecli_audit_dropped - Count the audit records lost so far
+ *
+ * With config->audit_file, every command line run by the instance (its
+ * sessions, terminal and config replay) is logged with its time, user,
+ * client address and result. Records are queued without blocking and
+ * written by a background thread; those arriving while config->audit_slots
+ * are all pending are dropped and counted here (and in the log).
+ *
+ * Returns: dropped records, 0 without audit log
+ */
+uint64_t ecli_audit_dropped(eecli_ctx_t *cli);
+
 /*
  * ecli_output - Output text to CLI client
  */
@@ -142,16 +429,84 @@ void ecli_output(eecli_ctx_t *cli, const char *fmt, ...)
 void ecli_err(eecli_ctx_t *cli, const char *fmt, ...)
     __attribute__((format(printf, 2, 3)));
 
+/*
+ * ecli_scratch - Allocate scratch memory for the running command
+ *
+ * Memory comes from the session arena and is released all at once when
+ * the command line has been run: never free it, and don't keep pointers
+ * to it after the handler returns. Suitably aligned for any type. Only
+ * available to command handlers (and what they call).
+ *
+ * Returns: pointer to size bytes, or NULL on allocation failure or when
+ * called outside a handler
+ */
+void *ecli_scratch(eecli_ctx_t *cli, size_t size);
+
+/*
+ * ecli_scratch_strdup - Copy a string into scratch memory
+ *
+ * Returns: copy of str with the lifetime of ecli_scratch(), or NULL
+ */
+char *ecli_scratch_strdup(eecli_ctx_t *cli, const char *str);
+
 /*
  * ecli_show_help - Display available commands
  */
 void ecli_show_help(eecli_ctx_t *cli);
 
 /*
- * ecli_register_context_group - Register a keyword as a context group
+ * ecli_show_help_topic - Display commands under topic
+ *
+ * topic is matched on whole words: "show ip" lists "show ip" and
+ * "show ip route", but not "show ipv6". Served from the help index built
+ * at init time (binary search on the sorted command paths). A NULL or
+ * empty topic lists all commands.
+ */
+void ecli_show_help_topic(eecli_ctx_t *cli, const char *topic);
+
+/* Lines listed by ecli_show_history() when count is 0 */
+#define ECLI_SHOW_HISTORY_DEFAULT 20
+
+/*
+ * ecli_show_history - Display the latest lines of the command history
+ *
+ * With config->history_file, the lines run by the sessions are appended
+ * to that log, tagged with their user: the client of a UNIX socket or the
+ * user of the terminal. TCP clients, which have no identity, are not
+ * logged. A session browses the lines of its user with the arrow keys
+ * (editline, telnet) across restarts. This lists the count latest ones
+ * containing match (all lines if NULL), oldest first; count 0 means
+ * ECLI_SHOW_HISTORY_DEFAULT.
+ */
+void ecli_show_history(eecli_ctx_t *cli, const char *match, size_t count);
+
+/*
+ * ecli_register_context_group - Deprecated, does nothing
+ *
+ * Any group found in the grammar can be entered as a context.
  */
 void ecli_register_context_group(const char *keyword);
 
+/*
+ * ecli_enter_context - Push a context level
+ *
+ * name is looked up in the grammar of the current level: its subtree is
+ * then the only grammar used for parsing, completion and help until the
+ * level is left with "exit" or "end". arg is copied and shown in the
+ * prompt ("app(interface-eth0)> "). Contexts not found in the grammar
+ * fall back to prefixing lines with the context path.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int ecli_enter_context(eecli_ctx_t *cli, const char *name, const char *arg);
+
+/*
+ * ecli_context_arg - Get the argument captured by a context level
+ *
+ * Returns: argument of the innermost level named name, or NULL
+ */
+const char *ecli_context_arg(eecli_ctx_t *cli, const char *name);
+
 /*
  * ecli_load_config - Load and replay configuration from a file
  *
@@ -0,0 +1,410 @@
+/*
+ * CLI Command Audit Log
+ *
+ * Copyright (C) 2026 Free Mobile, Vincent Jardin <vjardin@free.fr>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ *
+ * Rotating audit log fed through a lock-free ring, see ecli_audit.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <netdb.h>
+#include <sys/stat.h>
+
+#include "ecli_audit.h"
+
+/*
+ * A ring slot
+ *
+ * seq tells who owns the slot (bounded queue after D. Vyukov): it equals
+ * the enqueue position when the slot is free for it, that position + 1
+ * once the record is written, and moves one lap ahead when the writer
+ * has consumed it.
+ */
+typedef struct audit_slot {
+    _Atomic size_t          seq;
+    struct timespec         ts;
+    ecli_audit_result_t     result;
+    int64_t                 uid;
+    pid_t                   pid;
+    const char             *origin;
+    bool                    has_addr;
+    struct sockaddr_storage addr;
+    char                    cmd[ECLI_AUDIT_CMD_MAX];
+} audit_slot_t;
+
+struct ecli_audit {
+    audit_slot_t    *ring;
+    size_t           mask;
+    _Atomic size_t   head;              /* Next enqueue position */
+    size_t           tail;              /* Next dequeue position, writer only */
+    _Atomic uint64_t dropped;
+    uint64_t         dropped_logged;    /* Writer only */
+
+    char            *path;
+    FILE            *file;
+    size_t           size;              /* Bytes in the current file */
+    size_t           max_size;
+    unsigned int     keep;
+
+    pthread_t        thread;
+    int              wake_fd[2];
+    atomic_bool      sleeping;          /* Writer waits on wake_fd */
+    atomic_bool      stop;
+};
+
+static FILE *audit_fopen(ecli_audit_t *audit)
+{
+    int fd = open(audit->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    struct stat st;
+    FILE *file;
+
+    if (fd < 0)
+        return NULL;
+    file = fdopen(fd, "a");
+    if (!file) {
+        close(fd);
+        return NULL;
+    }
+    audit->size = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+    return file;
+}
+
+/*
+ * Shift path.N-1 to path.N, ..., path to path.1 and start a new file
+ */
+static void audit_rotate(ecli_audit_t *audit)
+{
+    size_t len = strlen(audit->path) + 16;
+    char from[len], to[len];
+    FILE *file;
+
+    fclose(audit->file);
+    audit->file = NULL;
+    if (audit->keep == 0) {
+        unlink(audit->path);
+    } else {
+        for (unsigned int i = audit->keep; i > 1; i--) {
+            snprintf(from, len, "%s.%u", audit->path, i - 1);
+            snprintf(to, len, "%s.%u", audit->path, i);
+            rename(from, to);
+        }
+        snprintf(to, len, "%s.1", audit->path);
+        rename(audit->path, to);
+    }
+
+    file = audit_fopen(audit);
+    if (!file)
+        fprintf(stderr, " Cannot reopen audit log %s: %s\n", audit->path, strerror(errno));
+    audit->file = file;
+}
+
+static void audit_format_src(const audit_slot_t *slot, char *buf, size_t len)
+{
+    char host[NI_MAXHOST], serv[NI_MAXSERV];
+
+    if (!slot->has_addr) {
+        snprintf(buf, len, "%s", slot->origin ? slot->origin : "-");
+        return;
+    }
+    switch (slot->addr.ss_family) {
+    case AF_UNIX:
+        snprintf(buf, len, "unix");
+        return;
+    case AF_INET:
+    case AF_INET6:
+        if (getnameinfo((const struct sockaddr *)&slot->addr, sizeof(slot->addr),
+                        host, sizeof(host), serv, sizeof(serv),
+                        NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
+            snprintf(buf, len, slot->addr.ss_family == AF_INET6 ? "[%s]:%s" : "%s:%s",
+                     host, serv);
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+    snprintf(buf, len, "-");
+}
+
+static const char *audit_result_str(ecli_audit_result_t result)
+{
+    switch (result) {
+    case ECLI_AUDIT_OK:          return "ok";
+    case ECLI_AUDIT_FAILED:      return "failed";
+    case ECLI_AUDIT_UNKNOWN:     return "unknown";
+    case ECLI_AUDIT_PARSE_ERROR: return "parse-error";
+    }
+    return "-";
+}
+
+static void audit_write_time(FILE *file, const struct timespec *ts)
+{
+    char buf[32];
+    struct tm tm;
+
+    gmtime_r(&ts->tv_sec, &tm);
+    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    fprintf(file, "%s.%03ldZ", buf, ts->tv_nsec / 1000000);
+}
+
+static void audit_write_cmd(FILE *file, const char *cmd)
+{
+    fputc('"', file);
+    for (const unsigned char *p = (const unsigned char *)cmd; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            fprintf(file, "\\%c", *p);
+        else if (*p < 0x20 || *p == 0x7f)
+            fprintf(file, "\\x%02x", *p);
+        else
+            fputc(*p, file);
+    }
+    fputc('"', file);
+}
+
+static void audit_write(ecli_audit_t *audit, const audit_slot_t *slot)
+{
+    FILE *file = audit->file;
+    char src[NI_MAXHOST + NI_MAXSERV + 4];
+    long start = ftell(file);
+
+    audit_format_src(slot, src, sizeof(src));
+    audit_write_time(file, &slot->ts);
+    if (slot->uid >= 0)
+        fprintf(file, " uid=%lld", (long long)slot->uid);
+    else
+        fprintf(file, " uid=-");
+    if (slot->pid > 0)
+        fprintf(file, " pid=%ld", (long)slot->pid);
+    else
+        fprintf(file, " pid=-");
+    fprintf(file, " src=%s result=%s cmd=", src, audit_result_str(slot->result));
+    audit_write_cmd(file, slot->cmd);
+    fputc('\n', file);
+
+    long end = ftell(file);
+    if (start >= 0 && end > start)
+        audit->size += (size_t)(end - start);
+}
+
+static void audit_write_dropped(ecli_audit_t *audit)
+{
+    uint64_t dropped = atomic_load_explicit(&audit->dropped, memory_order_relaxed);
+    struct timespec ts;
+
+    if (dropped == audit->dropped_logged)
+        return;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    audit_write_time(audit->file, &ts);
+    fprintf(audit->file, " dropped=%llu\n",
+            (unsigned long long)(dropped - audit->dropped_logged));
+    audit->dropped_logged = dropped;
+}
+
+/*
+ * Write out every record queued so far
+ *
+ * Returns: the number of records consumed
+ */
+static size_t audit_drain(ecli_audit_t *audit)
+{
+    size_t count = 0;
+
+    for (;;) {
+        audit_slot_t *slot = &audit->ring[audit->tail & audit->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+        if (seq != audit->tail + 1)
+            break;
+        if (audit->file) {
+            if (audit->max_size && audit->size >= audit->max_size)
+                audit_rotate(audit);
+            if (audit->file)
+                audit_write(audit, slot);
+        }
+        atomic_store_explicit(&slot->seq, audit->tail + audit->mask + 1,
+                              memory_order_release);
+        audit->tail++;
+        count++;
+    }
+    if (audit->file) {
+        audit_write_dropped(audit);
+        fflush(audit->file);
+    }
+    return count;
+}
+
+static void *audit_thread(void *arg)
+{
+    ecli_audit_t *audit = arg;
+    char buf[64];
+
+    for (;;) {
+        audit_drain(audit);
+        if (atomic_load(&audit->stop))
+            break;
+
+        /* Announce the wait, then look again for a record queued meanwhile */
+        atomic_store(&audit->sleeping, true);
+        if (audit_drain(audit) == 0 && !atomic_load(&audit->stop)) {
+            if (read(audit->wake_fd[0], buf, sizeof(buf)) < 0 && errno != EINTR)
+                break;
+        }
+        atomic_store(&audit->sleeping, false);
+    }
+    audit_drain(audit);
+    return NULL;
+}
+
+static void audit_wake(ecli_audit_t *audit)
+{
+    char c = 0;
+
+    if (atomic_exchange(&audit->sleeping, false)) {
+        ssize_t ret = write(audit->wake_fd[1], &c, 1);
+        (void)ret; /* Pipe full: a wakeup is already pending */
+    }
+}
+
+ecli_audit_t *ecli_audit_open(const char *path, size_t max_size, unsigned int keep,
+                              size_t slots)
+{
+    ecli_audit_t *audit;
+    sigset_t all, old;
+    size_t count = 1;
+    int err;
+
+    if (slots == 0)
+        slots = ECLI_AUDIT_SLOTS_DEFAULT;
+    while (count < slots)
+        count <<= 1;
+
+    audit = calloc(1, sizeof(*audit));
+    if (!audit)
+        return NULL;
+    audit->wake_fd[0] = audit->wake_fd[1] = -1;
+    audit->max_size = max_size ? max_size : ECLI_AUDIT_SIZE_DEFAULT;
+    if (keep == 0)
+        keep = ECLI_AUDIT_KEEP_DEFAULT;
+    audit->keep = keep == ECLI_AUDIT_KEEP_NONE ? 0 : keep;
+    audit->mask = count - 1;
+    audit->ring = calloc(count, sizeof(*audit->ring));
+    audit->path = strdup(path);
+    if (!audit->ring || !audit->path)
+        goto fail;
+    for (size_t i = 0; i < count; i++)
+        atomic_init(&audit->ring[i].seq, i);
+
+    audit->file = audit_fopen(audit);
+    if (!audit->file) {
+        fprintf(stderr, " Cannot open audit log %s: %s\n", path, strerror(errno));
+        goto fail;
+    }
+    if (pipe2(audit->wake_fd, O_CLOEXEC) < 0) {
+        fprintf(stderr, " Cannot create audit wakeup: %s\n", strerror(errno));
+        goto fail;
+    }
+    /* Signals go to the application threads, not to the writer */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    err = pthread_create(&audit->thread, NULL, audit_thread, audit);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err) {
+        fprintf(stderr, " Cannot start audit writer: %s\n", strerror(err));
+        goto fail;
+    }
+    return audit;
+
+fail:
+    if (audit->wake_fd[0] >= 0) {
+        close(audit->wake_fd[0]);
+        close(audit->wake_fd[1]);
+    }
+    if (audit->file)
+        fclose(audit->file);
+    free(audit->path);
+    free(audit->ring);
+    free(audit);
+    return NULL;
+}
+
+void ecli_audit_close(ecli_audit_t *audit)
+{
+    char c = 0;
+    ssize_t ret;
+
+    if (!audit)
+        return;
+    atomic_store(&audit->stop, true);
+    ret = write(audit->wake_fd[1], &c, 1);
+    (void)ret;
+    pthread_join(audit->thread, NULL);
+
+    close(audit->wake_fd[0]);
+    close(audit->wake_fd[1]);
+    if (audit->file)
+        fclose(audit->file);
+    free(audit->path);
+    free(audit->ring);
+    free(audit);
+}
+
+void ecli_audit_log(ecli_audit_t *audit, const struct sockaddr_storage *addr,
+                    const char *origin, int64_t uid, pid_t pid,
+                    ecli_audit_result_t result, const char *cmd)
+{
+    audit_slot_t *slot;
+    size_t pos;
+
+    if (!audit)
+        return;
+
+    /* Claim the slot at head, unless the writer has not freed it yet */
+    pos = atomic_load_explicit(&audit->head, memory_order_relaxed);
+    for (;;) {
+        slot = &audit->ring[pos & audit->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&audit->head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&audit->dropped, 1, memory_order_relaxed);
+            audit_wake(audit);
+            return;
+        } else {
+            pos = atomic_load_explicit(&audit->head, memory_order_relaxed);
+        }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &slot->ts);
+    slot->result = result;
+    slot->uid = uid;
+    slot->pid = pid;
+    slot->origin = origin;
+    slot->has_addr = addr != NULL;
+    if (addr)
+        slot->addr = *addr;
+    snprintf(slot->cmd, sizeof(slot->cmd), "%s", cmd ? cmd : "");
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    audit_wake(audit);
+}
+
+uint64_t ecli_audit_drops(ecli_audit_t *audit)
+{
+    return audit ? atomic_load(&audit->dropped) : 0;
+}
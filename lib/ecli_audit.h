@@ -0,0 +1,93 @@
+/*
+ * CLI Command Audit Log
+ *
+ * Copyright (C) 2026 Free Mobile, Vincent Jardin <vjardin@free.fr>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ *
+ * Internal to the library (not installed): records every command run
+ * by an instance (when, who, from where, with which result) to a
+ * rotating text file, without file I/O on the command path.
+ *
+ * QUICK REFERENCE
+ *
+ *   ecli_audit_open(path, max_size, keep, slots) - Start the audit writer
+ *   ecli_audit_close(audit)              - Flush pending records and stop
+ *   ecli_audit_log(audit, ...)           - Queue a record (any thread)
+ *   ecli_audit_drops(audit)              - Records lost to a full ring
+ *
+ * Records are queued in a bounded lock-free ring of slots, filled by the
+ * threads running commands and drained by one writer thread. When the
+ * ring is full, records are dropped and counted, and the writer notes
+ * the count in the file. Once the file reaches max_size it is renamed
+ * to path.1 (path.1 to path.2, ... up to path.<keep>) and a new one is
+ * started.
+ *
+ * FILE FORMAT
+ *
+ *   One line per command:
+ *
+ *     2026-01-02T03:04:05.678Z uid=1000 pid=4242 src=unix result=ok cmd="show run"
+ *
+ *   uid and pid are "-" when unknown, src is the client address
+ *   ("192.0.2.1:52000", "[2001:db8::1]:52000", "unix") or the origin
+ *   given for local commands ("console", "config", "exec"). cmd is quoted with
+ *   '"', '\' and control characters escaped.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "ecli.h"
+
+/* Longer command lines are truncated in the log */
+#define ECLI_AUDIT_CMD_MAX 512
+
+/* Defaults used when the configuration leaves them at 0 */
+#define ECLI_AUDIT_SIZE_DEFAULT  (16 * 1024 * 1024)
+#define ECLI_AUDIT_KEEP_DEFAULT  4
+#define ECLI_AUDIT_SLOTS_DEFAULT 1024
+
+typedef enum {
+    ECLI_AUDIT_OK,             /* Handler succeeded */
+    ECLI_AUDIT_FAILED,         /* Handler failed */
+    ECLI_AUDIT_UNKNOWN,        /* Line matched no command */
+    ECLI_AUDIT_PARSE_ERROR,    /* Line could not be parsed */
+} ecli_audit_result_t;
+
+typedef struct ecli_audit ecli_audit_t;
+
+/*
+ * ecli_audit_open - Open the audit file and start its writer thread
+ *
+ * slots is rounded up to a power of 2. keep is the number of rotated
+ * files kept, ECLI_AUDIT_KEEP_NONE for none.
+ *
+ * Returns: the audit log, or NULL on error (reported on stderr)
+ */
+ecli_audit_t *ecli_audit_open(const char *path, size_t max_size, unsigned int keep,
+                              size_t slots);
+
+/*
+ * ecli_audit_close - Write the queued records, stop the writer and close
+ */
+void ecli_audit_close(ecli_audit_t *audit);
+
+/*
+ * ecli_audit_log - Queue a record, timestamped now
+ *
+ * addr is the client address, or NULL for local commands, then shown as
+ * origin (a string literal). uid and pid are -1 and 0 when unknown.
+ * Never blocks: the record is dropped if the ring is full.
+ */
+void ecli_audit_log(ecli_audit_t *audit, const struct sockaddr_storage *addr,
+                    const char *origin, int64_t uid, pid_t pid,
+                    ecli_audit_result_t result, const char *cmd);
+
+/*
+ * ecli_audit_drops - Number of records dropped so far
+ */
+uint64_t ecli_audit_drops(ecli_audit_t *audit);
@@ -20,11 +20,18 @@
 
 /*
  * "help" - display available commands
+ * "help <topic>" - only those under topic (e.g., "help show")
  */
-ECLI_DEFUN(help, "help", "help", "show available commands")
+#define ID_HELP_TOPIC "topic"
+
+ECLI_DEFUN(help, "help", "help [topic]", "show available commands",
+    ECLI_ARG_ANY(ID_HELP_TOPIC, "command words to filter on"))
 {
-    ecli_output(cli, "Press TAB for command completion and contextual help.\n\n");
-    ecli_show_help(cli);
+    const char *topic = ecli_arg_str(parse, ID_HELP_TOPIC);
+
+    if (!topic)
+        ecli_output(cli, "Press TAB for command completion and contextual help.\n\n");
+    ecli_show_help_topic(cli, topic);
     return 0;
 }
 
@@ -80,6 +87,20 @@ ECLI_DEFUN_SUB0(show, version, "show_version", "version", "display version infor
     return 0;
 }
 
+/*
+ * "show history" - latest lines of the command history
+ * "show history <match>" - only those containing match
+ */
+#define ID_HIST_MATCH "hist_match"
+
+ECLI_DEFUN_SUB(show, history, "show_history", "history [hist_match]",
+    "display the command history",
+    ECLI_ARG_ANY(ID_HIST_MATCH, "text the lines contain"))
+{
+    ecli_show_history(cli, ecli_arg_str(parse, ID_HIST_MATCH), 0);
+    return 0;
+}
+
 /*
  * "show doc" - display or export command documentation
  *
@@ -174,6 +195,41 @@ ECLI_DEFUN_SUB(write, file, "write_file", "file filename", "save config to file"
     return 0;
 }
 
+/*
+ * "write doc" - export documentation of all commands
+ *
+ * Syntax:
+ *   write doc <dir|file>              - one file per command, or all in one
+ *   write doc <dir|file> format <fmt> - same, in md, rst or txt
+ */
+#define ID_DOC_PATH "doc_path"
+
+ECLI_DEFUN_SUB(write, doc, "write_doc", "doc doc_path [format doc_format]",
+    "export documentation of all commands",
+    _H("output directory or file", ec_node_re(ID_DOC_PATH, "[^ ]+")),
+    ECLI_ARG_DOC_FMT(ID_DOC_FMT, "format (md, rst, txt)"))
+{
+    const char *path = ecli_arg_str(parse, ID_DOC_PATH);
+    const char *format = ecli_arg_str(parse, ID_DOC_FMT);
+    ecli_doc_fmt_t fmt = ECLI_DOC_FMT_MD;
+
+    if (!path) {
+        ecli_output(cli, "Usage: write doc <dir|file> [format <fmt>]\n");
+        return 0;
+    }
+
+    if (format) {
+        if (strcmp(format, "rst") == 0)
+            fmt = ECLI_DOC_FMT_RST;
+        else if (strcmp(format, "txt") == 0)
+            fmt = ECLI_DOC_FMT_TXT;
+    }
+
+    /* Errors are reported by ecli_write_doc() */
+    ecli_write_doc(cli, path, fmt);
+    return 0;
+}
+
 ECLI_DEFUN_SUB(write, yaml, "write_yaml", "yaml filename", "export CLI grammar to YAML",
     _H("output filename", ec_node_re(ID_FILENAME, "[^ ]+")))
 {
@@ -42,6 +42,9 @@
  *   FMT_UINT  - unsigned int
  *   FMT_LONG  - long
  *   FMT_ULONG - unsigned long
+ *   FMT_IPV4  - uint32_t IPv4 address (network byte order)
+ *   FMT_MAC   - const uint8_t * (6 bytes)
+ *   FMT_IPV6  - const struct in6_addr *
  *
  * ARCHITECTURE OVERVIEW
  *
@@ -81,13 +84,13 @@
  * // Required: Initialize CLI command context
  * ECLI_CMD_CTX()
  *
- * static bool g_running = true;
+ * static volatile bool g_running = true;
  *
  * // Simple top-level command
  * ECLI_DEFUN(quit, "quit", "quit", "exit the application")
  * {
- *     g_running = false;
  *     ecli_output(cli, "Goodbye!\n");
+ *     ecli_request_exit();
  *     return 0;
  * }
  *
@@ -105,10 +108,9 @@
  * }
  *
  * int main(void) {
- *     ec_init();
- *     eecli_ctx_t *cli = ecli_init(&(ecli_config_t){ .prompt = "app> " });
- *     while (g_running) ecli_process(cli);
- *     ecli_shutdown(cli);
+ *     ecli_init(&(ecli_config_t){ .prompt = "app> " });
+ *     ecli_run(&g_running);
+ *     ecli_shutdown();
  *     return 0;
  * }
  *
@@ -416,6 +418,16 @@
  *   FMT_UINT  - Unsigned int
  *   FMT_LONG  - Signed long
  *   FMT_ULONG - Unsigned long
+ *   FMT_IPV4  - IPv4 address, uint32_t in network byte order
+ *   FMT_MAC   - MAC address, const uint8_t * to 6 bytes
+ *   FMT_IPV6  - IPv6 address, const struct in6_addr *
+ *
+ * Address tags are rendered straight into the output line, so a config
+ * dump never builds an intermediate string per address:
+ *
+ *   ECLI_OUT_FMT(cli, fp, "arp {ip} {mac}\n",
+ *       "ip",  FMT_IPV4, e->ip,
+ *       "mac", FMT_MAC,  e->mac, NULL);
  *
  * The argument list must end with NULL.
  *
@@ -699,6 +711,9 @@
  *   ecli_out_register(name, group, default_fmt, func, priority)
  *       Register an output function. Called by ECLI_DEFUN_SET.
  *
+ *   ecli_instance_out_register(inst, name, group, default_fmt, func, priority)
+ *       Same, shown by one instance only.
+ *
  *   ecli_dump_running_config(cli, fp)
  *       Dump all registered config. Called by "write terminal/file".
  *
@@ -711,25 +726,41 @@
  *
  * CONTEXT MODES
  *
- * Commands can enter context modes using ecli_enter_context():
+ * Every group is a context: typing its keyword alone ("show") enters it.
+ * Contexts taking an argument are declared with ECLI_DEFUN_CONTEXT and can
+ * be nested with ECLI_DEFUN_CONTEXT_SUB:
  *
- *   ECLI_DEFUN_SUB(interface_cmd, select, "interface_select",
- *       "interface ifname",
- *       "enter interface configuration mode",
+ *   ECLI_DEFUN_CONTEXT(iface, "interface_enter", "interface",
+ *       "configure an interface",
  *       ECLI_ARG_IFNAME("ifname", "interface name"))
+ *
+ *   ECLI_DEFUN_CONTEXT_SUB(iface, vlan, "vlan_enter", "vlan",
+ *       "configure a VLAN",
+ *       ECLI_ARG_VLAN("vlan_id", "VLAN ID"))
+ *
+ *   ECLI_DEFUN_SUB0(vlan, shutdown, "vlan_shutdown",
+ *       "shutdown", "disable the VLAN")
  *   {
- *       const char *ifname = ec_pnode_get_str(parse, "ifname");
- *       ecli_enter_context(cli, "interface", ifname);
- *       return 0;
+ *       const char *ifname = ecli_arg_ctx_str(cli, parse, "ifname");
+ *       const char *vid = ecli_arg_ctx_str(cli, parse, "vlan_id");
+ *       ...
  *   }
  *
+ * Any command handler can also enter a context explicitly with
+ * ecli_enter_context(cli, "interface", ifname).
+ *
  * In context mode:
  *   - Prompt changes: "app> " -> "app(interface-eth0)> "
- *   - "exit" returns to parent context
- *   - Context-specific commands become available
- *
- * Register a group as a context with ecli_register_context_group()
- * (done automatically by ECLI_DEFUN_GROUP).
+ *     -> "app(interface-eth0-vlan-10)> "
+ *   - Lines are parsed against the context subtree first; lines not
+ *     matching it are run from the enclosing levels, up to the top one
+ *     (e.g. "help", "show ...")
+ *   - Completion and help list the commands of the context subtree, and
+ *     those of the enclosing levels only when it has none for the words
+ *     typed
+ *   - "exit" returns to the parent context, "end" to the top level
+ *   - The same commands can be run in one line from the top level:
+ *     "interface eth0 vlan 10 shutdown"
  *
  *
  * ERROR HANDLING
@@ -771,7 +802,7 @@ typedef int (*ecli_cmd_cb_t)(eecli_ctx_t *cli, const struct ec_pnode *parse);
 typedef void (*ecli_out_t)(eecli_ctx_t *cli, FILE *fp, const char *fmt);
 
 typedef struct ecli_out_entry {
-    struct ecli_out_entry *next;
+    struct ecli_out_entry *next;   /* Unused, entries are kept in snapshots */
     const char   *name;        /* Callback name (matches yaml_cb) */
     const char   *group;       /* Group name for organized output */
     const char   *default_fmt; /* Default format string from C code */
@@ -786,12 +817,16 @@ typedef enum {
     ECLI_FMT_UINT,      /* unsigned int - unsigned integer */
     ECLI_FMT_LONG,      /* long - signed long integer */
     ECLI_FMT_ULONG,     /* unsigned long - unsigned long integer */
+    ECLI_FMT_IPV4,      /* uint32_t - IPv4 address, network byte order */
+    ECLI_FMT_MAC,       /* const uint8_t * - 6-byte MAC address */
+    ECLI_FMT_IPV6,      /* const struct in6_addr * - IPv6 address */
 } ecli_fmt_type_t;
 
 /* Attribute keys for storing CLI metadata on ec_node */
 #define ECLI_HELP_ATTR    "help"
 #define ECLI_CB_ATTR      "cli.callback"
 #define ECLI_CB_NAME_ATTR "callback"
+#define ECLI_CTX_ATTR     "cli.context"
 
 /* Shorthand type tags for ECLI_OUT_FMT */
 #define FMT_END   ECLI_FMT_END
@@ -800,6 +835,9 @@ typedef enum {
 #define FMT_UINT  ECLI_FMT_UINT
 #define FMT_LONG  ECLI_FMT_LONG
 #define FMT_ULONG ECLI_FMT_ULONG
+#define FMT_IPV4  ECLI_FMT_IPV4
+#define FMT_MAC   ECLI_FMT_MAC
+#define FMT_IPV6  ECLI_FMT_IPV6
 
 static inline struct ec_node *
 _cli_attr_help(const char *help, struct ec_node *node)
@@ -882,6 +920,96 @@ fail:
 
 #define _H(helpstr, node) _cli_attr_help((helpstr), (node))
 
+/*
+ * ecli_context_def_t - Context mode descriptor
+ *
+ * Attached under ECLI_CTX_ATTR to the grammar nodes that enter a context,
+ * so the context keyword, its captured argument and the subtree scoped to
+ * the new level can be found from either the parse tree or the grammar.
+ */
+typedef struct ecli_context_def {
+    const char      *keyword;  /* Context name, shown in the prompt */
+    const char      *arg_id;   /* Id of the captured argument (NULL if none) */
+    struct ec_node **sub;      /* Subtree parsed while in the context */
+} ecli_context_def_t;
+
+/*
+ * ecli_context_enter_cb - Enter the context(s) matched by a parse tree
+ *
+ * Callback of the nodes created by ECLI_DEFUN_CONTEXT. Pushes one level
+ * per context descriptor found in the parse tree, capturing its argument.
+ */
+int ecli_context_enter_cb(eecli_ctx_t *cli, const struct ec_pnode *parse);
+
+static inline struct ec_node *
+_cli_attr_context(const ecli_context_def_t *def, struct ec_node *node)
+{
+    if (node == NULL)
+        return NULL;
+    struct ec_dict *attrs = ec_node_attrs(node);
+    if (attrs == NULL)
+        goto fail;
+    if (ec_dict_set(attrs, ECLI_CTX_ATTR, (void *)def, NULL) < 0)
+        goto fail;
+    return node;
+fail:
+    ec_node_free(node);
+    return NULL;
+}
+
+/*
+ * _cli_add_context - Add the grammar of a context with argument to parent
+ *
+ * Two alternatives are added, the longest first since "or" nodes do not
+ * backtrack:
+ *   "keyword arg <subcommand>"  runs a context command in one line
+ *   "keyword arg"               enters the context (ecli_context_enter_cb)
+ * The argument node is shared by both through its reference count.
+ */
+static inline int
+_cli_add_context(struct ec_node *parent, ecli_context_def_t *def,
+                 const char *cb_name, const char *help, struct ec_node *arg)
+{
+    struct ec_node *oneshot, *enter;
+    char expr[128];
+
+    if (parent == NULL || arg == NULL || *def->sub == NULL) {
+        ec_node_free(arg);
+        return -1;
+    }
+    def->arg_id = ec_node_id(arg);
+    snprintf(expr, sizeof(expr), "%s %s", def->keyword, def->arg_id);
+
+    oneshot = _cli_attr_context(def, EC_NODE_SEQ(EC_NO_ID,
+        ec_node_str(EC_NO_ID, def->keyword),
+        ec_node_clone(arg),
+        *def->sub));
+    if (oneshot == NULL) {
+        /* The subtree was freed with the sequence */
+        *def->sub = NULL;
+        ec_node_free(arg);
+        return -1;
+    }
+
+    ecli_yaml_register(cb_name, ecli_context_enter_cb);
+    enter = _cli_attr_context(def,
+        _cli_attr_callback(ecli_context_enter_cb, cb_name,
+            _H(help, EC_NODE_CMD(EC_NO_ID, expr, arg))));
+    if (enter == NULL) {
+        ec_node_free(oneshot);
+        *def->sub = NULL;
+        return -1;
+    }
+
+    if (ec_node_or_add(parent, oneshot) < 0) {
+        ec_node_free(enter);
+        *def->sub = NULL;
+        return -1;
+    }
+    return ec_node_or_add(parent, enter);
+}
+
+
 /*
  * _cli_sub_keyword - Create a keyword str node with description for tab completion
  *
@@ -968,7 +1096,6 @@ extern struct ec_node *__cli_root;
     static struct ec_node *__grp_##grp = NULL; \
     static int _grp_init_##grp(void) { \
         __grp_##grp = ec_node("or", EC_NO_ID); \
-        ecli_register_context_group((keyword)); \
         return __grp_##grp ? 0 : -1; \
     } \
     static struct ec_init _grp_init_s_##grp = { \
@@ -998,7 +1125,6 @@ extern struct ec_node *__cli_root;
     struct ec_node *__grp_##grp = NULL; \
     static int _grp_init_##grp(void) { \
         __grp_##grp = ec_node("or", EC_NO_ID); \
-        ecli_register_context_group((keyword)); \
         return __grp_##grp ? 0 : -1; \
     } \
     static struct ec_init _grp_init_s_##grp = { \
@@ -1027,6 +1153,67 @@ extern struct ec_node *__cli_root;
 #define ECLI_USE_GROUP(grp) \
     extern struct ec_node *__grp_##grp
 
+/*
+ * ECLI_DEFUN_CONTEXT - Define a context mode entered with an argument
+ *
+ * Creates the group of commands available in the context (extend it with
+ * ECLI_DEFUN_SUB) and a "keyword arg" command entering it, e.g.
+ * "interface eth0" -> "app(interface-eth0)> ". The argument is captured
+ * on the context stack, see ecli_context_arg() and ecli_arg_ctx_str().
+ * The group commands can also be run in one line: "interface eth0 shutdown".
+ *
+ * Parameters:
+ *   grp     - Group name, used with ECLI_DEFUN_SUB and ECLI_DEFUN_CONTEXT_SUB
+ *   yaml_cb - Callback name of the enter command
+ *   kw      - Context keyword
+ *   helpstr - Help text of the enter command
+ *   argnode - Argument node (ECLI_ARG_*), its id names the argument
+ *
+ * Example:
+ *   ECLI_DEFUN_CONTEXT(iface, "interface_enter", "interface",
+ *       "configure an interface",
+ *       ECLI_ARG_IFNAME("ifname", "interface name"))
+ */
+#define ECLI_DEFUN_CONTEXT(grp, yaml_cb, kw, helpstr, argnode) \
+    _ECLI_DEFUN_CONTEXT(__cli_root, grp, yaml_cb, kw, helpstr, argnode, 125)
+
+/*
+ * ECLI_DEFUN_CONTEXT_SUB - Define a context nested in another context
+ *
+ * Same as ECLI_DEFUN_CONTEXT, entered from the parent context, e.g.
+ * "vlan 10" in "app(interface-eth0)> " -> "app(interface-eth0-vlan-10)> ".
+ *
+ * Example:
+ *   ECLI_DEFUN_CONTEXT_SUB(iface, vlan, "vlan_enter", "vlan",
+ *       "configure a VLAN",
+ *       ECLI_ARG_VLAN("vlan_id", "VLAN ID"))
+ */
+#define ECLI_DEFUN_CONTEXT_SUB(parent, grp, yaml_cb, kw, helpstr, argnode) \
+    _ECLI_DEFUN_CONTEXT(__grp_##parent, grp, yaml_cb, kw, helpstr, argnode, 120)
+
+#define _ECLI_DEFUN_CONTEXT(parent, grp, yaml_cb, kw, helpstr, argnode, prio) \
+    static struct ec_node *__grp_##grp = NULL; \
+    static ecli_context_def_t _ctx_def_##grp = { \
+        .keyword = (kw), .arg_id = NULL, .sub = &__grp_##grp \
+    }; \
+    static int _grp_init_##grp(void) { \
+        __grp_##grp = ec_node("or", EC_NO_ID); \
+        return __grp_##grp ? 0 : -1; \
+    } \
+    static struct ec_init _grp_init_s_##grp = { \
+        .init = _grp_init_##grp, .exit = NULL, .priority = 115 \
+    }; \
+    EC_INIT_REGISTER(_grp_init_s_##grp); \
+    \
+    static int _grp_add_##grp(void) { \
+        return _cli_add_context((parent), &_ctx_def_##grp, (yaml_cb), \
+                                (helpstr), (argnode)); \
+    } \
+    static struct ec_init _grp_add_s_##grp = { \
+        .init = _grp_add_##grp, .exit = NULL, .priority = (prio) \
+    }; \
+    EC_INIT_REGISTER(_grp_add_s_##grp)
+
 /*
  * ECLI_DEFUN_SUB0 - Define a simple subcommand without arguments
  *
@@ -1173,6 +1360,20 @@ extern struct ec_node *__cli_root;
  *
  * To strip documentation from release builds:
  *   objcopy --remove-section=.ecli_doc binary binary-stripped
+ *
+ * Compressed documentation:
+ *   Build the application with -DECLI_DOC_COMPRESSED. ECLI_DOC then only
+ *   emits a "name\0long_desc\0examples" text record into the
+ *   "ecli_doc_text" section (both strings must be literals). After linking,
+ *   pack the records into a single zlib blob:
+ *
+ *     ecli-docpack binary binary-packed
+ *
+ *   The blob lives in the non-loaded "ecli_docz" section, so it costs no
+ *   memory until the first ecli_doc_lookup(), which reads it from
+ *   /proc/self/exe and inflates it once. It is stripped the same way:
+ *     objcopy --remove-section=ecli_docz binary-packed binary-stripped
+ *   Requires libecli built with zlib (doc_compression option).
  */
 
 typedef struct ecli_doc_entry {
@@ -1181,6 +1382,20 @@ typedef struct ecli_doc_entry {
     const char *examples;    /* Example usage (newline separated) */
 } __attribute__((aligned(32))) ecli_doc_entry_t;
 
+/* Compressed documentation (see ECLI_DOC_COMPRESSED) */
+#define ECLI_DOC_TEXT_SECTION "ecli_doc_text"  /* Raw records, before packing */
+#define ECLI_DOCZ_SECTION     "ecli_docz"      /* Packed blob, not loaded */
+#define ECLI_DOCZ_MAGIC       "ECDZ"
+
+/*
+ * Header of the ecli_docz blob, followed by the zlib stream of the
+ * concatenated ecli_doc_text records
+ */
+typedef struct ecli_docz_hdr {
+    char     magic[4];       /* ECLI_DOCZ_MAGIC */
+    uint32_t raw_size;       /* Size of the inflated records */
+} ecli_docz_hdr_t;
+
 /* Section markers (defined by linker)
  * Weak symbols allow the code to detect if documentation was stripped. */
 extern const ecli_doc_entry_t __start_ecli_doc[] __attribute__((weak));
@@ -1200,6 +1415,11 @@ extern const ecli_doc_entry_t __stop_ecli_doc[] __attribute__((weak));
 #ifdef ECLI_NO_DOC
 #define ECLI_DOC(yaml_cb, long_desc_str, examples_str) \
     /* Documentation disabled */
+#elif defined(ECLI_DOC_COMPRESSED)
+#define ECLI_DOC(yaml_cb, long_desc_str, examples_str) \
+    static const char _doc_##yaml_cb[] \
+    __attribute__((section(ECLI_DOC_TEXT_SECTION), used, aligned(1))) = \
+        #yaml_cb "\0" long_desc_str "\0" examples_str
 #else
 #define ECLI_DOC(yaml_cb, long_desc_str, examples_str) \
     static const ecli_doc_entry_t _doc_##yaml_cb \
@@ -1227,6 +1447,9 @@ void ecli_show_doc(eecli_ctx_t *cli, const char *cmd_name);
 void ecli_show_doc_file(eecli_ctx_t *cli, const char *cmd_name,
                        const char *filename, ecli_doc_fmt_t fmt);
 
+/* Export documentation of all commands to a directory or a single file */
+int ecli_write_doc(eecli_ctx_t *cli, const char *path, ecli_doc_fmt_t fmt);
+
 extern struct ec_node *ecli_cmd_get_commands(void);
 
 static inline struct ec_node *ecli_cmd_get_root(void)
@@ -1241,9 +1464,29 @@ const char *ecli_arg_str(const struct ec_pnode *parse, const char *id);
 
 int ecli_arg_int(const struct ec_pnode *parse, const char *id, int def);
 
+/*
+ * ecli_arg_ctx_str - Get an argument from the parse tree or the context stack
+ *
+ * Looks up id in the parse tree first, then in the arguments captured by
+ * the enclosing contexts (innermost first), so a context command reads
+ * "ifname" the same way whether it was typed in one line or in the
+ * "interface eth0" context.
+ */
+const char *ecli_arg_ctx_str(eecli_ctx_t *cli, const struct ec_pnode *parse,
+                             const char *id);
+
 void ecli_out_register(const char *name, const char *group,
                       const char *default_fmt, ecli_out_t func, int priority);
 
+/*
+ * Register an output shown by "write terminal" of one instance only
+ *
+ * ecli_dump_running_config() merges them by priority with the outputs of
+ * the process (ecli_out_register()), which come first on ties.
+ */
+void ecli_instance_out_register(eecli_ctx_t *inst, const char *name, const char *group,
+                                const char *default_fmt, ecli_out_t func, int priority);
+
 void ecli_dump_running_config(eecli_ctx_t *cli, FILE *fp);
 
 const char *ecli_out_get_fmt(const char *name, const char *default_fmt);
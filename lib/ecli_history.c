@@ -0,0 +1,474 @@
+/*
+ * CLI Command History Log
+ *
+ * Copyright (C) 2026 Free Mobile, Vincent Jardin <vjardin@free.fr>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ *
+ * Append-only command history log, see ecli_history.h for the format.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "ecli_history.h"
+
+#define HIST_MAGIC      "ECLIHST1"
+#define HIST_HDR_SIZE   16
+#define HIST_REC_FIXED  12              /* Both lengths and the uid */
+#define HIST_LINE_MAX   65536           /* Longer lines are not kept */
+#define HIST_TAILS      64              /* Users whose last line is indexed */
+
+/* Last record of a user, to skip repeats without walking the log */
+typedef struct hist_tail {
+    uint32_t uid;
+    size_t   off;
+} hist_tail_t;
+
+struct ecli_history {
+    pthread_mutex_t lock;
+    char           *path;
+    int             fd;
+    dev_t           dev;                /* File of fd, replaced by compaction */
+    ino_t           ino;
+    size_t          max_size;
+    size_t          size;               /* Valid bytes, records end there */
+    const uint8_t  *map;                /* Read-only view of [0, map_len) */
+    size_t          map_len;
+    hist_tail_t     tails[HIST_TAILS];  /* Most recently active users */
+    size_t          ntails;
+};
+
+static size_t rec_size(uint32_t len)
+{
+    return HIST_REC_FIXED + ((len + 3) & ~(size_t)3);
+}
+
+static uint32_t load_u32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void hist_unmap(ecli_history_t *hist)
+{
+    if (hist->map)
+        munmap((void *)hist->map, hist->map_len);
+    hist->map = NULL;
+    hist->map_len = 0;
+}
+
+/*
+ * Map the first len bytes of the log
+ *
+ * The mapping spans max_size, past the end of the file, so appends
+ * show up in it without mapping again until the log is compacted.
+ */
+static int hist_map(ecli_history_t *hist, size_t len)
+{
+    void *map;
+
+    if (hist->map && hist->map_len >= len)
+        return 0;
+    hist_unmap(hist);
+    if (len < hist->max_size)
+        len = hist->max_size;
+    map = mmap(NULL, len, PROT_READ, MAP_SHARED, hist->fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+    hist->map = map;
+    hist->map_len = len;
+    return 0;
+}
+
+static hist_tail_t *hist_tail_find(ecli_history_t *hist, uint32_t uid)
+{
+    for (size_t i = 0; i < hist->ntails; i++) {
+        if (hist->tails[i].uid == uid)
+            return &hist->tails[i];
+    }
+    return NULL;
+}
+
+/*
+ * Index the record of uid at off, the newest one of that user
+ *
+ * When the index is full, the user idle for the longest time leaves it.
+ */
+static void hist_tail_set(ecli_history_t *hist, uint32_t uid, size_t off)
+{
+    hist_tail_t *t = hist_tail_find(hist, uid);
+
+    if (!t && hist->ntails < HIST_TAILS) {
+        t = &hist->tails[hist->ntails++];
+    } else if (!t) {
+        t = &hist->tails[0];
+        for (size_t i = 1; i < HIST_TAILS; i++) {
+            if (hist->tails[i].off < t->off)
+                t = &hist->tails[i];
+        }
+    }
+    t->uid = uid;
+    t->off = off;
+}
+
+/*
+ * Record ending at *end: moves *end to its start
+ *
+ * Returns: the record, or NULL at the start of the log
+ */
+static const uint8_t *rec_prev(const ecli_history_t *hist, size_t *end)
+{
+    size_t off = *end;
+    uint32_t len;
+    size_t size;
+
+    if (off < HIST_HDR_SIZE + HIST_REC_FIXED)
+        return NULL;
+    len = load_u32(hist->map + off - 4);
+    size = rec_size(len);
+    if (len > HIST_LINE_MAX || size > off - HIST_HDR_SIZE)
+        return NULL;
+    off -= size;
+    if (load_u32(hist->map + off) != len)
+        return NULL;
+    *end = off;
+    return hist->map + off;
+}
+
+/*
+ * Index the whole records in [off, len)
+ *
+ * Returns: the end of the last whole record
+ */
+static size_t hist_scan(ecli_history_t *hist, size_t off, size_t len)
+{
+    while (len - off >= HIST_REC_FIXED) {
+        uint32_t rlen = load_u32(hist->map + off);
+        size_t size = rec_size(rlen);
+
+        if (rlen > HIST_LINE_MAX || size > len - off ||
+            load_u32(hist->map + off + size - 4) != rlen)
+            break;
+        hist_tail_set(hist, load_u32(hist->map + off + 4), off);
+        off += size;
+    }
+    return off;
+}
+
+/*
+ * Catch up with the records appended by other processes
+ *
+ * With repair (exclusive lock held), a record torn by a crash is cut off.
+ */
+static int hist_refresh(ecli_history_t *hist, bool repair)
+{
+    struct stat st;
+    size_t len, end;
+
+    if (fstat(hist->fd, &st) < 0 || (size_t)st.st_size < HIST_HDR_SIZE)
+        return -1;
+    len = (size_t)st.st_size;
+    if (len < hist->size) {
+        /* Cut by another process: index it again */
+        hist->size = HIST_HDR_SIZE;
+        hist->ntails = 0;
+    }
+    if (hist_map(hist, len) < 0)
+        return -1;
+    if (len == hist->size)
+        return 0;
+
+    end = hist_scan(hist, hist->size, len);
+    if (end != len && repair && ftruncate(hist->fd, end) < 0) {
+        fprintf(stderr, " Cannot repair history %s: %s\n", hist->path, strerror(errno));
+        return -1;
+    }
+    hist->size = end;
+    return 0;
+}
+
+static int hist_open_fd(const char *path)
+{
+    return open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+}
+
+/*
+ * Switch to the log opened as fd, indexed from scratch
+ */
+static int hist_adopt(ecli_history_t *hist, int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) < 0)
+        return -1;
+    hist_unmap(hist);
+    close(hist->fd);
+    hist->fd = fd;
+    hist->dev = st.st_dev;
+    hist->ino = st.st_ino;
+    hist->size = HIST_HDR_SIZE;
+    hist->ntails = 0;
+    return 0;
+}
+
+static int hist_flock(int fd, int op)
+{
+    while (flock(fd, op) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Lock the log against other processes (LOCK_SH or LOCK_EX)
+ *
+ * A log compacted by another process was renamed over: the lock is
+ * taken on the new one. Records appended since the last call are
+ * indexed.
+ */
+static int hist_lock(ecli_history_t *hist, int op)
+{
+    struct stat st;
+
+    for (;;) {
+        int fd;
+
+        if (hist_flock(hist->fd, op) < 0)
+            return -1;
+        if (stat(hist->path, &st) < 0 ||
+            (st.st_dev == hist->dev && st.st_ino == hist->ino))
+            break;
+        fd = hist_open_fd(hist->path);
+        if (fd < 0 || hist_adopt(hist, fd) < 0) {
+            if (fd >= 0)
+                close(fd);
+            flock(hist->fd, LOCK_UN);
+            return -1;
+        }
+    }
+    if (hist_refresh(hist, op == LOCK_EX) < 0) {
+        flock(hist->fd, LOCK_UN);
+        return -1;
+    }
+    return 0;
+}
+
+ecli_history_t *ecli_history_open(const char *path, size_t max_size)
+{
+    ecli_history_t *hist;
+    uint8_t hdr[HIST_HDR_SIZE];
+    struct stat st;
+
+    hist = calloc(1, sizeof(*hist));
+    if (!hist)
+        return NULL;
+    pthread_mutex_init(&hist->lock, NULL);
+    hist->path = strdup(path);
+    hist->fd = hist_open_fd(path);
+    if (!hist->path || hist->fd < 0 || fstat(hist->fd, &st) < 0 ||
+        hist_flock(hist->fd, LOCK_EX) < 0) {
+        fprintf(stderr, " Cannot open history %s: %s\n", path, strerror(errno));
+        goto fail;
+    }
+    hist->dev = st.st_dev;
+    hist->ino = st.st_ino;
+    hist->size = HIST_HDR_SIZE;
+    hist->max_size = max_size ? max_size : ECLI_HISTORY_SIZE_DEFAULT;
+    if (hist->max_size < HIST_HDR_SIZE * 2)
+        hist->max_size = HIST_HDR_SIZE * 2;
+
+    /* Size read under the lock: another process may have created it */
+    if (fstat(hist->fd, &st) == 0 && st.st_size == 0) {
+        memset(hdr, 0, sizeof(hdr));
+        memcpy(hdr, HIST_MAGIC, strlen(HIST_MAGIC));
+        if (write(hist->fd, hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) {
+            fprintf(stderr, " Cannot write history %s: %s\n", path, strerror(errno));
+            goto fail;
+        }
+    } else if ((size_t)st.st_size < HIST_HDR_SIZE ||
+               hist_map(hist, (size_t)st.st_size) < 0 ||
+               memcmp(hist->map, HIST_MAGIC, strlen(HIST_MAGIC)) != 0) {
+        fprintf(stderr, " Not a history log: %s\n", path);
+        goto fail;
+    }
+    if (hist_refresh(hist, true) < 0) {
+        fprintf(stderr, " Cannot read history %s: %s\n", path, strerror(errno));
+        goto fail;
+    }
+
+    flock(hist->fd, LOCK_UN);
+    return hist;
+
+fail:
+    hist_unmap(hist);
+    if (hist->fd >= 0)
+        close(hist->fd);
+    pthread_mutex_destroy(&hist->lock);
+    free(hist->path);
+    free(hist);
+    return NULL;
+}
+
+void ecli_history_close(ecli_history_t *hist)
+{
+    if (!hist)
+        return;
+    hist_unmap(hist);
+    close(hist->fd);
+    pthread_mutex_destroy(&hist->lock);
+    free(hist->path);
+    free(hist);
+}
+
+/*
+ * Rewrite the log with the newest records filling half of max_size
+ *
+ * The new log is written aside, synced and renamed over the old one,
+ * then locked before the lock on the old one is released.
+ */
+static int hist_compact(ecli_history_t *hist)
+{
+    size_t keep = HIST_HDR_SIZE, start = hist->size;
+    size_t len = strlen(hist->path) + sizeof(".tmp");
+    char *tmp;
+    int fd;
+
+    for (;;) {
+        size_t prev = start;
+
+        if (!rec_prev(hist, &prev) || keep + (start - prev) > hist->max_size / 2)
+            break;
+        keep += start - prev;
+        start = prev;
+    }
+
+    tmp = malloc(len);
+    if (!tmp)
+        return -1;
+    snprintf(tmp, len, "%s.tmp", hist->path);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0 ||
+        write(fd, hist->map, HIST_HDR_SIZE) != HIST_HDR_SIZE ||
+        write(fd, hist->map + start, hist->size - start) != (ssize_t)(hist->size - start) ||
+        fsync(fd) < 0 ||
+        rename(tmp, hist->path) < 0) {
+        fprintf(stderr, " Cannot compact history %s: %s\n", hist->path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        free(tmp);
+        return -1;
+    }
+    close(fd);
+    free(tmp);
+
+    /* Appends now go to the new log */
+    fd = hist_open_fd(hist->path);
+    if (fd < 0)
+        return -1;
+    if (hist_flock(fd, LOCK_EX) < 0 || hist_adopt(hist, fd) < 0) {
+        close(fd);
+        return -1;
+    }
+    return hist_refresh(hist, true);
+}
+
+int ecli_history_add(ecli_history_t *hist, uint32_t uid, const char *line)
+{
+    static const uint8_t pad[4];
+    size_t len = strlen(line);
+    uint32_t rlen = (uint32_t)len;
+    uint32_t head[2] = { rlen, uid };
+    size_t size = rec_size(rlen);
+    struct iovec iov[4] = {
+        { head, sizeof(head) },
+        { (void *)line, len },
+        { (void *)pad, size - HIST_REC_FIXED - len },
+        { &rlen, sizeof(rlen) },
+    };
+    hist_tail_t *tail;
+    int ret = 0;
+
+    if (!hist || len == 0 || len > HIST_LINE_MAX)
+        return 0;
+
+    pthread_mutex_lock(&hist->lock);
+    if (hist_lock(hist, LOCK_EX) < 0) {
+        pthread_mutex_unlock(&hist->lock);
+        return -1;
+    }
+
+    /* Skip a repeat of the user's previous line */
+    tail = hist_tail_find(hist, uid);
+    if (tail) {
+        const uint8_t *rec = hist->map + tail->off;
+
+        if (load_u32(rec) == rlen && memcmp(rec + 8, line, len) == 0)
+            goto out;
+    }
+
+    if (hist->size + size > hist->max_size && hist_compact(hist) < 0) {
+        ret = -1;
+        goto out;
+    }
+    if (writev(hist->fd, iov, 4) != (ssize_t)size) {
+        /* Drop a partial record */
+        if (ftruncate(hist->fd, hist->size) < 0)
+            fprintf(stderr, " Cannot repair history %s: %s\n", hist->path, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+    hist_tail_set(hist, uid, hist->size);
+    hist->size += size;
+
+out:
+    flock(hist->fd, LOCK_UN);
+    pthread_mutex_unlock(&hist->lock);
+    return ret;
+}
+
+size_t ecli_history_search(ecli_history_t *hist, uint32_t uid, const char *match,
+                           size_t max, ecli_history_cb_t cb, void *arg)
+{
+    size_t mlen = match ? strlen(match) : 0;
+    size_t end, found = 0;
+    const uint8_t *rec;
+
+    if (!hist || max == 0)
+        return 0;
+
+    pthread_mutex_lock(&hist->lock);
+    if (hist_lock(hist, LOCK_SH) < 0)
+        goto out;
+    end = hist->size;
+    while ((rec = rec_prev(hist, &end)) != NULL) {
+        const char *text = (const char *)rec + 8;
+        uint32_t len = load_u32(rec);
+
+        if (load_u32(rec + 4) != uid)
+            continue;
+        if (mlen && !memmem(text, len, match, mlen))
+            continue;
+        found++;
+        if (cb(text, len, arg) || found == max)
+            break;
+    }
+    flock(hist->fd, LOCK_UN);
+out:
+    pthread_mutex_unlock(&hist->lock);
+    return found;
+}
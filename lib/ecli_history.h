@@ -0,0 +1,91 @@
+/*
+ * CLI Command History Log
+ *
+ * Copyright (C) 2026 Free Mobile, Vincent Jardin <vjardin@free.fr>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ *
+ * Internal to the library (not installed): the command history of an
+ * instance, persisted in an append-only log shared by its sessions.
+ *
+ * QUICK REFERENCE
+ *
+ *   ecli_history_open(path, max_size)    - Open or create a history log
+ *   ecli_history_close(hist)             - Close it
+ *   ecli_history_add(hist, uid, line)    - Append a command line
+ *   ecli_history_search(hist, uid, match, max, cb, arg)
+ *                                        - Walk the lines of a user, newest first
+ *
+ * FILE FORMAT
+ *
+ *   A 16-byte header ("ECLIHST1", then zeros) followed by records:
+ *
+ *     uint32_t len;          text length
+ *     uint32_t uid;          user
+ *     char     text[len];    not NUL-terminated, zero-padded to 4 bytes
+ *     uint32_t len;          again, to walk the log backwards
+ *
+ *   Integers are in host byte order. The log is read through a shared
+ *   mapping, kept across appends, and searched from its end, so recent
+ *   lines are found without reading the rest. The last record of each
+ *   recently active user is indexed to skip repeats. Records are appended
+ *   with a single writev() and a torn last record is cut off. Once the
+ *   log would exceed max_size, it is rewritten with its newest half,
+ *   synced, then renamed over.
+ *
+ *   Processes sharing a log take flock() on it: exclusive to append or
+ *   compact, shared to search. A process finding the log renamed over
+ *   follows the new one.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Log size cap used when the configuration leaves it at 0 */
+#define ECLI_HISTORY_SIZE_DEFAULT (8 * 1024 * 1024)
+
+typedef struct ecli_history ecli_history_t;
+
+/*
+ * Called for each line found, newest first
+ *
+ * line is not NUL-terminated and only valid during the call.
+ *
+ * Returns: 0 to go on, non-zero to stop the search
+ */
+typedef int (*ecli_history_cb_t)(const char *line, size_t len, void *arg);
+
+/*
+ * ecli_history_open - Open a history log, created if needed
+ *
+ * Returns: the log, or NULL on error (reported on stderr)
+ */
+ecli_history_t *ecli_history_open(const char *path, size_t max_size);
+
+/*
+ * ecli_history_close - Close a history log
+ */
+void ecli_history_close(ecli_history_t *hist);
+
+/*
+ * ecli_history_add - Append a line of a user
+ *
+ * Empty lines and a repeat of the user's previous line are skipped.
+ * Only the previous lines of the most recently active users are known.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int ecli_history_add(ecli_history_t *hist, uint32_t uid, const char *line);
+
+/*
+ * ecli_history_search - Walk the lines of a user, newest first
+ *
+ * Only lines containing match are reported, all of them when match is
+ * NULL. Stops after max lines or when cb returns non-zero. Safe from
+ * several threads.
+ *
+ * Returns: number of lines reported
+ */
+size_t ecli_history_search(ecli_history_t *hist, uint32_t uid, const char *match,
+                           size_t max, ecli_history_cb_t cb, void *arg);
@@ -0,0 +1,435 @@
+/*
+ * CLI Native Address Nodes
+ *
+ * Copyright (C) 2026 Free Mobile, Vincent Jardin <vjardin@free.fr>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ *
+ * libecoli node types matching IPv4/IPv6 addresses and prefixes and MAC
+ * addresses without going through a POSIX regex. Each node validates and
+ * converts its token in one pass, then stores the resulting ecli_val_t on
+ * the parse node (ECLI_VALUE_ATTR) so handlers never parse it again.
+ *
+ * Completion only proposes the argument placeholder when the partial token
+ * can still become a valid value, which is a plain character-class check.
+ *
+ * The "dynamic" node wraps any argument node and completes it with
+ * candidates fetched from the application through a provider callback,
+ * cached with a TTL. The provider runs on a helper thread, so a slow one
+ * never holds up completion beyond its deadline.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <netinet/in.h>
+
+#include <ecoli.h>
+
+#include "ecli_types.h"
+
+typedef int (*addr_conv_t)(const char *str, ecli_val_t *val);
+
+static int conv_ipv4(const char *str, ecli_val_t *val)
+{
+    if (strchr(str, '/') || ecli_parse_ipv4(str, &val->ipv4.addr) < 0)
+        return -1;
+    val->ipv4.prefix_len = -1;
+    val->type = ECLI_VAL_IPV4;
+    return 0;
+}
+
+static int conv_ipv4_prefix(const char *str, ecli_val_t *val)
+{
+    if (ecli_parse_ipv4_prefix(str, &val->ipv4.addr, &val->ipv4.prefix_len) < 0)
+        return -1;
+    val->type = ECLI_VAL_IPV4;
+    return 0;
+}
+
+static int conv_ipv6(const char *str, ecli_val_t *val)
+{
+    if (strchr(str, '/') || ecli_parse_ipv6(str, &val->ipv6.addr) < 0)
+        return -1;
+    val->ipv6.prefix_len = -1;
+    val->type = ECLI_VAL_IPV6;
+    return 0;
+}
+
+static int conv_ipv6_prefix(const char *str, ecli_val_t *val)
+{
+    if (ecli_parse_ipv6_prefix(str, &val->ipv6.addr, &val->ipv6.prefix_len) < 0)
+        return -1;
+    val->type = ECLI_VAL_IPV6;
+    return 0;
+}
+
+static int conv_mac(const char *str, ecli_val_t *val)
+{
+    if (strchr(str, '-') || ecli_parse_mac(str, val->mac) < 0)
+        return -1;
+    val->type = ECLI_VAL_MAC;
+    return 0;
+}
+
+static int conv_mac_any(const char *str, ecli_val_t *val)
+{
+    if (ecli_parse_mac(str, val->mac) < 0)
+        return -1;
+    val->type = ECLI_VAL_MAC;
+    return 0;
+}
+
+/*
+ * Common parse: match exactly one token and attach its binary value
+ */
+static int addr_parse(struct ec_pnode *pstate, const struct ec_strvec *strvec,
+                      addr_conv_t conv)
+{
+    const char *str;
+    ecli_val_t *val;
+
+    if (ec_strvec_len(strvec) == 0)
+        return EC_PARSE_NOMATCH;
+
+    str = ec_strvec_val(strvec, 0);
+    val = calloc(1, sizeof(*val));
+    if (!val)
+        return -1;
+
+    if (conv(str, val) < 0) {
+        free(val);
+        return EC_PARSE_NOMATCH;
+    }
+
+    /* str is owned by the strvec, which lives as long as the parse node */
+    val->str = str;
+    if (ec_dict_set(ec_pnode_get_attrs(pstate), ECLI_VALUE_ATTR, val, free) < 0)
+        return -1;
+
+    return 1;
+}
+
+/*
+ * Common completion: the token is a free-form argument, so only report an
+ * unknown completion when the partial token uses allowed characters.
+ */
+static int addr_complete(const struct ec_node *node, struct ec_comp *comp,
+                         const struct ec_strvec *strvec, const char *charset)
+{
+    if (ec_strvec_len(strvec) != 1)
+        return 0;
+
+    const char *str = ec_strvec_val(strvec, 0);
+    if (str[strspn(str, charset)] != '\0')
+        return 0;
+
+    return ec_complete_unknown(node, comp, strvec);
+}
+
+#define ECLI_CS_IPV4   "0123456789."
+#define ECLI_CS_IPV4_P "0123456789./"
+#define ECLI_CS_IPV6   "0123456789abcdefABCDEF:."
+#define ECLI_CS_IPV6_P "0123456789abcdefABCDEF:./"
+#define ECLI_CS_MAC    "0123456789abcdefABCDEF:"
+#define ECLI_CS_MAC_A  "0123456789abcdefABCDEF:-"
+
+#define ECLI_ADDR_NODE(kind, conv, charset) \
+    static int ecli_node_##kind##_parse(const struct ec_node *node, \
+                                        struct ec_pnode *pstate, \
+                                        const struct ec_strvec *strvec) \
+    { \
+        (void)node; \
+        return addr_parse(pstate, strvec, (conv)); \
+    } \
+    static int ecli_node_##kind##_complete(const struct ec_node *node, \
+                                           struct ec_comp *comp, \
+                                           const struct ec_strvec *strvec) \
+    { \
+        return addr_complete(node, comp, strvec, (charset)); \
+    } \
+    static struct ec_node_type ecli_node_##kind##_type = { \
+        .name = #kind, \
+        .parse = ecli_node_##kind##_parse, \
+        .complete = ecli_node_##kind##_complete, \
+    }; \
+    EC_NODE_TYPE_REGISTER(ecli_node_##kind##_type); \
+    struct ec_node *ecli_node_##kind(const char *id) \
+    { \
+        return ec_node_from_type(&ecli_node_##kind##_type, id); \
+    }
+
+ECLI_ADDR_NODE(ipv4, conv_ipv4, ECLI_CS_IPV4)
+ECLI_ADDR_NODE(ipv4_prefix, conv_ipv4_prefix, ECLI_CS_IPV4_P)
+ECLI_ADDR_NODE(ipv6, conv_ipv6, ECLI_CS_IPV6)
+ECLI_ADDR_NODE(ipv6_prefix, conv_ipv6_prefix, ECLI_CS_IPV6_P)
+ECLI_ADDR_NODE(mac, conv_mac, ECLI_CS_MAC)
+ECLI_ADDR_NODE(mac_any, conv_mac_any, ECLI_CS_MAC_A)
+
+/*
+ * Dynamic completion
+ */
+struct ecli_comp_list {
+    char   **items;
+    size_t   count;
+    size_t   cap;
+    uint64_t deadline_ms;
+    bool     expired;
+};
+
+struct dyn_node {
+    struct ec_node      *child;
+    ecli_comp_provider_t provider;
+    void                *opaque;
+    unsigned int         ttl_ms;
+    unsigned int         timeout_ms;
+    /* Candidate cache, sessions may complete from worker threads */
+    pthread_mutex_t      lock;
+    pthread_cond_t       done;      /* Refresh finished */
+    char               **cands;
+    size_t               count;
+    uint64_t             stamp_ms;  /* Last provider call */
+    bool                 cached;
+    bool                 refreshing; /* Provider running on its thread */
+};
+
+static uint64_t dyn_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void comp_items_free(char **items, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        free(items[i]);
+    free(items);
+}
+
+bool ecli_comp_expired(ecli_comp_list_t *list)
+{
+    if (!list->expired && dyn_now_ms() >= list->deadline_ms)
+        list->expired = true;
+    return list->expired;
+}
+
+int ecli_comp_add(ecli_comp_list_t *list, const char *str)
+{
+    if (ecli_comp_expired(list))
+        return -1;
+
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 16;
+        char **items = realloc(list->items, cap * sizeof(*items));
+        if (!items)
+            return -1;
+        list->items = items;
+        list->cap = cap;
+    }
+    list->items[list->count] = strdup(str);
+    if (!list->items[list->count])
+        return -1;
+    list->count++;
+    return 0;
+}
+
+/*
+ * Provider call, on its own thread so that the cache lock is not held
+ *
+ * A provider that misses its deadline does not replace the previous
+ * candidates (unless there were none). The TTL restarts from the call
+ * either way, so a slow provider is not called again on every TAB.
+ */
+static void *dyn_refresh_thread(void *arg)
+{
+    struct dyn_node *priv = arg;
+    ecli_comp_list_t list = { 0 };
+    int ret;
+
+    list.deadline_ms = dyn_now_ms() + priv->timeout_ms;
+    ret = priv->provider(&list, priv->opaque);
+    ecli_comp_expired(&list);
+
+    pthread_mutex_lock(&priv->lock);
+    if (ret < 0 || (list.expired && priv->cached)) {
+        comp_items_free(list.items, list.count);
+        priv->cached = priv->cached || ret >= 0;
+    } else {
+        comp_items_free(priv->cands, priv->count);
+        priv->cands = list.items;
+        priv->count = list.count;
+        priv->cached = true;
+    }
+    priv->refreshing = false;
+    pthread_cond_broadcast(&priv->done);
+    pthread_mutex_unlock(&priv->lock);
+    return NULL;
+}
+
+/*
+ * Start a refresh once the TTL has expired, lock held
+ *
+ * The candidates cached so far stay in use meanwhile. Without any, the
+ * caller waits for the provider until its deadline, not longer.
+ */
+static void dyn_refresh(struct dyn_node *priv)
+{
+    uint64_t now = dyn_now_ms();
+    sigset_t all, old;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int err;
+
+    if (!priv->refreshing && (!priv->cached || now - priv->stamp_ms >= priv->ttl_ms)) {
+        priv->stamp_ms = now;
+        priv->refreshing = true;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        /* Signals go to the application threads, not to the provider */
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        err = pthread_create(&thread, &attr, dyn_refresh_thread, priv);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        pthread_attr_destroy(&attr);
+        if (err)
+            priv->refreshing = false;
+    }
+
+    if (priv->refreshing && !priv->cached) {
+        uint64_t deadline = priv->stamp_ms + priv->timeout_ms;
+        struct timespec ts = {
+            .tv_sec = (time_t)(deadline / 1000),
+            .tv_nsec = (long)(deadline % 1000) * 1000000,
+        };
+
+        while (priv->refreshing &&
+               pthread_cond_timedwait(&priv->done, &priv->lock, &ts) == 0)
+            ;
+    }
+}
+
+static int ecli_node_dyn_parse(const struct ec_node *node,
+                               struct ec_pnode *pstate,
+                               const struct ec_strvec *strvec)
+{
+    struct dyn_node *priv = ec_node_priv(node);
+
+    return ec_parse_child(priv->child, pstate, strvec);
+}
+
+static int ecli_node_dyn_complete(const struct ec_node *node,
+                                  struct ec_comp *comp,
+                                  const struct ec_strvec *strvec)
+{
+    struct dyn_node *priv = ec_node_priv(node);
+    const char *str;
+    size_t len, added = 0;
+
+    if (ec_strvec_len(strvec) != 1)
+        return 0;
+
+    str = ec_strvec_val(strvec, 0);
+    len = strlen(str);
+    pthread_mutex_lock(&priv->lock);
+    dyn_refresh(priv);
+
+    for (size_t i = 0; i < priv->count; i++) {
+        if (strncmp(priv->cands[i], str, len) != 0)
+            continue;
+        if (!ec_comp_add_item(comp, node, EC_COMP_FULL, str, priv->cands[i])) {
+            pthread_mutex_unlock(&priv->lock);
+            return -1;
+        }
+        added++;
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    /* No known value: let the child propose its placeholder */
+    if (added == 0)
+        return ec_complete_child(priv->child, comp, strvec);
+    return 0;
+}
+
+static void ecli_node_dyn_free_priv(struct ec_node *node)
+{
+    struct dyn_node *priv = ec_node_priv(node);
+
+    /* A provider still running uses the node until it returns */
+    pthread_mutex_lock(&priv->lock);
+    while (priv->refreshing)
+        pthread_cond_wait(&priv->done, &priv->lock);
+    pthread_mutex_unlock(&priv->lock);
+
+    ec_node_free(priv->child);
+    comp_items_free(priv->cands, priv->count);
+    pthread_cond_destroy(&priv->done);
+    pthread_mutex_destroy(&priv->lock);
+}
+
+static size_t ecli_node_dyn_get_children_count(const struct ec_node *node)
+{
+    struct dyn_node *priv = ec_node_priv(node);
+
+    return priv->child ? 1 : 0;
+}
+
+static int ecli_node_dyn_get_child(const struct ec_node *node, size_t i,
+                                   struct ec_node **child)
+{
+    struct dyn_node *priv = ec_node_priv(node);
+
+    if (i > 0 || !priv->child)
+        return -1;
+    *child = priv->child;
+    return 0;
+}
+
+static struct ec_node_type ecli_node_dyn_type = {
+    .name = "dynamic",
+    .parse = ecli_node_dyn_parse,
+    .complete = ecli_node_dyn_complete,
+    .size = sizeof(struct dyn_node),
+    .free_priv = ecli_node_dyn_free_priv,
+    .get_children_count = ecli_node_dyn_get_children_count,
+    .get_child = ecli_node_dyn_get_child,
+};
+EC_NODE_TYPE_REGISTER(ecli_node_dyn_type);
+
+struct ec_node *ecli_node_dyn(const char *id, struct ec_node *child,
+                              ecli_comp_provider_t provider, void *opaque,
+                              unsigned int ttl_ms, unsigned int timeout_ms)
+{
+    pthread_condattr_t cattr;
+    struct ec_node *node;
+    struct dyn_node *priv;
+
+    if (!child || !provider) {
+        ec_node_free(child);
+        return NULL;
+    }
+
+    node = ec_node_from_type(&ecli_node_dyn_type, id);
+    if (!node) {
+        ec_node_free(child);
+        return NULL;
+    }
+
+    priv = ec_node_priv(node);
+    pthread_mutex_init(&priv->lock, NULL);
+    /* Deadlines are taken on the monotonic clock */
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&priv->done, &cattr);
+    pthread_condattr_destroy(&cattr);
+    priv->child = child;
+    priv->provider = provider;
+    priv->opaque = opaque;
+    priv->ttl_ms = ttl_ms;
+    priv->timeout_ms = timeout_ms;
+    return node;
+}
@@ -46,9 +46,22 @@ static int _cli_cmd_finalize(void)
     return __cli_commands ? 0 : -1;
 }
 
+/*
+ * Drop the library reference on the grammar at ec_exit()
+ *
+ * The grammar is built once per process, instances created and freed
+ * meanwhile only take and drop their own reference.
+ */
+static void _cli_cmd_release(void)
+{
+    ec_node_free(__cli_commands);
+    __cli_commands = NULL;
+    __cli_root = NULL;
+}
+
 static struct ec_init _cli_finit = {
     .init = _cli_cmd_finalize,
-    .exit = NULL,
+    .exit = _cli_cmd_release,
     .priority = 190
 };
 EC_INIT_REGISTER(_cli_finit);
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <arpa/inet.h>
@@ -17,6 +18,218 @@
 
 #include "ecli_types.h"
 
+/*
+ * Hand-rolled scanners
+ *
+ * The single and array parsers below share these. They walk the string
+ * once, use no libc conversion call and no temporary copy, and keep the
+ * loops fixed-length (4 octets, 6 bytes) so the compiler can unroll them.
+ * They accept exactly what inet_pton() accepts: four decimal octets
+ * without leading zeros for IPv4, and for IPv6 up to 8 groups of 1-4 hex
+ * digits with one "::" and an optional IPv4 tail.
+ */
+
+static inline int hex_digit(unsigned char c)
+{
+    if ((unsigned int)(c - '0') < 10)
+        return c - '0';
+    c |= 0x20;
+    if ((unsigned int)(c - 'a') < 6)
+        return c - 'a' + 10;
+    return -1;
+}
+
+/*
+ * Scan a dotted-quad IPv4 address
+ *
+ * @return Pointer to the first character after the address, NULL on error
+ */
+static const char *scan_ipv4(const char *p, uint32_t *addr)
+{
+    uint32_t host = 0;
+
+    for (int i = 0; i < 4; i++) {
+        unsigned int octet = 0;
+        int digits = 0;
+
+        if (i > 0 && *p++ != '.')
+            return NULL;
+        while ((unsigned int)(*p - '0') < 10 && digits < 3) {
+            octet = octet * 10 + (unsigned int)(*p - '0');
+            p++;
+            digits++;
+        }
+        if (digits == 0 || octet > 255 || (digits > 1 && p[-digits] == '0'))
+            return NULL;
+        host = (host << 8) | octet;
+    }
+
+    *addr = htonl(host);
+    return p;
+}
+
+/*
+ * Scan an IPv6 address
+ *
+ * @return Pointer to the first character after the address, NULL on error
+ */
+static const char *scan_ipv6(const char *p, struct in6_addr *addr)
+{
+    uint8_t buf[16];
+    int n = 0;                          /* Bytes scanned */
+    int gap = -1;                       /* Offset of "::" */
+
+    if (*p == ':') {
+        if (p[1] != ':')
+            return NULL;
+        gap = 0;
+        p += 2;
+    }
+    while (gap != n || hex_digit((unsigned char)*p) >= 0) {
+        const char *group = p;
+        unsigned int val = 0;
+        int digits = 0, d;
+
+        while (digits < 4 && (d = hex_digit((unsigned char)*p)) >= 0) {
+            val = (val << 4) | (unsigned int)d;
+            p++;
+            digits++;
+        }
+        if (*p == '.') {
+            uint32_t v4;
+
+            if (n > 12 || !(p = scan_ipv4(group, &v4)))
+                return NULL;
+            memcpy(buf + n, &v4, 4);
+            n += 4;
+            break;
+        }
+        if (digits == 0 || n == 16)
+            return NULL;
+        buf[n++] = (uint8_t)(val >> 8);
+        buf[n++] = (uint8_t)val;
+        if (*p != ':')
+            break;
+        if (*++p == ':') {
+            if (gap >= 0)
+                return NULL;
+            gap = n;
+            p++;
+        }
+    }
+
+    if (gap >= 0) {
+        if (n == 16)
+            return NULL;
+        memmove(buf + 16 - (n - gap), buf + gap, (size_t)(n - gap));
+        memset(buf + gap, 0, (size_t)(16 - n));
+    } else if (n != 16) {
+        return NULL;
+    }
+    memcpy(addr->s6_addr, buf, 16);
+    return p;
+}
+
+/*
+ * Scan a decimal prefix length up to max, which must end the string
+ */
+static int scan_prefix_len(const char *p, int max, int *prefix_len)
+{
+    int plen = 0;
+    int digits = 0;
+
+    while ((unsigned int)(*p - '0') < 10 && digits < 3) {
+        plen = plen * 10 + (*p - '0');
+        p++;
+        digits++;
+    }
+    if (digits == 0 || *p != '\0' || plen > max)
+        return -1;
+
+    *prefix_len = plen;
+    return 0;
+}
+
+/*
+ * Scan a MAC address: 6 groups of 1-2 hex digits, with one separator
+ * (':' or '-') used all along
+ */
+static int scan_mac(const char *p, uint8_t mac[6])
+{
+    char sep = '\0';
+
+    for (int i = 0; i < 6; i++) {
+        int hi, lo;
+
+        if (i > 0) {
+            if (sep == '\0') {
+                if (*p != ':' && *p != '-')
+                    return -1;
+                sep = *p;
+            } else if (*p != sep) {
+                return -1;
+            }
+            p++;
+        }
+        hi = hex_digit((unsigned char)*p);
+        if (hi < 0)
+            return -1;
+        p++;
+        lo = hex_digit((unsigned char)*p);
+        if (lo >= 0) {
+            hi = (hi << 4) | lo;
+            p++;
+        }
+        mac[i] = (uint8_t)hi;
+    }
+
+    return *p == '\0' ? 0 : -1;
+}
+
+/*
+ * Write an IPv4 address (no terminating NUL), return its length (<= 15)
+ */
+static size_t put_ipv4(char *buf, uint32_t addr)
+{
+    uint32_t host = ntohl(addr);
+    char *p = buf;
+
+    for (int i = 0; i < 4; i++) {
+        unsigned int octet = (host >> (24 - 8 * i)) & 0xff;
+
+        if (i > 0)
+            *p++ = '.';
+        if (octet >= 100) {
+            *p++ = (char)('0' + octet / 100);
+            octet %= 100;
+            *p++ = (char)('0' + octet / 10);
+        } else if (octet >= 10) {
+            *p++ = (char)('0' + octet / 10);
+        }
+        *p++ = (char)('0' + octet % 10);
+    }
+
+    return (size_t)(p - buf);
+}
+
+/*
+ * Write a MAC address (no terminating NUL), always 17 characters
+ */
+static size_t put_mac(char *buf, const uint8_t mac[6])
+{
+    static const char hex[] = "0123456789abcdef";
+    char *p = buf;
+
+    for (int i = 0; i < 6; i++) {
+        if (i > 0)
+            *p++ = ':';
+        *p++ = hex[mac[i] >> 4];
+        *p++ = hex[mac[i] & 0x0f];
+    }
+
+    return (size_t)(p - buf);
+}
+
 /*
  * Parse IPv4 address string to uint32_t (network byte order)
  *
@@ -26,15 +239,15 @@
  */
 int ecli_parse_ipv4(const char *str, uint32_t *addr)
 {
-    struct in_addr in;
+    const char *end;
 
     if (!str || !addr)
         return -1;
 
-    if (inet_pton(AF_INET, str, &in) != 1)
+    end = scan_ipv4(str, addr);
+    if (!end || *end != '\0')
         return -1;
 
-    *addr = in.s_addr;
     return 0;
 }
 
@@ -48,34 +261,16 @@ int ecli_parse_ipv4(const char *str, uint32_t *addr)
  */
 int ecli_parse_ipv4_prefix(const char *str, uint32_t *addr, int *prefix_len)
 {
-    char buf[64];
-    char *slash;
-    long plen;
+    const char *slash;
 
     if (!str || !addr || !prefix_len)
         return -1;
 
-    /* Copy to mutable buffer */
-    snprintf(buf, sizeof(buf), "%s", str);
-
-    /* Find the slash */
-    slash = strchr(buf, '/');
-    if (!slash)
-        return -1;
-
-    *slash = '\0';
-
-    /* Parse address */
-    if (ecli_parse_ipv4(buf, addr) < 0)
+    slash = scan_ipv4(str, addr);
+    if (!slash || *slash != '/')
         return -1;
 
-    /* Parse prefix length */
-    plen = strtol(slash + 1, NULL, 10);
-    if (plen < 0 || plen > 32)
-        return -1;
-
-    *prefix_len = (int)plen;
-    return 0;
+    return scan_prefix_len(slash + 1, 32, prefix_len);
 }
 
 /*
@@ -87,19 +282,41 @@ int ecli_parse_ipv4_prefix(const char *str, uint32_t *addr, int *prefix_len)
  */
 int ecli_parse_ipv6(const char *str, struct in6_addr *addr)
 {
+    const char *end;
+
     if (!str || !addr)
         return -1;
 
-    if (inet_pton(AF_INET6, str, addr) != 1)
+    end = scan_ipv6(str, addr);
+    return end && *end == '\0' ? 0 : -1;
+}
+
+/*
+ * Parse IPv6 prefix string to address and prefix length
+ *
+ * @param str        IPv6 prefix string (e.g., "2001:db8::/32")
+ * @param addr       Output address structure
+ * @param prefix_len Output prefix length (0-128)
+ * @return 0 on success, -1 on error
+ */
+int ecli_parse_ipv6_prefix(const char *str, struct in6_addr *addr, int *prefix_len)
+{
+    const char *slash;
+
+    if (!str || !addr || !prefix_len)
+        return -1;
+
+    slash = scan_ipv6(str, addr);
+    if (!slash || *slash != '/')
         return -1;
 
-    return 0;
+    return scan_prefix_len(slash + 1, 128, prefix_len);
 }
 
 /*
  * Parse MAC address string to 6-byte array
  *
- * Accepts formats:
+ * Accepts formats (1 or 2 hex digits per byte, one separator throughout):
  *   - aa:bb:cc:dd:ee:ff (colon-separated)
  *   - aa-bb-cc-dd-ee-ff (dash-separated)
  *
@@ -109,34 +326,10 @@ int ecli_parse_ipv6(const char *str, struct in6_addr *addr)
  */
 int ecli_parse_mac(const char *str, uint8_t mac[6])
 {
-    unsigned int bytes[6];
-    int ret;
-
     if (!str || !mac)
         return -1;
 
-    /* Try colon-separated format */
-    ret = sscanf(str, "%x:%x:%x:%x:%x:%x",
-                 &bytes[0], &bytes[1], &bytes[2],
-                 &bytes[3], &bytes[4], &bytes[5]);
-    if (ret != 6) {
-        /* Try dash-separated format */
-        ret = sscanf(str, "%x-%x-%x-%x-%x-%x",
-                     &bytes[0], &bytes[1], &bytes[2],
-                     &bytes[3], &bytes[4], &bytes[5]);
-    }
-
-    if (ret != 6)
-        return -1;
-
-    /* Validate range */
-    for (int i = 0; i < 6; i++) {
-        if (bytes[i] > 255)
-            return -1;
-        mac[i] = (uint8_t)bytes[i];
-    }
-
-    return 0;
+    return scan_mac(str, mac);
 }
 
 /*
@@ -174,21 +367,93 @@ int ecli_parse_bool(const char *str, bool *value)
     return -1;
 }
 
+/*
+ * Format IPv4 address into a caller-provided buffer
+ *
+ * @param addr IPv4 address in network byte order
+ * @param buf  Output buffer
+ * @param size Size of buf (ECLI_FMT_IPV4_LEN is always enough)
+ * @return buf on success, NULL if buf is too small
+ */
+const char *ecli_fmt_ipv4_r(uint32_t addr, char *buf, size_t size)
+{
+    char tmp[ECLI_FMT_IPV4_LEN];
+    size_t len;
+
+    if (!buf)
+        return NULL;
+
+    if (size >= ECLI_FMT_IPV4_LEN) {
+        buf[put_ipv4(buf, addr)] = '\0';
+        return buf;
+    }
+
+    len = put_ipv4(tmp, addr);
+    if (len >= size)
+        return NULL;
+    memcpy(buf, tmp, len);
+    buf[len] = '\0';
+    return buf;
+}
+
+/*
+ * Format MAC address into a caller-provided buffer
+ *
+ * @param mac  6-byte MAC address
+ * @param buf  Output buffer
+ * @param size Size of buf (at least ECLI_FMT_MAC_LEN)
+ * @return buf on success, NULL if buf is too small
+ */
+const char *ecli_fmt_mac_r(const uint8_t mac[6], char *buf, size_t size)
+{
+    if (!mac || !buf || size < ECLI_FMT_MAC_LEN)
+        return NULL;
+
+    buf[put_mac(buf, mac)] = '\0';
+    return buf;
+}
+
+/*
+ * Format IPv6 address into a caller-provided buffer
+ *
+ * @param addr IPv6 address
+ * @param buf  Output buffer
+ * @param size Size of buf (ECLI_FMT_IPV6_LEN is always enough)
+ * @return buf on success, NULL if buf is too small
+ */
+const char *ecli_fmt_ipv6_r(const struct in6_addr *addr, char *buf, size_t size)
+{
+    if (!addr || !buf || size > (size_t)INT32_MAX)
+        return NULL;
+
+    return inet_ntop(AF_INET6, addr, buf, (socklen_t)size);
+}
+
+/*
+ * Per-thread rotating buffers for the legacy formatters
+ *
+ * Each thread gets ECLI_FMT_SLOTS buffers used in turn, so up to that many
+ * results can be alive at once, e.g. in one ecli_output() argument list.
+ */
+#define ECLI_FMT_SLOTS 4
+
 /*
  * Format IPv4 address to string
  *
- * Uses static buffer - not thread-safe for multiple concurrent calls.
+ * Returns one of ECLI_FMT_SLOTS per-thread buffers: safe across threads
+ * and for a few calls in the same expression. Prefer ecli_fmt_ipv4_r()
+ * when the result has to live longer.
  *
  * @param addr IPv4 address in network byte order
- * @return Pointer to static string buffer
+ * @return Pointer to a per-thread string buffer
  */
 const char *ecli_fmt_ipv4(uint32_t addr)
 {
-    static char buf[INET_ADDRSTRLEN];
-    struct in_addr in;
+    static _Thread_local char bufs[ECLI_FMT_SLOTS][ECLI_FMT_IPV4_LEN];
+    static _Thread_local unsigned int slot;
+    char *buf = bufs[slot++ % ECLI_FMT_SLOTS];
 
-    in.s_addr = addr;
-    inet_ntop(AF_INET, &in, buf, sizeof(buf));
+    buf[put_ipv4(buf, addr)] = '\0';
 
     return buf;
 }
@@ -196,17 +461,506 @@ const char *ecli_fmt_ipv4(uint32_t addr)
 /*
  * Format MAC address to string
  *
- * Uses static buffer - not thread-safe for multiple concurrent calls.
+ * Same buffer rules as ecli_fmt_ipv4(). Prefer ecli_fmt_mac_r() when the
+ * result has to live longer.
  *
  * @param mac 6-byte MAC address
- * @return Pointer to static string buffer
+ * @return Pointer to a per-thread string buffer
  */
 const char *ecli_fmt_mac(const uint8_t mac[6])
 {
-    static char buf[18];
+    static _Thread_local char bufs[ECLI_FMT_SLOTS][ECLI_FMT_MAC_LEN];
+    static _Thread_local unsigned int slot;
+    char *buf = bufs[slot++ % ECLI_FMT_SLOTS];
 
-    snprintf(buf, sizeof(buf), "%02x:%02x:%02x:%02x:%02x:%02x",
-             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    buf[put_mac(buf, mac)] = '\0';
 
     return buf;
 }
+
+/*
+ * Parse an array of IPv4 address strings
+ *
+ * Meant for bulk imports (static ARP or route tables): one call converts a
+ * whole batch with the same scanner as ecli_parse_ipv4(). Conversion stops
+ * at the first invalid entry, so a return value below n is the index of
+ * the offending string.
+ *
+ * @param strs  Input strings
+ * @param addrs Output addresses in network byte order (n entries)
+ * @param n     Number of strings
+ * @return Number of leading entries converted
+ */
+size_t ecli_parse_ipv4_array(const char *const strs[], uint32_t addrs[], size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        const char *end = strs[i] ? scan_ipv4(strs[i], &addrs[i]) : NULL;
+
+        if (!end || *end != '\0')
+            break;
+    }
+
+    return i;
+}
+
+/*
+ * Parse an array of IPv4 prefix strings
+ *
+ * @param strs        Input strings (e.g., "10.0.0.0/8")
+ * @param addrs       Output addresses in network byte order (n entries)
+ * @param prefix_lens Output prefix lengths (n entries)
+ * @param n           Number of strings
+ * @return Number of leading entries converted
+ */
+size_t ecli_parse_ipv4_prefix_array(const char *const strs[], uint32_t addrs[],
+                                    int prefix_lens[], size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        const char *slash = strs[i] ? scan_ipv4(strs[i], &addrs[i]) : NULL;
+
+        if (!slash || *slash != '/' ||
+            scan_prefix_len(slash + 1, 32, &prefix_lens[i]) < 0)
+            break;
+    }
+
+    return i;
+}
+
+/*
+ * Parse an array of IPv6 address strings
+ *
+ * @param strs  Input strings
+ * @param addrs Output addresses (n entries)
+ * @param n     Number of strings
+ * @return Number of leading entries converted
+ */
+size_t ecli_parse_ipv6_array(const char *const strs[], struct in6_addr addrs[], size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (ecli_parse_ipv6(strs[i], &addrs[i]) < 0)
+            break;
+    }
+
+    return i;
+}
+
+/*
+ * Parse an array of MAC address strings
+ *
+ * @param strs Input strings
+ * @param macs Output MAC addresses (n entries)
+ * @param n    Number of strings
+ * @return Number of leading entries converted
+ */
+size_t ecli_parse_mac_array(const char *const strs[], uint8_t macs[][6], size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (!strs[i] || scan_mac(strs[i], macs[i]) < 0)
+            break;
+    }
+
+    return i;
+}
+
+/*
+ * Format an array of IPv4 addresses into one buffer
+ *
+ * Entries are written back to back, each followed by sep, and the buffer
+ * is always NUL-terminated. Only whole entries are written: when the
+ * buffer fills up, call again from the returned index.
+ *
+ * @param addrs Addresses in network byte order
+ * @param n     Number of addresses
+ * @param sep   Character written after each entry (e.g., '\n')
+ * @param buf   Output buffer
+ * @param size  Size of buf
+ * @return Number of entries written
+ */
+size_t ecli_fmt_ipv4_array(const uint32_t addrs[], size_t n, char sep,
+                           char *buf, size_t size)
+{
+    size_t off = 0;
+    size_t i;
+
+    if (!buf || size == 0)
+        return 0;
+
+    for (i = 0; i < n; i++) {
+        /* Worst case: 15 characters, separator, final NUL */
+        if (size - off < INET_ADDRSTRLEN + 1)
+            break;
+        off += put_ipv4(buf + off, addrs[i]);
+        buf[off++] = sep;
+    }
+    buf[off] = '\0';
+
+    return i;
+}
+
+/*
+ * Format an array of MAC addresses into one buffer
+ *
+ * Same contract as ecli_fmt_ipv4_array().
+ *
+ * @param macs MAC addresses
+ * @param n    Number of addresses
+ * @param sep  Character written after each entry (e.g., '\n')
+ * @param buf  Output buffer
+ * @param size Size of buf
+ * @return Number of entries written
+ */
+size_t ecli_fmt_mac_array(const uint8_t macs[][6], size_t n, char sep,
+                          char *buf, size_t size)
+{
+    size_t off = 0;
+    size_t i;
+
+    if (!buf || size == 0)
+        return 0;
+
+    for (i = 0; i < n; i++) {
+        if (size - off < 17 + 2)
+            break;
+        off += put_mac(buf + off, macs[i]);
+        buf[off++] = sep;
+    }
+    buf[off] = '\0';
+
+    return i;
+}
+
+/*
+ * Format an array of IPv6 addresses into one buffer
+ *
+ * Same contract as ecli_fmt_ipv4_array(). Addresses are written in the
+ * canonical form of inet_ntop(), "::" for the longest run of zeros.
+ *
+ * @param addrs IPv6 addresses
+ * @param n     Number of addresses
+ * @param sep   Character written after each entry (e.g., '\n')
+ * @param buf   Output buffer
+ * @param size  Size of buf
+ * @return Number of entries written
+ */
+size_t ecli_fmt_ipv6_array(const struct in6_addr addrs[], size_t n, char sep,
+                           char *buf, size_t size)
+{
+    size_t off = 0;
+    size_t i;
+
+    if (!buf || size == 0)
+        return 0;
+
+    for (i = 0; i < n; i++) {
+        /* Worst case: 45 characters, separator, final NUL */
+        if (size - off < INET6_ADDRSTRLEN + 1)
+            break;
+        if (!inet_ntop(AF_INET6, &addrs[i], buf + off, INET6_ADDRSTRLEN))
+            break;
+        off += strlen(buf + off);
+        buf[off++] = sep;
+    }
+    buf[off] = '\0';
+
+    return i;
+}
+
+/*
+ * Collect typed argument values in a single walk of the parse tree
+ *
+ * Each id in ids[] gets a slot at the same index in args->vals. The first
+ * match in pre-order wins, as with ec_pnode_find(). Values matched by an
+ * int or uint node are converted here by the node itself, so the range
+ * and base of the grammar apply. Values matched by the native address
+ * nodes are copied from the parse node. Other values keep their string
+ * form and are converted on demand by the ecli_args_*() accessors.
+ *
+ * @param parse Parse tree passed to the command handler
+ * @param args  Output argument table
+ * @param ids   Argument ids (as given to the ECLI_ARG_* macros)
+ * @param n     Number of ids (at most ECLI_ARGS_MAX)
+ * @return Number of ids found, -1 on error
+ */
+int ecli_args_collect(const struct ec_pnode *parse, ecli_args_t *args,
+                      const char *const ids[], size_t n)
+{
+    const struct ec_pnode *p;
+    size_t found = 0;
+
+    if (!parse || !args || !ids || n > ECLI_ARGS_MAX)
+        return -1;
+
+    memset(args, 0, sizeof(*args));
+    args->count = n;
+    for (size_t i = 0; i < n; i++)
+        args->ids[i] = ids[i];
+
+    EC_PNODE_FOREACH(p, parse) {
+        const struct ec_node *node = ec_pnode_get_node(p);
+        const char *id = ec_node_id(node);
+
+        if (!id || strcmp(id, EC_NO_ID) == 0)
+            continue;
+
+        for (size_t i = 0; i < n; i++) {
+            ecli_val_t *val = &args->vals[i];
+
+            if (val->type != ECLI_VAL_NONE || strcmp(ids[i], id) != 0)
+                continue;
+
+            /*
+             * Native nodes (ecli_node.c) already stored the binary value,
+             * ecli_exec() arguments only have that one
+             */
+            struct ec_dict *pattrs = ec_pnode_get_attrs((struct ec_pnode *)p);
+            const ecli_val_t *pre = pattrs ? ec_dict_get(pattrs, ECLI_VALUE_ATTR) : NULL;
+            if (pre) {
+                *val = *pre;
+                found++;
+                break;
+            }
+
+            const struct ec_strvec *vec = ec_pnode_get_strvec(p);
+            if (!vec || ec_strvec_len(vec) == 0)
+                break;
+
+            val->str = ec_strvec_val(vec, 0);
+            val->type = ECLI_VAL_STR;
+
+            const char *type = ec_node_type_name(ec_node_type(node));
+            if (strcmp(type, "int") == 0) {
+                if (ec_node_int_getval(node, val->str, &val->i64) == 0)
+                    val->type = ECLI_VAL_INT;
+            } else if (strcmp(type, "uint") == 0) {
+                if (ec_node_uint_getval(node, val->str, &val->u64) == 0)
+                    val->type = ECLI_VAL_UINT;
+            }
+
+            found++;
+            break;
+        }
+
+        if (found == n)
+            break;
+    }
+
+    return (int)found;
+}
+
+/*
+ * Check whether an argument slot was matched
+ */
+bool ecli_args_has(const ecli_args_t *args, size_t idx)
+{
+    return args && idx < args->count && args->vals[idx].type != ECLI_VAL_NONE;
+}
+
+/*
+ * Get the matched token of an argument slot
+ *
+ * @return Token string, or NULL if the argument is absent
+ */
+const char *ecli_args_str(const ecli_args_t *args, size_t idx)
+{
+    if (!ecli_args_has(args, idx))
+        return NULL;
+    return args->vals[idx].str;
+}
+
+/*
+ * Get a signed integer argument
+ *
+ * Values already converted by an int node are returned directly; other
+ * tokens (e.g. ECLI_ARG_HEX) are converted with strtoll() in base 0.
+ *
+ * @return Integer value, or def if absent or not a number
+ */
+int64_t ecli_args_int(const ecli_args_t *args, size_t idx, int64_t def)
+{
+    const ecli_val_t *val;
+    char *end;
+
+    if (!ecli_args_has(args, idx))
+        return def;
+
+    val = &args->vals[idx];
+    if (val->type == ECLI_VAL_INT)
+        return val->i64;
+    if (val->type == ECLI_VAL_UINT)
+        return val->u64 > INT64_MAX ? def : (int64_t)val->u64;
+    if (val->type != ECLI_VAL_STR)
+        return def;
+
+    errno = 0;
+    long long v = strtoll(val->str, &end, 0);
+    if (errno != 0 || end == val->str || *end != '\0')
+        return def;
+    return v;
+}
+
+/*
+ * Get an unsigned integer argument
+ *
+ * @return Integer value, or def if absent, negative or not a number
+ */
+uint64_t ecli_args_uint(const ecli_args_t *args, size_t idx, uint64_t def)
+{
+    const ecli_val_t *val;
+    char *end;
+
+    if (!ecli_args_has(args, idx))
+        return def;
+
+    val = &args->vals[idx];
+    if (val->type == ECLI_VAL_UINT)
+        return val->u64;
+    if (val->type == ECLI_VAL_INT)
+        return val->i64 < 0 ? def : (uint64_t)val->i64;
+    if (val->type != ECLI_VAL_STR || val->str[0] == '-')
+        return def;
+
+    errno = 0;
+    unsigned long long v = strtoull(val->str, &end, 0);
+    if (errno != 0 || end == val->str || *end != '\0')
+        return def;
+    return v;
+}
+
+/*
+ * Get an IPv4 prefix argument, converting it once
+ *
+ * Accepts both "a.b.c.d" (prefix_len set to -1) and "a.b.c.d/len".
+ * The converted value is cached in the slot for later calls.
+ *
+ * @return 0 on success, -1 if absent or invalid
+ */
+int ecli_args_ipv4_prefix(ecli_args_t *args, size_t idx,
+                          uint32_t *addr, int *prefix_len)
+{
+    ecli_val_t *val;
+
+    if (!ecli_args_has(args, idx) || !addr)
+        return -1;
+
+    val = &args->vals[idx];
+    if (val->type == ECLI_VAL_STR) {
+        if (strchr(val->str, '/')) {
+            if (ecli_parse_ipv4_prefix(val->str, &val->ipv4.addr,
+                                       &val->ipv4.prefix_len) < 0)
+                return -1;
+        } else {
+            if (ecli_parse_ipv4(val->str, &val->ipv4.addr) < 0)
+                return -1;
+            val->ipv4.prefix_len = -1;
+        }
+        val->type = ECLI_VAL_IPV4;
+    }
+
+    if (val->type != ECLI_VAL_IPV4)
+        return -1;
+
+    *addr = val->ipv4.addr;
+    if (prefix_len)
+        *prefix_len = val->ipv4.prefix_len;
+    return 0;
+}
+
+/*
+ * Get an IPv4 address argument (network byte order)
+ *
+ * @return 0 on success, -1 if absent or invalid
+ */
+int ecli_args_ipv4(ecli_args_t *args, size_t idx, uint32_t *addr)
+{
+    return ecli_args_ipv4_prefix(args, idx, addr, NULL);
+}
+
+/*
+ * Get an IPv6 address or prefix argument, converting it once
+ *
+ * prefix_len (optional) is set to -1 when no /len was given.
+ *
+ * @return 0 on success, -1 if absent or invalid
+ */
+int ecli_args_ipv6(ecli_args_t *args, size_t idx,
+                   struct in6_addr *addr, int *prefix_len)
+{
+    ecli_val_t *val;
+
+    if (!ecli_args_has(args, idx) || !addr)
+        return -1;
+
+    val = &args->vals[idx];
+    if (val->type == ECLI_VAL_STR) {
+        if (strchr(val->str, '/')) {
+            if (ecli_parse_ipv6_prefix(val->str, &val->ipv6.addr,
+                                       &val->ipv6.prefix_len) < 0)
+                return -1;
+        } else {
+            if (ecli_parse_ipv6(val->str, &val->ipv6.addr) < 0)
+                return -1;
+            val->ipv6.prefix_len = -1;
+        }
+        val->type = ECLI_VAL_IPV6;
+    }
+
+    if (val->type != ECLI_VAL_IPV6)
+        return -1;
+
+    *addr = val->ipv6.addr;
+    if (prefix_len)
+        *prefix_len = val->ipv6.prefix_len;
+    return 0;
+}
+
+/*
+ * Get a MAC address argument, converting it once
+ *
+ * @return 0 on success, -1 if absent or invalid
+ */
+int ecli_args_mac(ecli_args_t *args, size_t idx, uint8_t mac[6])
+{
+    ecli_val_t *val;
+
+    if (!ecli_args_has(args, idx) || !mac)
+        return -1;
+
+    val = &args->vals[idx];
+    if (val->type == ECLI_VAL_STR) {
+        if (ecli_parse_mac(val->str, val->mac) < 0)
+            return -1;
+        val->type = ECLI_VAL_MAC;
+    }
+
+    if (val->type != ECLI_VAL_MAC)
+        return -1;
+
+    memcpy(mac, val->mac, 6);
+    return 0;
+}
+
+/*
+ * Get the binary value stored by a native address node
+ *
+ * @param parse Parse tree passed to the command handler
+ * @param id    Argument id
+ * @return Value owned by the parse tree, or NULL if the argument is absent
+ *         or was not matched by a native node
+ */
+const ecli_val_t *ecli_arg_val(const struct ec_pnode *parse, const char *id)
+{
+    const struct ec_pnode *p = ec_pnode_find(parse, id);
+    if (!p)
+        return NULL;
+
+    struct ec_dict *attrs = ec_pnode_get_attrs((struct ec_pnode *)p);
+    return attrs ? ec_dict_get(attrs, ECLI_VALUE_ATTR) : NULL;
+}
@@ -17,7 +17,7 @@
  *   ECLI_ARG_FILENAME(id, help)  - Filename without spaces
  *   ECLI_ARG_PATH(id, help)      - File path (absolute or relative)
  *
- * NETWORK ADDRESSES:
+ * NETWORK ADDRESSES (native matcher nodes, value stored as binary):
  *   ECLI_ARG_IPV4(id, help)        - IPv4 address (e.g., "192.168.1.1")
  *   ECLI_ARG_IPV4_PREFIX(id, help) - IPv4 CIDR (e.g., "10.0.0.0/8")
  *   ECLI_ARG_IPV6(id, help)        - IPv6 address (e.g., "2001:db8::1")
@@ -53,6 +53,18 @@
  *   ECLI_ARG_ANY(id, help)            - Any single token
  *   ECLI_ARG_REGEX(id, pattern, help) - Custom regex pattern
  *
+ * PROGRAMMATIC EXECUTION (no text, no parser):
+ *   ECLI_EXEC(cli, cb_name, args...)  - Run a handler with typed arguments
+ *   ECLI_EXEC_STR(id, str)            - String argument
+ *   ECLI_EXEC_INT(id, v) / ECLI_EXEC_UINT(id, v)
+ *   ECLI_EXEC_IPV4(id, addr)          - IPv4 address (network byte order)
+ *   ECLI_EXEC_IPV4_PREFIX(id, addr, len)
+ *
+ * DYNAMIC COMPLETION (candidates from application state):
+ *   ECLI_ARG_DYN(id, help, child, provider, opaque)   - Any node + provider
+ *   ECLI_ARG_IFNAME_DYN(id, help, provider, opaque)   - Interface name
+ *   ECLI_ARG_NAME_DYN(id, help, provider, opaque)     - Generic identifier
+ *
  * USAGE EXAMPLES
  *
  * Example 1: Simple command with a name argument
@@ -92,12 +104,10 @@
  *       "configure interface IP address",
  *       ECLI_ARG_IPV4_PREFIX("prefix", "IP address with prefix (e.g., 192.168.1.1/24)"))
  *   {
- *       const char *prefix_str = ec_pnode_get_str(parse, "prefix");
- *       uint32_t addr;
- *       int prefix_len;
- *       if (ecli_parse_ipv4_prefix(prefix_str, &addr, &prefix_len) == 0) {
- *           printf("Configured: %s (prefix length: %d)\n", prefix_str, prefix_len);
- *       }
+ *       // The prefix node already converted the token, no re-parsing needed
+ *       const ecli_val_t *prefix = ecli_arg_val(parse, "prefix");
+ *       printf("Configured: %s (prefix length: %d)\n",
+ *              prefix->str, prefix->ipv4.prefix_len);
  *       return 0;
  *   }
  *   // Usage: ip address 192.168.1.1/24
@@ -211,10 +221,114 @@
  *   bool enabled;
  *   ecli_parse_bool(ec_pnode_get_str(parse, "state"), &enabled);
  *
+ * TYPED ARGUMENTS
+ *
+ * Handlers reading many arguments can collect them all in a single walk of
+ * the parse tree instead of one ec_pnode_find() per argument. Integer
+ * arguments are converted by their int/uint node during the walk, address
+ * arguments are converted on first access and cached:
+ *
+ *   enum { A_IP, A_MAC, A_VLAN };
+ *   ecli_args_t args;
+ *   ECLI_ARGS_COLLECT(parse, &args, "ip", "mac", "vlan");
+ *
+ *   uint32_t ip;
+ *   uint8_t mac[6];
+ *   if (ecli_args_ipv4(&args, A_IP, &ip) < 0 ||
+ *       ecli_args_mac(&args, A_MAC, mac) < 0)
+ *       return -1;
+ *   int64_t vlan = ecli_args_int(&args, A_VLAN, 1);
+ *
+ * Slots keep the order of the ids given to ECLI_ARGS_COLLECT. String
+ * pointers stay valid as long as the parse tree does.
+ *
+ * FORMATTING ADDRESSES
+ *
+ * ecli_fmt_ipv4() and ecli_fmt_mac() return per-thread rotating buffers,
+ * fine for a few calls in one ecli_output(). When the string must outlive
+ * that, format into your own buffer:
+ *
+ *   char ip[ECLI_FMT_IPV4_LEN], mac[ECLI_FMT_MAC_LEN];
+ *   ecli_fmt_ipv4_r(addr, ip, sizeof(ip));
+ *   ecli_fmt_mac_r(hwaddr, mac, sizeof(mac));
+ *
+ * Config output can skip the string entirely with the FMT_IPV4, FMT_MAC
+ * and FMT_IPV6 tags of ECLI_OUT_FMT (see ecli_cmd.h).
+ *
+ * BULK CONVERSION
+ *
+ * Table imports (static ARP, routes) can convert whole batches at once:
+ *
+ *   ecli_parse_ipv4_array(strs, addrs, n)               - n strings -> n addresses
+ *   ecli_parse_ipv4_prefix_array(strs, addrs, lens, n)  - n CIDR strings
+ *   ecli_parse_ipv6_array(strs, addrs, n)               - n IPv6 strings
+ *   ecli_parse_mac_array(strs, macs, n)                 - n MAC strings
+ *   ecli_fmt_ipv4_array(addrs, n, sep, buf, size)       - n addresses -> buf
+ *   ecli_fmt_mac_array(macs, n, sep, buf, size)         - n MACs -> buf
+ *   ecli_fmt_ipv6_array(addrs, n, sep, buf, size)       - n IPv6 addresses -> buf
+ *
+ * Parsers return the number of leading entries converted (the index of the
+ * first bad string when lower than n). Formatters return the number of
+ * entries that fit in buf; call again from there to continue.
+ *
+ * PROGRAMMATIC EXECUTION
+ *
+ * Applications replaying changes through their own handlers can call them
+ * by callback name (the yaml_cb of ECLI_DEFUN*) with typed values, instead
+ * of formatting a line for ecli_load_config() and parsing it back:
+ *
+ *   ret = ECLI_EXEC(NULL, "route_add",
+ *                   ECLI_EXEC_IPV4_PREFIX("prefix", htonl(0x0a000000), 8),
+ *                   ECLI_EXEC_IPV4("gateway", htonl(0xc0a80001)),
+ *                   ECLI_EXEC_UINT("metric", 10));
+ *
+ * The handler receives a parse tree holding the values as is:
+ * ecli_arg_val(), ECLI_ARGS_COLLECT(), ecli_arg_int() and the
+ * ecli_args_*() accessors read them without conversion. ecli_arg_str()
+ * formats typed values given without .str on first use; ecli_args_str()
+ * only returns .str, so pass string arguments with ECLI_EXEC_STR. Values
+ * are not checked against the grammar (ranges, patterns): the caller owns
+ * their validity.
+ *
+ * DYNAMIC COMPLETION
+ *
+ * Arguments whose valid values live in application state (interfaces,
+ * VLAN names, peers) can propose them on TAB. The provider fills a list
+ * of candidates; the argument is still validated by its child node:
+ *
+ *   static int list_ifaces(ecli_comp_list_t *list, void *opaque)
+ *   {
+ *       for (struct iface *i = iface_first(); i; i = iface_next(i))
+ *           if (ecli_comp_add(list, i->name) < 0)
+ *               break;              // deadline passed or out of memory
+ *       return 0;
+ *   }
+ *
+ *   ECLI_DEFUN_SUB(show, iface, "show_interface", "interface ifname",
+ *       "display an interface",
+ *       ECLI_ARG_IFNAME_DYN("ifname", "interface name", list_ifaces, NULL))
+ *
+ * Candidates are cached on the node for ECLI_DYN_TTL_MS. Once it
+ * expires, TAB still completes from the cached candidates while the
+ * provider runs again on a helper thread of the library. Only the first
+ * completion, with nothing cached yet, waits for the provider, and not
+ * longer than ECLI_DYN_TIMEOUT_MS: a provider blocked in a backend call
+ * never freezes a session, nor the other sessions completing the same
+ * argument. After the deadline, ecli_comp_add() refuses new entries and
+ * ecli_comp_expired() turns true; such a late list does not replace the
+ * previous candidates. Use ecli_node_dyn() for other TTL/timeout values.
+ *
+ * Threading: a provider runs on its own thread, at most one call at a
+ * time per node, with signals blocked. It is not serialized with command
+ * handlers (the handler lock is not held) nor with the providers of other
+ * nodes, so it must read application state in a thread-safe way. Freeing
+ * the node waits for a running call to return.
+ *
 
  */
 #pragma once
 
+#include <netinet/in.h>
 #include <ecoli.h>
 #include "ecli_cmd.h"
 
@@ -262,22 +376,22 @@
     _H((help), ec_node_re((id), ECLI_RE_PATH))
 
 #define ECLI_ARG_IPV4(id, help) \
-    _H((help), ec_node_re((id), ECLI_RE_IPV4))
+    _H((help), ecli_node_ipv4((id)))
 
 #define ECLI_ARG_IPV4_PREFIX(id, help) \
-    _H((help), ec_node_re((id), ECLI_RE_IPV4_PREFIX))
+    _H((help), ecli_node_ipv4_prefix((id)))
 
 #define ECLI_ARG_IPV6(id, help) \
-    _H((help), ec_node_re((id), ECLI_RE_IPV6))
+    _H((help), ecli_node_ipv6((id)))
 
 #define ECLI_ARG_IPV6_PREFIX(id, help) \
-    _H((help), ec_node_re((id), ECLI_RE_IPV6_PREFIX))
+    _H((help), ecli_node_ipv6_prefix((id)))
 
 #define ECLI_ARG_MAC(id, help) \
-    _H((help), ec_node_re((id), ECLI_RE_MAC))
+    _H((help), ecli_node_mac((id)))
 
 #define ECLI_ARG_MAC_ANY(id, help) \
-    _H((help), ec_node_re((id), ECLI_RE_MAC_ANY))
+    _H((help), ecli_node_mac_any((id)))
 
 #define ECLI_ARG_UINT(id, max, help) \
     _H((help), ec_node_int((id), 0, (max), 10))
@@ -353,6 +467,22 @@
 #define ECLI_ARG_REGEX(id, pattern, help) \
     _H((help), ec_node_re((id), (pattern)))
 
+/* Default cache TTL and provider deadline of dynamic completion */
+#define ECLI_DYN_TTL_MS     2000
+#define ECLI_DYN_TIMEOUT_MS 100
+
+#define ECLI_ARG_DYN(id, help, child, provider, opaque) \
+    _H((help), ecli_node_dyn((id), (child), (provider), (opaque), \
+                             ECLI_DYN_TTL_MS, ECLI_DYN_TIMEOUT_MS))
+
+#define ECLI_ARG_IFNAME_DYN(id, help, provider, opaque) \
+    ECLI_ARG_DYN((id), (help), ec_node_re(EC_NO_ID, ECLI_RE_IFNAME), \
+                 (provider), (opaque))
+
+#define ECLI_ARG_NAME_DYN(id, help, provider, opaque) \
+    ECLI_ARG_DYN((id), (help), ec_node_re(EC_NO_ID, ECLI_RE_NAME), \
+                 (provider), (opaque))
+
 /* Documentation format choice (md, rst, txt) */
 #define ECLI_ARG_DOC_FMT(id, help) \
     _H((help), EC_NODE_OR((id), \
@@ -364,9 +494,10 @@ int ecli_parse_ipv4(const char *str, uint32_t *addr);
 
 int ecli_parse_ipv4_prefix(const char *str, uint32_t *addr, int *prefix_len);
 
-struct in6_addr;
 int ecli_parse_ipv6(const char *str, struct in6_addr *addr);
 
+int ecli_parse_ipv6_prefix(const char *str, struct in6_addr *addr, int *prefix_len);
+
 int ecli_parse_mac(const char *str, uint8_t mac[6]);
 
 int ecli_parse_bool(const char *str, bool *value);
@@ -374,3 +505,186 @@ int ecli_parse_bool(const char *str, bool *value);
 const char *ecli_fmt_ipv4(uint32_t addr);
 
 const char *ecli_fmt_mac(const uint8_t mac[6]);
+
+/* Buffer sizes for the caller-buffer formatters (including the NUL) */
+#define ECLI_FMT_IPV4_LEN 16
+#define ECLI_FMT_MAC_LEN  18
+#define ECLI_FMT_IPV6_LEN INET6_ADDRSTRLEN
+
+const char *ecli_fmt_ipv4_r(uint32_t addr, char *buf, size_t size);
+
+const char *ecli_fmt_mac_r(const uint8_t mac[6], char *buf, size_t size);
+
+const char *ecli_fmt_ipv6_r(const struct in6_addr *addr, char *buf, size_t size);
+
+size_t ecli_parse_ipv4_array(const char *const strs[], uint32_t addrs[], size_t n);
+
+size_t ecli_parse_ipv4_prefix_array(const char *const strs[], uint32_t addrs[],
+                                    int prefix_lens[], size_t n);
+
+size_t ecli_parse_ipv6_array(const char *const strs[], struct in6_addr addrs[], size_t n);
+
+size_t ecli_parse_mac_array(const char *const strs[], uint8_t macs[][6], size_t n);
+
+size_t ecli_fmt_ipv4_array(const uint32_t addrs[], size_t n, char sep,
+                           char *buf, size_t size);
+
+size_t ecli_fmt_mac_array(const uint8_t macs[][6], size_t n, char sep,
+                          char *buf, size_t size);
+
+size_t ecli_fmt_ipv6_array(const struct in6_addr addrs[], size_t n, char sep,
+                           char *buf, size_t size);
+
+/* Maximum number of ids collected by one ecli_args_collect() call */
+#define ECLI_ARGS_MAX 16
+
+typedef enum {
+    ECLI_VAL_NONE = 0,  /* Argument not present in the parse tree */
+    ECLI_VAL_STR,       /* Matched token, not converted (yet) */
+    ECLI_VAL_INT,       /* Signed integer from an int node */
+    ECLI_VAL_UINT,      /* Unsigned integer from a uint node */
+    ECLI_VAL_IPV4,      /* IPv4 address (network byte order) */
+    ECLI_VAL_IPV6,      /* IPv6 address */
+    ECLI_VAL_MAC,       /* 6-byte MAC address */
+} ecli_val_type_t;
+
+typedef struct ecli_val {
+    ecli_val_type_t  type;
+    const char      *str;         /* Matched token, NULL if absent */
+    union {
+        int64_t  i64;
+        uint64_t u64;
+        struct {
+            uint32_t addr;        /* Network byte order */
+            int      prefix_len;  /* -1 when no /len was given */
+        } ipv4;
+        struct {
+            struct in6_addr addr;
+            int      prefix_len;  /* -1 when no /len was given */
+        } ipv6;
+        uint8_t  mac[6];
+    };
+} ecli_val_t;
+
+typedef struct ecli_args {
+    size_t      count;
+    const char *ids[ECLI_ARGS_MAX];
+    ecli_val_t  vals[ECLI_ARGS_MAX];
+} ecli_args_t;
+
+int ecli_args_collect(const struct ec_pnode *parse, ecli_args_t *args,
+                      const char *const ids[], size_t n);
+
+#define ECLI_ARGS_COLLECT(parse, args, ...) \
+    ecli_args_collect((parse), (args), \
+        (const char *const[]){ __VA_ARGS__ }, \
+        sizeof((const char *const[]){ __VA_ARGS__ }) / sizeof(const char *))
+
+bool ecli_args_has(const ecli_args_t *args, size_t idx);
+
+const char *ecli_args_str(const ecli_args_t *args, size_t idx);
+
+int64_t ecli_args_int(const ecli_args_t *args, size_t idx, int64_t def);
+
+uint64_t ecli_args_uint(const ecli_args_t *args, size_t idx, uint64_t def);
+
+int ecli_args_ipv4(ecli_args_t *args, size_t idx, uint32_t *addr);
+
+int ecli_args_ipv4_prefix(ecli_args_t *args, size_t idx,
+                          uint32_t *addr, int *prefix_len);
+
+int ecli_args_ipv6(ecli_args_t *args, size_t idx,
+                   struct in6_addr *addr, int *prefix_len);
+
+int ecli_args_mac(ecli_args_t *args, size_t idx, uint8_t mac[6]);
+
+/*
+ * Programmatic execution (ecli.c)
+ */
+typedef struct ecli_exec_arg {
+    const char *id;     /* Argument id, as given to ECLI_ARG_*() */
+    ecli_val_t  val;    /* Value, .str optional for typed values */
+} ecli_exec_arg_t;
+
+#define ECLI_EXEC_STR(id_, s) \
+    ((ecli_exec_arg_t){ .id = (id_), .val = { .type = ECLI_VAL_STR, .str = (s) } })
+#define ECLI_EXEC_INT(id_, v) \
+    ((ecli_exec_arg_t){ .id = (id_), .val = { .type = ECLI_VAL_INT, .i64 = (v) } })
+#define ECLI_EXEC_UINT(id_, v) \
+    ((ecli_exec_arg_t){ .id = (id_), .val = { .type = ECLI_VAL_UINT, .u64 = (v) } })
+#define ECLI_EXEC_IPV4(id_, a) \
+    ((ecli_exec_arg_t){ .id = (id_), \
+        .val = { .type = ECLI_VAL_IPV4, .ipv4 = { .addr = (a), .prefix_len = -1 } } })
+#define ECLI_EXEC_IPV4_PREFIX(id_, a, len) \
+    ((ecli_exec_arg_t){ .id = (id_), \
+        .val = { .type = ECLI_VAL_IPV4, .ipv4 = { .addr = (a), .prefix_len = (len) } } })
+
+/*
+ * Run the handler registered under cb_name with typed arguments
+ *
+ * cli NULL means the session running the current command, else the
+ * global context. With worker threads, the handler lock is taken as for
+ * session commands: don't call with ecli_lock() held.
+ *
+ * @return Handler return value, -1 on unknown command or argument
+ */
+int ecli_exec(eecli_ctx_t *cli, const char *cb_name,
+              const ecli_exec_arg_t *args, size_t nargs);
+
+#define ECLI_EXEC(cli, cb_name, ...) \
+    ecli_exec((cli), (cb_name), \
+        (const ecli_exec_arg_t[]){ __VA_ARGS__ }, \
+        sizeof((const ecli_exec_arg_t[]){ __VA_ARGS__ }) / sizeof(ecli_exec_arg_t))
+
+/*
+ * Native address nodes (ecli_node.c)
+ *
+ * Hand-written matchers used by ECLI_ARG_IPV4, ECLI_ARG_IPV4_PREFIX,
+ * ECLI_ARG_IPV6, ECLI_ARG_IPV6_PREFIX, ECLI_ARG_MAC and ECLI_ARG_MAC_ANY.
+ * They validate and convert the token in one pass and store the binary
+ * ecli_val_t on the parse node under ECLI_VALUE_ATTR, where
+ * ecli_args_collect() and ecli_arg_val() pick it up.
+ */
+#define ECLI_VALUE_ATTR "ecli.value"
+
+struct ec_node *ecli_node_ipv4(const char *id);
+
+struct ec_node *ecli_node_ipv4_prefix(const char *id);
+
+struct ec_node *ecli_node_ipv6(const char *id);
+
+struct ec_node *ecli_node_ipv6_prefix(const char *id);
+
+struct ec_node *ecli_node_mac(const char *id);
+
+struct ec_node *ecli_node_mac_any(const char *id);
+
+const ecli_val_t *ecli_arg_val(const struct ec_pnode *parse, const char *id);
+
+/*
+ * Dynamic completion node (ecli_node.c)
+ *
+ * Parses like its child node and completes with the candidates returned
+ * by a provider, cached for ttl_ms and refreshed on a helper thread. The
+ * provider gets timeout_ms to fill the list. The node takes ownership of
+ * child (freed on error).
+ */
+typedef struct ecli_comp_list ecli_comp_list_t;
+
+typedef int (*ecli_comp_provider_t)(ecli_comp_list_t *list, void *opaque);
+
+struct ec_node *ecli_node_dyn(const char *id, struct ec_node *child,
+                              ecli_comp_provider_t provider, void *opaque,
+                              unsigned int ttl_ms, unsigned int timeout_ms);
+
+/*
+ * Add a candidate to the list (copied)
+ *
+ * Returns: 0 on success, -1 once the deadline has passed or on ENOMEM
+ */
+int ecli_comp_add(ecli_comp_list_t *list, const char *str);
+
+/*
+ * Check whether the provider deadline has passed
+ */
+bool ecli_comp_expired(ecli_comp_list_t *list);
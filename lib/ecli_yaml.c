@@ -13,8 +13,8 @@
 #include <errno.h>
 #include <unistd.h>
 #include <limits.h>
-#include <sys/queue.h>
-#include "queue-extension.h"
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include <yaml.h>
 #include <ecoli.h>
@@ -27,87 +27,91 @@
 /* Attribute key for callback name in YAML */
 #define ECLI_YAML_CB_ATTR "callback"
 
+/*
+ * Registries
+ *
+ * Both are lists of immutable entries read without a lock: entries are
+ * only added, at the head, by an atomic store once filled in. Registering
+ * a name again adds an entry that shadows the previous one, which stays
+ * valid for readers until ecli_yaml_cleanup().
+ */
+
 /* Callback registry entry */
 struct cb_entry {
-    SLIST_ENTRY(cb_entry) next;
+    struct cb_entry *next;
     const char *name;
     ecli_yaml_cb_t callback;
 };
 
 /* Output format override entry */
 struct output_fmt_entry {
-    SLIST_ENTRY(output_fmt_entry) next;
+    struct output_fmt_entry *next;
     char *callback_name;
     char *fmt;
 };
 
 /* Callback registry */
-static SLIST_HEAD(, cb_entry) cb_registry = SLIST_HEAD_INITIALIZER(cb_registry);
+static _Atomic(struct cb_entry *) cb_registry = NULL;
 static size_t cb_count = 0;
 
 /* Output format override registry */
-static SLIST_HEAD(, output_fmt_entry) output_fmt_registry = SLIST_HEAD_INITIALIZER(output_fmt_registry);
+static _Atomic(struct output_fmt_entry *) output_fmt_registry = NULL;
 
-static bool initialized = false;
+/* Serializes registrations */
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* The registries are statically initialized, kept for API compatibility */
 int ecli_yaml_init(void)
 {
-    if (initialized)
-        return 0;
-
-    SLIST_INIT(&cb_registry);
-    cb_count = 0;
-    SLIST_INIT(&output_fmt_registry);
-    initialized = true;
-
     return 0;
 }
 
 void ecli_yaml_cleanup(void)
 {
     /* Free callback entries */
-    struct cb_entry *cb, *cb_tmp;
-    SLIST_FOREACH_SAFE(cb, &cb_registry, next, cb_tmp) {
-        SLIST_REMOVE(&cb_registry, cb, cb_entry, next);
+    struct cb_entry *cb = atomic_exchange(&cb_registry, NULL);
+    while (cb) {
+        struct cb_entry *next = cb->next;
         free(cb);
+        cb = next;
     }
-    cb_count = 0;
 
     /* Free output format entries */
-    struct output_fmt_entry *fmt, *fmt_tmp;
-    SLIST_FOREACH_SAFE(fmt, &output_fmt_registry, next, fmt_tmp) {
-        SLIST_REMOVE(&output_fmt_registry, fmt, output_fmt_entry, next);
+    struct output_fmt_entry *fmt = atomic_exchange(&output_fmt_registry, NULL);
+    while (fmt) {
+        struct output_fmt_entry *next = fmt->next;
         free(fmt->callback_name);
         free(fmt->fmt);
         free(fmt);
+        fmt = next;
     }
 
-    initialized = false;
+    pthread_mutex_lock(&registry_lock);
+    cb_count = 0;
+    pthread_mutex_unlock(&registry_lock);
 }
 
-int ecli_yaml_register(const char *name, ecli_yaml_cb_t callback)
+static struct cb_entry *find_callback(const char *name)
 {
-    if (!initialized) {
-        if (ecli_yaml_init() < 0)
-            return -1;
+    struct cb_entry *entry = atomic_load_explicit(&cb_registry, memory_order_acquire);
+
+    for (; entry; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0)
+            return entry;
     }
 
+    return NULL;
+}
+
+int ecli_yaml_register(const char *name, ecli_yaml_cb_t callback)
+{
     if (name == NULL || callback == NULL) {
         errno = EINVAL;
         return -1;
     }
 
-    /* Check for duplicate */
-    struct cb_entry *entry;
-    SLIST_FOREACH(entry, &cb_registry, next) {
-        if (strcmp(entry->name, name) == 0) {
-            entry->callback = callback;
-            return 0;
-        }
-    }
-
     /* Allocate new entry */
-    entry = malloc(sizeof(*entry));
+    struct cb_entry *entry = malloc(sizeof(*entry));
     if (!entry) {
         errno = ENOMEM;
         return -1;
@@ -115,8 +119,14 @@ int ecli_yaml_register(const char *name, ecli_yaml_cb_t callback)
 
     entry->name = name;
     entry->callback = callback;
-    SLIST_INSERT_HEAD(&cb_registry, entry, next);
-    cb_count++;
+
+    pthread_mutex_lock(&registry_lock);
+    /* A duplicate is shadowed, not counted twice */
+    if (!find_callback(name))
+        cb_count++;
+    entry->next = atomic_load_explicit(&cb_registry, memory_order_relaxed);
+    atomic_store_explicit(&cb_registry, entry, memory_order_release);
+    pthread_mutex_unlock(&registry_lock);
 
     return 0;
 }
@@ -126,13 +136,8 @@ static ecli_yaml_cb_t lookup_callback(const char *name)
     if (name == NULL)
         return NULL;
 
-    struct cb_entry *entry;
-    SLIST_FOREACH(entry, &cb_registry, next) {
-        if (strcmp(entry->name, name) == 0)
-            return entry->callback;
-    }
-
-    return NULL;
+    struct cb_entry *entry = find_callback(name);
+    return entry ? entry->callback : NULL;
 }
 
 const char *ecli_yaml_get_callback_name(const struct ec_pnode *parse)
@@ -182,28 +187,13 @@ int ecli_yaml_dispatch(eecli_ctx_t *cli, const struct ec_pnode *parse)
  */
 static int ecli_yaml_register_output_fmt(const char *callback_name, const char *fmt)
 {
-    if (!initialized) {
-        if (ecli_yaml_init() < 0)
-            return -1;
-    }
-
     if (callback_name == NULL || fmt == NULL) {
         errno = EINVAL;
         return -1;
     }
 
-    /* Check for existing entry and update */
-    struct output_fmt_entry *entry;
-    SLIST_FOREACH(entry, &output_fmt_registry, next) {
-        if (strcmp(entry->callback_name, callback_name) == 0) {
-            free(entry->fmt);
-            entry->fmt = strdup(fmt);
-            return entry->fmt ? 0 : -1;
-        }
-    }
-
-    /* Allocate new entry */
-    entry = malloc(sizeof(*entry));
+    /* Allocate new entry, shadowing any previous one for this callback */
+    struct output_fmt_entry *entry = malloc(sizeof(*entry));
     if (!entry) {
         errno = ENOMEM;
         return -1;
@@ -219,7 +209,10 @@ static int ecli_yaml_register_output_fmt(const char *callback_name, const char *
         return -1;
     }
 
-    SLIST_INSERT_HEAD(&output_fmt_registry, entry, next);
+    pthread_mutex_lock(&registry_lock);
+    entry->next = atomic_load_explicit(&output_fmt_registry, memory_order_relaxed);
+    atomic_store_explicit(&output_fmt_registry, entry, memory_order_release);
+    pthread_mutex_unlock(&registry_lock);
 
     return 0;
 }
@@ -354,8 +347,9 @@ const char *ecli_yaml_get_output_fmt(const char *callback_name)
     if (callback_name == NULL)
         return NULL;
 
-    struct output_fmt_entry *entry;
-    SLIST_FOREACH(entry, &output_fmt_registry, next) {
+    struct output_fmt_entry *entry =
+        atomic_load_explicit(&output_fmt_registry, memory_order_acquire);
+    for (; entry; entry = entry->next) {
         if (strcmp(entry->callback_name, callback_name) == 0)
             return entry->fmt;
     }
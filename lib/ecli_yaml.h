@@ -100,6 +100,8 @@
  *   str    - Literal string
  *   int    - Integer with min/max/base
  *   re     - Regular expression pattern
+ *   ipv4, ipv4_prefix, ipv6, ipv6_prefix, mac, mac_any
+ *          - Native address matchers (no attributes besides id)
  *
  * TRANSLATION EXAMPLES
  *
@@ -0,0 +1,206 @@
+/*
+ * CLI Common Type Parsing Benchmark
+ *
+ * Copyright (C) 2026 Free Mobile, Vincent Jardin <vjardin@free.fr>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ *
+ * Times the bulk converters of ecli_types.c against the libc loops they
+ * replace (inet_pton, inet_ntop, sscanf) on the same generated table.
+ * Run with "meson test -C build --benchmark -v", or directly with an
+ * optional entry count.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "ecli_types.h"
+
+#define BENCH_ENTRIES 100000
+#define BENCH_ROUNDS  20
+
+static size_t g_n;
+static char (*g_v4)[INET_ADDRSTRLEN];
+static char (*g_v6)[INET6_ADDRSTRLEN];
+static char (*g_mac)[18];
+static const char **g_v4_strs, **g_v6_strs, **g_mac_strs;
+static uint32_t *g_addrs4;
+static struct in6_addr *g_addrs6;
+static uint8_t (*g_macs)[6];
+static char *g_buf;
+static size_t g_buf_size;
+
+/* Keeps the results alive so the loops are not optimized away */
+static volatile size_t g_sink;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double ours, double libc)
+{
+    double per = 1e9 / ((double)g_n * BENCH_ROUNDS);
+
+    printf("%-12s %8.1f ns/entry   libc %8.1f ns/entry   x%.2f\n",
+           name, ours * per, libc * per, libc / ours);
+}
+
+static int setup(size_t n)
+{
+    uint32_t seed = 12345;
+
+    g_n = n;
+    g_v4 = calloc(n, sizeof(*g_v4));
+    g_v6 = calloc(n, sizeof(*g_v6));
+    g_mac = calloc(n, sizeof(*g_mac));
+    g_v4_strs = calloc(n, sizeof(*g_v4_strs));
+    g_v6_strs = calloc(n, sizeof(*g_v6_strs));
+    g_mac_strs = calloc(n, sizeof(*g_mac_strs));
+    g_addrs4 = calloc(n, sizeof(*g_addrs4));
+    g_addrs6 = calloc(n, sizeof(*g_addrs6));
+    g_macs = calloc(n, sizeof(*g_macs));
+    g_buf_size = n * INET6_ADDRSTRLEN + 1;
+    g_buf = malloc(g_buf_size);
+    if (!g_v4 || !g_v6 || !g_mac || !g_v4_strs || !g_v6_strs || !g_mac_strs ||
+        !g_addrs4 || !g_addrs6 || !g_macs || !g_buf)
+        return -1;
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t r[4];
+
+        for (int j = 0; j < 4; j++) {
+            seed = seed * 1103515245 + 12345;
+            r[j] = seed;
+        }
+        snprintf(g_v4[i], sizeof(g_v4[i]), "%u.%u.%u.%u",
+                 r[0] >> 24, (r[0] >> 16) & 0xff, (r[1] >> 8) & 0xff, r[1] & 0xff);
+        snprintf(g_v6[i], sizeof(g_v6[i]), "2001:db8:%x:%x::%x:%x",
+                 r[0] >> 16, r[1] & 0xffff, r[2] >> 16, r[3] & 0xffff);
+        snprintf(g_mac[i], sizeof(g_mac[i]), "%02x:%02x:%02x:%02x:%02x:%02x",
+                 r[0] >> 24, (r[0] >> 16) & 0xff, r[2] >> 24, (r[2] >> 8) & 0xff,
+                 r[3] >> 24, r[3] & 0xff);
+        g_v4_strs[i] = g_v4[i];
+        g_v6_strs[i] = g_v6[i];
+        g_mac_strs[i] = g_mac[i];
+    }
+    return 0;
+}
+
+static int bench_parse_ipv4(void)
+{
+    double t0, t1, t2;
+    size_t ok = 0;
+
+    t0 = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++)
+        ok += ecli_parse_ipv4_array(g_v4_strs, g_addrs4, g_n);
+    t1 = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++)
+        for (size_t i = 0; i < g_n; i++)
+            ok += inet_pton(AF_INET, g_v4_strs[i], &g_addrs4[i]) == 1;
+    t2 = now();
+
+    g_sink = ok;
+    report("parse ipv4", t1 - t0, t2 - t1);
+    return ok == 2 * g_n * BENCH_ROUNDS ? 0 : -1;
+}
+
+static int bench_parse_ipv6(void)
+{
+    double t0, t1, t2;
+    size_t ok = 0;
+
+    t0 = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++)
+        ok += ecli_parse_ipv6_array(g_v6_strs, g_addrs6, g_n);
+    t1 = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++)
+        for (size_t i = 0; i < g_n; i++)
+            ok += inet_pton(AF_INET6, g_v6_strs[i], &g_addrs6[i]) == 1;
+    t2 = now();
+
+    g_sink = ok;
+    report("parse ipv6", t1 - t0, t2 - t1);
+    return ok == 2 * g_n * BENCH_ROUNDS ? 0 : -1;
+}
+
+static int bench_parse_mac(void)
+{
+    double t0, t1, t2;
+    size_t ok = 0;
+
+    t0 = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++)
+        ok += ecli_parse_mac_array(g_mac_strs, g_macs, g_n);
+    t1 = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (size_t i = 0; i < g_n; i++) {
+            unsigned int b[6];
+
+            if (sscanf(g_mac_strs[i], "%2x:%2x:%2x:%2x:%2x:%2x",
+                       &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6)
+                continue;
+            for (int j = 0; j < 6; j++)
+                g_macs[i][j] = (uint8_t)b[j];
+            ok++;
+        }
+    }
+    t2 = now();
+
+    g_sink = ok;
+    report("parse mac", t1 - t0, t2 - t1);
+    return ok == 2 * g_n * BENCH_ROUNDS ? 0 : -1;
+}
+
+static int bench_fmt_ipv4(void)
+{
+    double t0, t1, t2;
+    size_t ok = 0;
+
+    t0 = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++)
+        ok += ecli_fmt_ipv4_array(g_addrs4, g_n, '\n', g_buf, g_buf_size);
+    t1 = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        size_t off = 0;
+
+        for (size_t i = 0; i < g_n; i++) {
+            if (!inet_ntop(AF_INET, &g_addrs4[i], g_buf + off, INET_ADDRSTRLEN))
+                break;
+            off += strlen(g_buf + off);
+            g_buf[off++] = '\n';
+            ok++;
+        }
+        g_buf[off] = '\0';
+    }
+    t2 = now();
+
+    g_sink = ok;
+    report("fmt ipv4", t1 - t0, t2 - t1);
+    return ok == 2 * g_n * BENCH_ROUNDS ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : BENCH_ENTRIES;
+
+    if (n == 0 || setup(n) < 0) {
+        fprintf(stderr, "Failed to set up %zu entries\n", n);
+        return 1;
+    }
+
+    printf("%zu entries, %d rounds\n", g_n, BENCH_ROUNDS);
+    if (bench_parse_ipv4() < 0 || bench_parse_ipv6() < 0 ||
+        bench_parse_mac() < 0 || bench_fmt_ipv4() < 0) {
+        fprintf(stderr, "Conversion mismatch\n");
+        return 1;
+    }
+    return 0;
+}
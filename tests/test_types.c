@@ -0,0 +1,144 @@
+/*
+ * CLI Common Type Parsing Tests
+ *
+ * Copyright (C) 2026 Free Mobile, Vincent Jardin <vjardin@free.fr>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ *
+ * Checks the hand-rolled scanners of ecli_types.c, in particular on the
+ * partial tokens completion feeds them while a user is typing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include "ecli_types.h"
+
+static int g_failed;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        g_failed++; \
+    } \
+} while (0)
+
+/*
+ * Parse a MAC address from a heap copy sized to the string, so reading
+ * past its end is caught by sanitizers
+ */
+static int parse_mac_exact(const char *str, uint8_t mac[6])
+{
+    char *copy = strdup(str);
+    int ret;
+
+    if (!copy)
+        return -1;
+    ret = ecli_parse_mac(copy, mac);
+    free(copy);
+    return ret;
+}
+
+static void test_mac(void)
+{
+    static const char *const truncated[] = {
+        "", "a", "ab", "ab:", "ab:cd", "ab:cd:", "ab:cd:ef:01:23", "ab:cd:ef:01:23:",
+    };
+    static const char *const invalid[] = {
+        "ab:cd-ef:01:23:45", "ab:cd:ef:01:23:45:", "abc:cd:ef:01:23:45", "ab.cd.ef.01.23.45",
+        "ab:cd:ef:01:23:4g",
+    };
+    static const uint8_t expect[6] = { 0xab, 0xcd, 0xef, 0x01, 0x23, 0x45 };
+    const char *const strs[] = { "ab:cd:ef:01:23:45", "ab:cd" };
+    uint8_t mac[6], macs[2][6];
+
+    for (size_t i = 0; i < sizeof(truncated) / sizeof(truncated[0]); i++)
+        CHECK(parse_mac_exact(truncated[i], mac) < 0);
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+        CHECK(parse_mac_exact(invalid[i], mac) < 0);
+
+    /* A NUL is never taken for a separator */
+    CHECK(ecli_parse_mac("ab\0cd\0ef\0" "01\0" "23\0" "45", mac) < 0);
+
+    CHECK(parse_mac_exact("ab:cd:ef:01:23:45", mac) == 0 && memcmp(mac, expect, 6) == 0);
+    CHECK(parse_mac_exact("AB-CD-EF-1-23-45", mac) == 0 && memcmp(mac, expect, 6) == 0);
+
+    CHECK(ecli_parse_mac_array(strs, macs, 2) == 1);
+}
+
+static void test_ipv4(void)
+{
+    uint32_t addr;
+    int plen;
+
+    CHECK(ecli_parse_ipv4("192.0.2.1", &addr) == 0 && addr == htonl(0xc0000201));
+    CHECK(ecli_parse_ipv4("192.0.2", &addr) < 0);
+    CHECK(ecli_parse_ipv4("192.0.2.", &addr) < 0);
+    CHECK(ecli_parse_ipv4("192.0.2.01", &addr) < 0);
+    CHECK(ecli_parse_ipv4("192.0.2.256", &addr) < 0);
+    CHECK(ecli_parse_ipv4_prefix("10.0.0.0/8", &addr, &plen) == 0 && plen == 8);
+    CHECK(ecli_parse_ipv4_prefix("10.0.0.0/", &addr, &plen) < 0);
+    CHECK(ecli_parse_ipv4_prefix("10.0.0.0/33", &addr, &plen) < 0);
+}
+
+static void test_ipv6(void)
+{
+    static const char *const strs[] = {
+        "::", "::1", "1::", "2001:db8::1", "1:2:3:4:5:6:7:8", "1:2:3:4:5:6:7::",
+        "::2:3:4:5:6:7:8", "::ffff:192.0.2.1", "1:2:3:4:5:6:192.0.2.1", "FE80::AbCd",
+        "1::2:3:4:5:6:7:8", ":1::", "1:::2", "1::2::3", "12345::", "1:2", "1:", ":",
+        "", "192.0.2.1", "1:2:3:4:5:6:7:192.0.2.1", "::192.0.2.01", "::1.2.3", "::1/64",
+    };
+    struct in6_addr addr, ref;
+    int plen;
+
+    /* Same answer as inet_pton() */
+    for (size_t i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+        int ok = inet_pton(AF_INET6, strs[i], &ref) == 1;
+
+        CHECK((ecli_parse_ipv6(strs[i], &addr) == 0) == ok);
+        CHECK(!ok || memcmp(&addr, &ref, sizeof(ref)) == 0);
+    }
+
+    CHECK(ecli_parse_ipv6_prefix("2001:db8::/32", &addr, &plen) == 0 && plen == 32);
+    CHECK(ecli_parse_ipv6_prefix("2001:db8::", &addr, &plen) < 0);
+    CHECK(ecli_parse_ipv6_prefix("2001:db8::/129", &addr, &plen) < 0);
+}
+
+static void test_fmt_array(void)
+{
+    const char *const v6[] = { "2001:db8::1", "::ffff:192.0.2.1", "1:2:3:4:5:6:7:8" };
+    struct in6_addr addrs6[3];
+    uint32_t addrs4[2] = { htonl(0xc0000201), htonl(0x0a000001) };
+    char buf[128];
+
+    CHECK(ecli_fmt_ipv4_array(addrs4, 2, ' ', buf, sizeof(buf)) == 2);
+    CHECK(strcmp(buf, "192.0.2.1 10.0.0.1 ") == 0);
+    CHECK(ecli_fmt_ipv4_array(addrs4, 2, ' ', buf, 20) == 1);
+    CHECK(strcmp(buf, "192.0.2.1 ") == 0);
+
+    CHECK(ecli_parse_ipv6_array(v6, addrs6, 3) == 3);
+    CHECK(ecli_fmt_ipv6_array(addrs6, 3, '\n', buf, sizeof(buf)) == 3);
+    CHECK(strcmp(buf, "2001:db8::1\n::ffff:192.0.2.1\n1:2:3:4:5:6:7:8\n") == 0);
+
+    /* Only whole entries, room for the longest form each time */
+    CHECK(ecli_fmt_ipv6_array(addrs6, 3, '\n', buf, 58) == 1);
+    CHECK(strcmp(buf, "2001:db8::1\n") == 0);
+    CHECK(ecli_fmt_ipv6_array(addrs6, 3, '\n', buf, 40) == 0 && buf[0] == '\0');
+}
+
+int main(void)
+{
+    test_mac();
+    test_ipv4();
+    test_ipv6();
+    test_fmt_array();
+
+    if (g_failed) {
+        fprintf(stderr, "%d check(s) failed\n", g_failed);
+        return 1;
+    }
+    return 0;
+}
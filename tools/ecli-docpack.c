@@ -0,0 +1,196 @@
+/*
+ * CLI Documentation Packer
+ *
+ * Copyright (C) 2026 Free Mobile, Vincent Jardin <vjardin@free.fr>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ *
+ * Post-link tool for applications built with -DECLI_DOC_COMPRESSED.
+ * Extracts the raw ECLI_DOC records from the "ecli_doc_text" section,
+ * compresses them into a single zlib blob and replaces the section with
+ * a non-loaded "ecli_docz" section, which libecli inflates on the first
+ * documentation lookup.
+ *
+ * Usage:
+ *   ecli-docpack <input-binary> <output-binary>
+ *
+ * The section surgery is done with objcopy ($OBJCOPY if set).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <zlib.h>
+
+#include "ecli_cmd.h"
+
+/*
+ * Run a command and wait for it
+ *
+ * @return 0 if the command exited with status 0, -1 otherwise
+ */
+static int run(char *const argv[])
+{
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "fork: %s\n", strerror(errno));
+        return -1;
+    }
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+
+    if (waitpid(pid, &status, 0) < 0)
+        return -1;
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+/*
+ * Read a whole file into memory
+ */
+static unsigned char *read_file(const char *path, size_t *size)
+{
+    unsigned char *buf = NULL;
+    FILE *fp;
+    long len;
+
+    fp = fopen(path, "rb");
+    if (!fp)
+        return NULL;
+
+    if (fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) >= 0 &&
+        fseek(fp, 0, SEEK_SET) == 0) {
+        buf = malloc(len ? (size_t)len : 1);
+        if (buf && fread(buf, 1, (size_t)len, fp) != (size_t)len) {
+            free(buf);
+            buf = NULL;
+        }
+        *size = (size_t)len;
+    }
+
+    fclose(fp);
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    const char *objcopy = getenv("OBJCOPY");
+    const char *tmpdir = getenv("TMPDIR");
+    char raw_path[PATH_MAX], blob_path[PATH_MAX], add_arg[PATH_MAX + 32];
+    unsigned char *raw = NULL, *zbuf = NULL;
+    size_t raw_size = 0;
+    uLongf zsize;
+    ecli_docz_hdr_t hdr;
+    FILE *fp = NULL;
+    int fd, ret = 1;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <input-binary> <output-binary>\n", argv[0]);
+        return 1;
+    }
+    if (!objcopy || !objcopy[0])
+        objcopy = "objcopy";
+    if (!tmpdir || !tmpdir[0])
+        tmpdir = "/tmp";
+
+    snprintf(raw_path, sizeof(raw_path), "%s/ecli-doc-XXXXXX", tmpdir);
+    snprintf(blob_path, sizeof(blob_path), "%s/ecli-docz-XXXXXX", tmpdir);
+    if ((fd = mkstemp(raw_path)) < 0) {
+        fprintf(stderr, "mkstemp: %s\n", strerror(errno));
+        return 1;
+    }
+    close(fd);
+    if ((fd = mkstemp(blob_path)) < 0) {
+        fprintf(stderr, "mkstemp: %s\n", strerror(errno));
+        unlink(raw_path);
+        return 1;
+    }
+    close(fd);
+
+    /* Extract the raw records */
+    char *dump[] = {
+        (char *)objcopy, "-O", "binary",
+        "--only-section=" ECLI_DOC_TEXT_SECTION,
+        argv[1], raw_path, NULL
+    };
+    if (run(dump) < 0) {
+        fprintf(stderr, "Failed to extract section %s from %s\n",
+                ECLI_DOC_TEXT_SECTION, argv[1]);
+        goto out;
+    }
+
+    raw = read_file(raw_path, &raw_size);
+    if (!raw) {
+        fprintf(stderr, "Cannot read %s: %s\n", raw_path, strerror(errno));
+        goto out;
+    }
+    if (raw_size == 0) {
+        fprintf(stderr, "No %s section in %s (built with -DECLI_DOC_COMPRESSED?)\n",
+                ECLI_DOC_TEXT_SECTION, argv[1]);
+        goto out;
+    }
+    if (raw_size > UINT32_MAX) {
+        fprintf(stderr, "Documentation too large (%zu bytes)\n", raw_size);
+        goto out;
+    }
+
+    /* Compress into one blob */
+    zsize = compressBound(raw_size);
+    zbuf = malloc(zsize);
+    if (!zbuf || compress2(zbuf, &zsize, raw, raw_size, Z_BEST_COMPRESSION) != Z_OK) {
+        fprintf(stderr, "Failed to compress documentation\n");
+        goto out;
+    }
+
+    memcpy(hdr.magic, ECLI_DOCZ_MAGIC, sizeof(hdr.magic));
+    hdr.raw_size = (uint32_t)raw_size;
+
+    fp = fopen(blob_path, "wb");
+    if (!fp || fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fwrite(zbuf, 1, zsize, fp) != zsize) {
+        fprintf(stderr, "Cannot write %s: %s\n", blob_path, strerror(errno));
+        goto out;
+    }
+    if (fclose(fp) != 0) {
+        fp = NULL;
+        fprintf(stderr, "Cannot write %s: %s\n", blob_path, strerror(errno));
+        goto out;
+    }
+    fp = NULL;
+
+    /* Swap the raw section for the packed one (not loaded at runtime) */
+    snprintf(add_arg, sizeof(add_arg), "%s=%s", ECLI_DOCZ_SECTION, blob_path);
+    char *pack[] = {
+        (char *)objcopy,
+        "--remove-section=" ECLI_DOC_TEXT_SECTION,
+        "--add-section", add_arg,
+        "--set-section-flags", ECLI_DOCZ_SECTION "=readonly,contents",
+        argv[1], argv[2], NULL
+    };
+    if (run(pack) < 0) {
+        fprintf(stderr, "Failed to write %s\n", argv[2]);
+        goto out;
+    }
+
+    printf("%s: documentation packed, %zu -> %lu bytes\n",
+           argv[2], raw_size, (unsigned long)(zsize + sizeof(hdr)));
+    ret = 0;
+
+out:
+    if (fp)
+        fclose(fp);
+    free(zbuf);
+    free(raw);
+    unlink(raw_path);
+    unlink(blob_path);
+    return ret;
+}